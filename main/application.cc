@@ -357,6 +357,7 @@ void Application::Start() {
 
     /* Setup the audio service */
     auto codec = board.GetAudioCodec();
+    audio_service_.SetUplinkProfile(board.GetUplinkProfile());
     audio_service_.Initialize(codec);
     audio_service_.Start();
 
@@ -370,6 +371,15 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+#if CONFIG_USE_SPECULATIVE_PRECONNECT
+    callbacks.on_wake_word_speech_start = [this]() {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateIdle && protocol_) {
+                protocol_->PreConnect();
+            }
+        });
+    };
+#endif
     audio_service_.SetCallbacks(callbacks);
 
     // Start the main event loop task with priority 3
@@ -411,6 +421,7 @@ void Application::Start() {
         protocol_ = std::make_unique<MqttProtocol>();
     }
 
+    protocol_->SetUplinkProfile(board.GetUplinkProfile());
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
@@ -421,7 +432,7 @@ void Application::Start() {
     });
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
         if (device_state_ == kDeviceStateSpeaking) {
-            audio_service_.PushPacketToDecodeQueue(std::move(packet));
+            audio_service_.PushPacketToJitterBuffer(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -430,28 +441,38 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+        // The server hello may have overridden the uplink profile
+        audio_service_.SetUplinkProfile(protocol_->uplink_profile());
+        audio_service_.SetUplinkHeadroom(protocol_->GetAudioHeadroom());
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        ESP_LOGI(TAG, "Audio channel closed, %u audio bytes sent", protocol_->audio_bytes_sent());
+        auto receive = protocol_->GetAudioReceiveStatistics();
+        if (receive.received_count > 0) {
+            ESP_LOGI(TAG, "Audio received: %lu, lost: %lu, reordered: %lu, duplicate: %lu, too old: %lu, jump: %lu",
+                receive.received_count, receive.lost_count, receive.reordered_count, receive.duplicate_count,
+                receive.too_old_count, receive.jump_count);
+        }
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+    protocol_->OnIncomingJson([this, display](const ControlMessage& message) {
+        // Fields are slices of the received text, copy whatever is kept
+        auto type = message.type();
+        if (type == "tts") {
+            auto state = message.Get("state");
+            if (state == "start") {
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (state == "stop") {
                 Schedule([this]() {
                     if (device_state_ == kDeviceStateSpeaking) {
                         if (listening_mode_ == kListeningModeManualStop) {
@@ -461,63 +482,67 @@ void Application::Start() {
                         }
                     }
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
+            } else if (state == "sentence_start") {
+                auto text = message.Get("text");
+                if (text.IsString()) {
+                    auto text_str = text.ToString();
+                    ESP_LOGI(TAG, "<< %s", text_str.c_str());
+                    Schedule([this, display, message = std::move(text_str)]() {
                         display->SetChatMessage("assistant", message.c_str());
                     });
                 }
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
+        } else if (type == "stt") {
+            auto text = message.Get("text");
+            if (text.IsString()) {
+                auto text_str = text.ToString();
+                ESP_LOGI(TAG, ">> %s", text_str.c_str());
+                Schedule([this, display, message = std::move(text_str)]() {
                     display->SetChatMessage("user", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
+        } else if (type == "llm") {
+            auto emotion = message.Get("emotion");
+            if (emotion.IsString()) {
+                Schedule([this, display, emotion_str = emotion.ToString()]() {
                     display->SetEmotion(emotion_str.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
+        } else if (type == "mcp") {
+            // The payload text goes to the MCP server as it is, without being printed again
+            auto payload = message.Get("payload");
+            if (payload.IsObject()) {
+                McpServer::GetInstance().ParseMessage(payload.raw);
             }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
+        } else if (type == "system") {
+            auto command = message.Get("command");
+            if (command.IsString()) {
+                auto command_str = command.ToString();
+                ESP_LOGI(TAG, "System command: %s", command_str.c_str());
+                if (command_str == "reboot") {
                     // Do a reboot if user requests a OTA update
                     Schedule([this]() {
                         Reboot();
                     });
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    ESP_LOGW(TAG, "Unknown system command: %s", command_str.c_str());
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
+        } else if (type == "alert") {
+            auto status = message.Get("status");
+            auto alert_message = message.Get("message");
+            auto emotion = message.Get("emotion");
+            if (status.IsString() && alert_message.IsString() && emotion.IsString()) {
+                Alert(status.ToString().c_str(), alert_message.ToString().c_str(), emotion.ToString().c_str(), Lang::Sounds::OGG_VIBRATION);
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
 #if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
+        } else if (type == "custom") {
+            auto payload = message.Get("payload");
+            if (payload.IsObject()) {
+                ESP_LOGI(TAG, "Received custom message: %.*s", (int)payload.raw.size(), payload.raw.data());
+                Schedule([this, display, payload_str = std::string(payload.raw)]() {
                     display->SetChatMessage("system", payload_str.c_str());
                 });
             } else {
@@ -525,7 +550,7 @@ void Application::Start() {
             }
 #endif
         } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            ESP_LOGW(TAG, "Unknown message type: %s", type.ToString().c_str());
         }
     });
     bool protocol_started = protocol_->Start();
@@ -601,6 +626,11 @@ void Application::MainEventLoop() {
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+
+            // Let the jitter buffer wait for packets the network is currently reordering
+            if (device_state_ == kDeviceStateSpeaking && protocol_) {
+                audio_service_.SetDownlinkReorderDepth(protocol_->GetAudioReceiveStatistics().reorder_depth);
+            }
         
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
@@ -701,6 +731,9 @@ void Application::SetDeviceState(DeviceState state) {
             if (!audio_service_.IsAudioProcessorRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
+#if CONFIG_USE_VAD_GATED_UPLINK
+                audio_service_.EnableUplinkGate(listening_mode_ != kListeningModeAutoStop);
+#endif
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
             }
@@ -840,6 +873,21 @@ void Application::SendMcpMessage(const std::string& payload) {
     }
 }
 
+void Application::SendMcpMessage(std::function<bool(const TextWriter& write)> write_payload, size_t size_hint) {
+    if (protocol_ == nullptr) {
+        return;
+    }
+
+    // The fragments must not be interleaved with other messages, so they are sent from the main thread too
+    if (xTaskGetCurrentTaskHandle() == main_event_loop_task_handle_) {
+        protocol_->SendMcpMessage(write_payload, size_hint);
+    } else {
+        Schedule([this, write_payload = std::move(write_payload), size_hint]() {
+            protocol_->SendMcpMessage(write_payload, size_hint);
+        });
+    }
+}
+
 void Application::SetAecMode(AecMode mode) {
     aec_mode_ = mode;
     Schedule([this]() {
@@ -5,10 +5,16 @@
 #include "lvgl_theme.h"
 #include "emote_display.h"
 
+#include "settings.h"
+
 #include <esp_log.h>
 #include <spi_flash_mmap.h>
 #include <esp_timer.h>
 #include <cbin_font.h>
+#include <mbedtls/sha256.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
 
 
 #define TAG "Assets"
@@ -21,6 +27,37 @@ struct mmap_assets_table {
     uint16_t asset_height;        /*!< Height of the asset */
 };
 
+/*
+ * Optional trailer at the next 4 byte boundary after the stored data, written by
+ * scripts/spiffs_assets/assets_digest.py. Older firmware does not read past the data.
+ * file_count SHA-256 digests of the files follow, in table order and without the ZZ prefix.
+ */
+#define ASSETS_DIGEST_MAGIC "XZDIGEST"
+#define ASSETS_DIGEST_VERSION 1
+
+struct mmap_assets_digest {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint8_t image_sha256[32];     /*!< Header, table and data */
+    uint8_t file_sha256[][32];
+};
+
+/*
+ * Block manifest served next to the image as <url>.blocks, also written by assets_digest.py.
+ * block_sha256 holds the SHA-256 of each block_size bytes of the image, the last block may be shorter.
+ */
+#define ASSETS_BLOCKS_MAGIC "XZBLOCKS"
+#define ASSETS_BLOCKS_VERSION 1
+
+struct mmap_assets_blocks {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;          /*!< A multiple of the flash sector size */
+    uint32_t image_size;
+    uint8_t block_sha256[][32];
+};
+
 
 Assets::Assets() {
     // Initialize the partition
@@ -34,13 +71,70 @@ Assets::~Assets() {
 }
 
 uint32_t Assets::CalculateChecksum(const char* data, uint32_t length) {
+    // A word at a time, the bytes are summed into two 16 bit lanes. data is word aligned
+    auto bytes = (const uint8_t*)data;
+    uint32_t word_length = length & ~3u;
     uint32_t checksum = 0;
-    for (uint32_t i = 0; i < length; i++) {
-        checksum += data[i];
+    uint32_t i = 0;
+    while (i < word_length) {
+        // 128 words add at most 128 * 2 * 255 to a lane, so it cannot overflow
+        uint32_t end = std::min(word_length, i + 128 * 4);
+        uint32_t lanes = 0;
+        for (; i < end; i += 4) {
+            uint32_t word = *(const uint32_t*)(bytes + i);
+            lanes += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+        }
+        checksum += (lanes & 0xFFFF) + (lanes >> 16);
+    }
+    for (; i < length; i++) {
+        checksum += bytes[i];
     }
     return checksum & 0xFFFF;
 }
 
+bool Assets::VerifyDigest(const mmap_assets_digest* digest, uint32_t stored_files, uint32_t stored_len) {
+    uint8_t sha256[32];
+    mbedtls_sha256((const unsigned char*)mmap_root_, 12 + stored_len, sha256, 0);
+    if (memcmp(sha256, digest->image_sha256, sizeof(sha256)) == 0) {
+        return true;
+    }
+
+    // Name the damaged files, to tell a bad download from a bad flash sector
+    auto data_start = mmap_root_ + 12 + sizeof(mmap_assets_table) * stored_files;
+    for (uint32_t i = 0; i < stored_files; i++) {
+        auto item = (const mmap_assets_table*)(mmap_root_ + 12 + i * sizeof(mmap_assets_table));
+        if (item->asset_offset + 2 + item->asset_size > stored_len - sizeof(mmap_assets_table) * stored_files) {
+            ESP_LOGE(TAG, "The asset %.32s is out of range", item->asset_name);
+            continue;
+        }
+        mbedtls_sha256((const unsigned char*)data_start + item->asset_offset + 2, item->asset_size, sha256, 0);
+        if (memcmp(sha256, digest->file_sha256[i], sizeof(sha256)) != 0) {
+            ESP_LOGE(TAG, "The asset %.32s does not match its SHA-256", item->asset_name);
+        }
+    }
+    return false;
+}
+
+std::string Assets::GetVerifiedKey(const mmap_assets_digest* digest, uint32_t stored_files, uint32_t stored_len) {
+    // The header and table identify the image, the trailer adds its digests when there is one
+    uint8_t sha256[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, (const unsigned char*)mmap_root_, 12 + sizeof(mmap_assets_table) * stored_files);
+    if (digest != nullptr) {
+        mbedtls_sha256_update(&ctx, (const unsigned char*)digest, sizeof(mmap_assets_digest) + 32 * stored_files);
+    }
+    mbedtls_sha256_finish(&ctx, sha256);
+    mbedtls_sha256_free(&ctx);
+
+    char key[33];
+    for (int i = 0; i < 16; i++) {
+        snprintf(key + i * 2, 3, "%02x", sha256[i]);
+    }
+    return std::string(key, 32);
+}
+
 bool Assets::InitializePartition() {
     partition_valid_ = false;
     checksum_valid_ = false;
@@ -73,19 +167,44 @@ bool Assets::InitializePartition() {
     uint32_t stored_chksum = *(uint32_t*)(mmap_root_ + 4);
     uint32_t stored_len = *(uint32_t*)(mmap_root_ + 8);
 
-    if (stored_len > partition_->size - 12) {
+    if (stored_len > partition_->size - 12 || stored_files > stored_len / sizeof(mmap_assets_table)) {
         ESP_LOGD(TAG, "The stored_len (0x%lx) is greater than the partition size (0x%lx) - 12", stored_len, partition_->size);
         return false;
     }
 
-    auto start_time = esp_timer_get_time();
-    uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
-    auto end_time = esp_timer_get_time();
-    ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
+    const mmap_assets_digest* digest = nullptr;
+    uint32_t digest_offset = (12 + stored_len + 3) & ~3u;
+    if (digest_offset + sizeof(mmap_assets_digest) + 32 * stored_files <= partition_->size) {
+        digest = (const mmap_assets_digest*)(mmap_root_ + digest_offset);
+        if (memcmp(digest->magic, ASSETS_DIGEST_MAGIC, sizeof(digest->magic)) != 0 ||
+            digest->version != ASSETS_DIGEST_VERSION || digest->file_count != stored_files) {
+            digest = nullptr;
+        }
+    }
 
-    if (calculated_checksum != stored_chksum) {
-        ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
-        return false;
+    // A verified image is remembered, so a normal boot does not read the whole partition
+    std::string verified_key = GetVerifiedKey(digest, stored_files, stored_len);
+    Settings settings("assets");
+    if (settings.GetString("verified") == verified_key) {
+        ESP_LOGI(TAG, "The assets were verified before (%s)", verified_key.c_str());
+    } else {
+        auto start_time = esp_timer_get_time();
+        if (digest != nullptr) {
+            if (!VerifyDigest(digest, stored_files, stored_len)) {
+                ESP_LOGE(TAG, "The assets SHA-256 does not match");
+                return false;
+            }
+        } else {
+            uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
+            if (calculated_checksum != stored_chksum) {
+                ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+                return false;
+            }
+        }
+        auto end_time = esp_timer_get_time();
+        ESP_LOGI(TAG, "The %s verification time is %d ms", digest != nullptr ? "SHA-256" : "checksum",
+            int((end_time - start_time) / 1000));
+        Settings("assets", true).SetString("verified", verified_key);
     }
 
     checksum_valid_ = true;
@@ -367,6 +486,56 @@ bool Assets::Apply() {
     return true;
 }
 
+bool Assets::GetChangedBlocks(const std::string& manifest, std::vector<HttpDownloadRange>& ranges) {
+    if (manifest.size() < sizeof(mmap_assets_blocks) || memcmp(manifest.data(), ASSETS_BLOCKS_MAGIC, 8) != 0) {
+        ESP_LOGW(TAG, "Invalid block manifest");
+        return false;
+    }
+    auto blocks = (const mmap_assets_blocks*)manifest.data();
+    const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
+    if (blocks->version != ASSETS_BLOCKS_VERSION || blocks->block_size == 0 || blocks->block_size % SECTOR_SIZE != 0) {
+        ESP_LOGW(TAG, "Unsupported block manifest, version %lu, block size %lu", blocks->version, blocks->block_size);
+        return false;
+    }
+    size_t block_count = (blocks->image_size + blocks->block_size - 1) / blocks->block_size;
+    if (blocks->image_size == 0 || blocks->image_size > partition_->size ||
+        manifest.size() != sizeof(mmap_assets_blocks) + 32 * block_count) {
+        ESP_LOGW(TAG, "Invalid block manifest for an image of %lu bytes", blocks->image_size);
+        return false;
+    }
+
+    // Hash the blocks already in the partition, adjacent changed blocks become one range
+    std::vector<char> buffer(SECTOR_SIZE);
+    uint8_t sha256[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    ranges.clear();
+    for (size_t i = 0; i < block_count; i++) {
+        size_t block_offset = i * blocks->block_size;
+        size_t block_size = std::min<size_t>(blocks->block_size, blocks->image_size - block_offset);
+        mbedtls_sha256_starts(&ctx, 0);
+        for (size_t offset = 0; offset < block_size; offset += buffer.size()) {
+            size_t size = std::min(buffer.size(), block_size - offset);
+            if (esp_partition_read(partition_, block_offset + offset, buffer.data(), size) != ESP_OK) {
+                mbedtls_sha256_free(&ctx);
+                return false;
+            }
+            mbedtls_sha256_update(&ctx, (const unsigned char*)buffer.data(), size);
+        }
+        mbedtls_sha256_finish(&ctx, sha256);
+        if (memcmp(sha256, blocks->block_sha256[i], sizeof(sha256)) == 0) {
+            continue;
+        }
+        if (!ranges.empty() && ranges.back().offset + ranges.back().size == block_offset) {
+            ranges.back().size += block_size;
+        } else {
+            ranges.push_back({block_offset, block_size});
+        }
+    }
+    mbedtls_sha256_free(&ctx);
+    return true;
+}
+
 bool Assets::Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback) {
     ESP_LOGI(TAG, "Downloading new version of assets from %s", url.c_str());
     
@@ -378,118 +547,74 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     }
     checksum_valid_ = false;
     assets_.clear();
+    // The partition is rewritten, it must be verified in full again
+    Settings("assets", true).EraseKey("verified");
 
-    // 下载新的资源文件
     auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    
-    if (!http->Open("GET", url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
-    }
+    HttpDownloader downloader([network]() { return network->CreateHttp(0); });
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get assets, status code: %d", http->GetStatusCode());
-        return false;
-    }
-
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
-        return false;
-    }
-
-    if (content_length > partition_->size) {
-        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition_->size);
-        return false;
-    }
-
-    // 定义扇区大小为4KB（ESP32的标准扇区大小）
+    // 扇区在写入前才擦除，擦除和写入在下载器的写线程上进行，与网络读取重叠
     const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
-    
-    // 计算需要擦除的扇区数量
-    size_t sectors_to_erase = (content_length + SECTOR_SIZE - 1) / SECTOR_SIZE; // 向上取整
-    size_t total_erase_size = sectors_to_erase * SECTOR_SIZE;
-    
-    ESP_LOGI(TAG, "Sector size: %u, content length: %u, sectors to erase: %u, total erase size: %u", 
-             SECTOR_SIZE, content_length, sectors_to_erase, total_erase_size);
-    
-    // 写入新的资源文件到分区，一边erase一边写入
-    char buffer[512];
-    size_t total_written = 0;
-    size_t recent_written = 0;
-    size_t current_sector = 0;
-    auto last_calc_time = esp_timer_get_time();
-    
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
+    size_t erased_end = 0;
+    std::atomic<size_t> sectors_erased = 0;
+    downloader.OnWrite([this, SECTOR_SIZE, &erased_end, &sectors_erased](size_t offset, const char* data, size_t size) {
+        if (offset > erased_end) {
+            erased_end = offset / SECTOR_SIZE * SECTOR_SIZE;
         }
-
-        if (ret == 0) {
-            break;
-        }
-
-        // 检查是否需要擦除新的扇区
-        size_t write_end_offset = total_written + ret;
-        size_t needed_sectors = (write_end_offset + SECTOR_SIZE - 1) / SECTOR_SIZE;
-        
-        // 擦除需要的新扇区
-        while (current_sector < needed_sectors) {
-            size_t sector_start = current_sector * SECTOR_SIZE;
-            size_t sector_end = (current_sector + 1) * SECTOR_SIZE;
-            
-            // 确保擦除范围不超过分区大小
-            if (sector_end > partition_->size) {
-                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", sector_end, partition_->size);
+        while (erased_end < offset + size) {
+            if (erased_end + SECTOR_SIZE > partition_->size) {
+                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", erased_end + SECTOR_SIZE, partition_->size);
                 return false;
             }
-            
-            ESP_LOGD(TAG, "Erasing sector %u (offset: %u, size: %u)", current_sector, sector_start, SECTOR_SIZE);
-            esp_err_t err = esp_partition_erase_range(partition_, sector_start, SECTOR_SIZE);
+            esp_err_t err = esp_partition_erase_range(partition_, erased_end, SECTOR_SIZE);
             if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to erase sector %u at offset %u: %s", current_sector, sector_start, esp_err_to_name(err));
+                ESP_LOGE(TAG, "Failed to erase sector at offset %u: %s", erased_end, esp_err_to_name(err));
                 return false;
             }
-            
-            current_sector++;
+            erased_end += SECTOR_SIZE;
+            sectors_erased++;
         }
-
-        // 写入数据到分区
-        esp_err_t err = esp_partition_write(partition_, total_written, buffer, ret);
+        esp_err_t err = esp_partition_write(partition_, offset, data, size);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", total_written, esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", offset, esp_err_to_name(err));
             return false;
         }
-
-        total_written += ret;
-        recent_written += ret;
-
-        // 计算进度和速度
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_written == content_length || ret == 0) {
-            size_t progress = total_written * 100 / content_length;
-            size_t speed = recent_written; // 每秒的字节数
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u", 
-                     progress, total_written, content_length, speed, current_sector);
-            if (progress_callback) {
-                progress_callback(progress, speed);
-            }
-            last_calc_time = esp_timer_get_time();
-            recent_written = 0; // 重置最近写入的字节数
+        return true;
+    });
+    downloader.OnProgress([&sectors_erased, progress_callback](size_t written, size_t total, size_t speed) {
+        int progress = written * 100 / total;
+        ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u",
+                 progress, written, total, speed, sectors_erased.load());
+        if (progress_callback) {
+            progress_callback(progress, speed);
+        }
+    });
+
+    // 如果服务器提供了分块清单，只下载与当前分区内容不同的块
+    std::string manifest_url = url;
+    manifest_url.insert(std::min(url.find('?'), url.size()), ".blocks");
+    std::string manifest;
+    std::vector<HttpDownloadRange> ranges;
+    bool success;
+    // 块大小是扇区大小的整数倍，所以清单最多为每个扇区一个哈希
+    size_t max_manifest_size = sizeof(mmap_assets_blocks) + 32 * ((partition_->size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    if (downloader.Fetch(manifest_url, manifest, max_manifest_size) && GetChangedBlocks(manifest, ranges)) {
+        size_t changed = 0;
+        for (auto& range : ranges) {
+            changed += range.size;
         }
+        ESP_LOGI(TAG, "Delta update, %u bytes in %u ranges differ", changed, ranges.size());
+        success = ranges.empty() || downloader.DownloadRanges(url, ranges);
+    } else {
+        success = downloader.Download(url, partition_->size);
     }
-    
-    http->Close();
-
-    if (total_written != content_length) {
-        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", total_written, content_length);
+    if (!success) {
         return false;
     }
 
-    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total sectors erased: %u", 
-             total_written, current_sector);
+    auto& statistics = downloader.statistics();
+    ESP_LOGI(TAG, "Assets download completed, %u bytes in %lld ms, %d reconnects, %lld ms waiting for flash, %u sectors erased",
+             statistics.bytes_received, statistics.elapsed_ms, statistics.reconnect_count, statistics.writer_wait_ms, sectors_erased.load());
 
     // 重新初始化资源分区
     if (!InitializePartition()) {
@@ -4,11 +4,14 @@
 #include <map>
 #include <string>
 #include <functional>
+#include <vector>
 
 #include <cJSON.h>
 #include <esp_partition.h>
 #include <model_path.h>
 
+#include "http_downloader.h"
+
 
 struct Asset {
     size_t size;
@@ -38,6 +41,9 @@ private:
 
     bool InitializePartition();
     uint32_t CalculateChecksum(const char* data, uint32_t length);
+    bool VerifyDigest(const struct mmap_assets_digest* digest, uint32_t stored_files, uint32_t stored_len);
+    std::string GetVerifiedKey(const struct mmap_assets_digest* digest, uint32_t stored_files, uint32_t stored_len);
+    bool GetChangedBlocks(const std::string& manifest, std::vector<HttpDownloadRange>& ranges);
 
     const esp_partition_t* partition_ = nullptr;
     esp_partition_mmap_handle_t mmap_handle_ = 0;
@@ -7,17 +7,24 @@
 
 #include <model_path.h>
 #include "audio_codec.h"
+#include "pcm_frame_pool.h"
 
 class AudioProcessor {
 public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) = 0;
-    virtual void Feed(std::vector<int16_t>&& data) = 0;
+    // Change the output frame length, takes effect from the next output frame
+    virtual void SetFrameDuration(int frame_duration_ms) = 0;
+    // timestamp is the server timestamp being played when the first sample was captured, 0 if none.
+    // It is carried to the output frame that contains that sample.
+    virtual void Feed(std::vector<int16_t>&& data, uint32_t timestamp) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data, uint32_t timestamp)> callback) = 0;
+    // Output frames are taken from this pool, the receiver of OnOutput returns them
+    virtual void SetFramePool(PcmFramePool* pool) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
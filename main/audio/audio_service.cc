@@ -1,6 +1,8 @@
 #include "audio_service.h"
+#include "dsp/pcm_kernels.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -18,39 +20,73 @@
 #define TAG "AudioService"
 
 
-AudioService::AudioService() {
+AudioService::AudioService()
+    // The decode queue also receives the whole testing queue when audio testing ends
+    : audio_decode_queue_(std::max(MAX_DECODE_PACKETS_IN_QUEUE, MAX_TESTING_PACKETS_IN_QUEUE)),
+      audio_send_queue_(MAX_SEND_PACKETS_IN_QUEUE),
+      audio_testing_queue_(MAX_TESTING_PACKETS_IN_QUEUE),
+      audio_encode_queue_(MAX_ENCODE_TASKS_IN_QUEUE),
+      audio_playback_queue_(MAX_PLAYBACK_TASKS_IN_QUEUE * PLAYBACK_SLOTS_PER_FRAME),
+      jitter_buffer_(MAX_DECODE_PACKETS_IN_QUEUE),
+      playback_clock_(PLAYBACK_CLOCK_ANCHORS, AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM),
+      input_frame_pool_(PCM_FRAME_POOL_SIZE),
+      output_frame_pool_(PLAYBACK_TASK_POOL_SIZE) {
     event_group_ = xEventGroupCreate();
+    queue_event_group_ = xEventGroupCreate();
+
+    /* Items discarded by Clear() go back to their pools instead of the heap */
+    auto release_packet = [](std::unique_ptr<AudioStreamPacket>&& packet) {
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+    };
+    audio_decode_queue_.SetDiscardHandler(release_packet);
+    audio_send_queue_.SetDiscardHandler(release_packet);
+    audio_testing_queue_.SetDiscardHandler(release_packet);
+    audio_encode_queue_.SetDiscardHandler([this](AudioTask&& task) {
+        input_frame_pool_.Release(std::move(task.pcm));
+    });
+    audio_playback_queue_.SetDiscardHandler([this](std::unique_ptr<AudioTask>&& task) {
+        ReleasePlaybackTask(std::move(task));
+    });
+    free_playback_tasks_.reserve(PLAYBACK_TASK_POOL_SIZE);
+#if CONFIG_USE_LOW_LATENCY_PLAYBACK
+    jitter_buffer_.SetFastStart(true);
+#endif
 }
 
 AudioService::~AudioService() {
     if (event_group_ != nullptr) {
         vEventGroupDelete(event_group_);
     }
+    if (queue_event_group_ != nullptr) {
+        vEventGroupDelete(queue_event_group_);
+    }
 }
 
 
 void AudioService::Initialize(AudioCodec* codec) {
     codec_ = codec;
     codec_->Start();
+    playback_clock_.SetSampleRate(codec->output_sample_rate());
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
+    ApplyUplinkProfile();
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
+    ReserveInputFrames(OPUS_FRAME_DURATION_MS * 16000 / 1000);
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
+    audio_processor_->SetFramePool(&input_frame_pool_);
 
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+    audio_processor_->OnOutput([this](std::vector<int16_t>&& data, uint32_t timestamp) {
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data), timestamp);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
@@ -109,12 +145,31 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+#if OPUS_SEPARATE_DECODE_TASK
+    /* Encode and decode run in their own tasks, so a long encode never delays the next decode */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncodeTask();
+        vTaskDelete(NULL);
+    }, "opus_encode", OPUS_ENCODE_TASK_STACK_SIZE, this, CONFIG_OPUS_ENCODE_TASK_PRIORITY, &opus_encode_task_handle_,
+        CONFIG_OPUS_ENCODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_ENCODE_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecodeTask();
+        vTaskDelete(NULL);
+    }, "opus_decode", OPUS_DECODE_TASK_STACK_SIZE, this, CONFIG_OPUS_DECODE_TASK_PRIORITY, &opus_decode_task_handle_,
+        CONFIG_OPUS_DECODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_DECODE_TASK_CORE);
+#else
+    /* One core, so one codec task, its stack already covers the encoder */
+    xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", OPUS_ENCODE_TASK_STACK_SIZE, this, CONFIG_OPUS_ENCODE_TASK_PRIORITY, &opus_encode_task_handle_,
+        CONFIG_OPUS_ENCODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_ENCODE_TASK_CORE);
+    opus_decode_task_handle_ = opus_encode_task_handle_;
+#endif
 }
 
 void AudioService::Stop() {
@@ -124,52 +179,61 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    jitter_buffer_.Clear();
+    // Wake up every task blocked on a queue so it can see service_stopped_
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_ALL);
 }
 
-bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+void AudioService::CaptureTimestamp(uint32_t* timestamp, int64_t duration_us) {
+#if CONFIG_USE_SERVER_AEC
+    /* The read returns with the last sample, the first one was captured a frame earlier */
+    if (timestamp != nullptr) {
+        *timestamp = playback_clock_.GetTimestamp(esp_timer_get_time() - duration_us);
+    }
+#endif
+}
+
+bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, uint32_t* timestamp) {
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableInput(true);
     }
 
+    /* All the intermediate buffers are members, so only one task may read at a time */
     if (codec_->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
+        input_frame_pool_.Resize(data, samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
         if (!codec_->InputData(data)) {
             return false;
         }
+        CaptureTimestamp(timestamp, samples * 1000000LL / sample_rate);
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t channel_samples = data.size() / 2;
+            input_frame_pool_.Resize(mic_channel_, channel_samples);
+            input_frame_pool_.Resize(reference_channel_, channel_samples);
+            PcmDeinterleaveStereo(data.data(), mic_channel_.data(), reference_channel_.data(), channel_samples);
+            input_frame_pool_.Resize(resampled_mic_, input_resampler_.GetOutputSamples(channel_samples));
+            input_frame_pool_.Resize(resampled_reference_, reference_resampler_.GetOutputSamples(channel_samples));
+            input_resampler_.Process(mic_channel_.data(), channel_samples, resampled_mic_.data());
+            reference_resampler_.Process(reference_channel_.data(), channel_samples, resampled_reference_.data());
+            input_frame_pool_.Resize(data, resampled_mic_.size() + resampled_reference_.size());
+            PcmInterleaveStereo(resampled_mic_.data(), resampled_reference_.data(), data.data(), resampled_mic_.size());
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            input_frame_pool_.Resize(resampled_mic_, input_resampler_.GetOutputSamples(data.size()));
+            input_resampler_.Process(data.data(), data.size(), resampled_mic_.data());
+            input_frame_pool_.Resize(data, resampled_mic_.size());
+            std::copy(resampled_mic_.begin(), resampled_mic_.end(), data.begin());
         }
     } else {
-        data.resize(samples * codec_->input_channels());
+        input_frame_pool_.Resize(data, samples * codec_->input_channels());
         if (!codec_->InputData(data)) {
             return false;
         }
+        CaptureTimestamp(timestamp, samples * 1000000LL / sample_rate);
     }
 
     /* Update the last input time */
@@ -204,34 +268,37 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            int frame_duration = uplink_frame_duration_ms_;
+            if (audio_testing_queue_.size() >= (size_t)(AUDIO_TESTING_MAX_DURATION_MS / frame_duration)) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            auto data = input_frame_pool_.Acquire(0);
+            int samples = frame_duration * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
+                // If input channels is 2, we need to fetch the left channel data (in place)
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    PcmExtractLeft(data.data(), data.data(), data.size() / 2);
+                    data.resize(data.size() / 2);
                 }
                 PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
                 continue;
             }
+            input_frame_pool_.Release(std::move(data));
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
+                auto data = input_frame_pool_.Acquire(0);
+                bool success = ReadAudioData(data, 16000, samples);
+                if (success) {
                     wake_word_->Feed(data);
+                }
+                input_frame_pool_.Release(std::move(data));
+                if (success) {
                     continue;
                 }
             }
@@ -239,11 +306,17 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
+                auto data = input_frame_pool_.Acquire(0);
+                uint32_t timestamp = 0;
+                bool success = ReadAudioData(data, 16000, samples, &timestamp);
+                if (success) {
+                    audio_processor_->Feed(std::move(data), timestamp);
+                }
+                // Processors that keep the frame move it out, otherwise it goes back to the pool
+                input_frame_pool_.Release(std::move(data));
+                if (success) {
                     continue;
                 }
             }
@@ -258,117 +331,393 @@ void AudioService::AudioInputTask() {
 
 void AudioService::AudioOutputTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
         if (service_stopped_) {
             break;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        std::unique_ptr<AudioTask> task;
+        if (!audio_playback_queue_.TryPop(task)) {
+            xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_PLAYBACK_AVAILABLE, pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        }
+        xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_PLAYBACK_SPACE);
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
+#if CONFIG_USE_SERVER_AEC
+        int64_t write_start_us = esp_timer_get_time();
+        codec_->OutputData(task->pcm);
+        /* Every sample is counted, so the uplink can be tagged with the exact audio being played */
+        playback_clock_.OnOutput(task->timestamp, task->pcm.size(), write_start_us, esp_timer_get_time());
+#else
         codec_->OutputData(task->pcm);
+#endif
+        if (task->decode_start_us != 0 && first_audio_pending_) {
+            RecordFirstAudioLatency(*task, esp_timer_get_time());
+        }
+
+        ReleasePlaybackTask(std::move(task));
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
+    }
 
-#if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+    ESP_LOGW(TAG, "Audio output task stopped");
+}
+
+#if OPUS_SEPARATE_DECODE_TASK
+void AudioService::OpusEncodeTask() {
+    while (true) {
+        xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_AVAILABLE | AS_QUEUE_EVENT_SEND_SPACE,
+            pdTRUE, pdFALSE, portMAX_DELAY);
+
+        /* The wakeup bits are cleared, so keep going until no frame can be encoded */
+        while (!service_stopped_ && EncodeOneTask()) {
+        }
+        if (service_stopped_) {
+            break;
         }
-#endif
     }
 
-    ESP_LOGW(TAG, "Audio output task stopped");
+    ESP_LOGW(TAG, "Opus encode task stopped");
 }
 
+void AudioService::OpusDecodeTask() {
+    while (true) {
+        /* A buffering jitter buffer may start playout because of time passing, not only a new packet */
+        TickType_t timeout = jitter_buffer_.IsBuffering() ? pdMS_TO_TICKS(JITTER_BUFFER_POLL_INTERVAL_MS) : portMAX_DELAY;
+        xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_AVAILABLE | AS_QUEUE_EVENT_PLAYBACK_SPACE,
+            pdTRUE, pdFALSE, timeout);
+
+        /* The wakeup bits are cleared, so keep going until no packet can be decoded */
+        while (!service_stopped_ && DecodeOnePacket()) {
+        }
+        if (service_stopped_) {
+            break;
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus decode task stopped");
+}
+#else
 void AudioService::OpusCodecTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
+        /* A buffering jitter buffer may start playout because of time passing, not only a new packet */
+        TickType_t timeout = jitter_buffer_.IsBuffering() ? pdMS_TO_TICKS(JITTER_BUFFER_POLL_INTERVAL_MS) : portMAX_DELAY;
+        xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_AVAILABLE | AS_QUEUE_EVENT_DECODE_AVAILABLE |
+            AS_QUEUE_EVENT_PLAYBACK_SPACE | AS_QUEUE_EVENT_SEND_SPACE, pdTRUE, pdFALSE, timeout);
+
+        /* The wakeup bits are cleared, so keep going until neither direction can make progress */
+        bool progressed = true;
+        while (progressed && !service_stopped_) {
+            progressed = DecodeOnePacket();
+            progressed = EncodeOneTask() || progressed;
+        }
         if (service_stopped_) {
             break;
         }
+    }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+    ESP_LOGW(TAG, "Opus codec task stopped");
+}
+#endif
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
+static void AddCodecTime(CodecTimeStatistics& statistics, int64_t elapsed_us, int frame_duration_ms) {
+    uint32_t us = elapsed_us;
+    statistics.frame_count++;
+    statistics.last_us = us;
+    statistics.average_us = statistics.frame_count == 1 ? us : statistics.average_us + ((int32_t)(us - statistics.average_us) / 16);
+    statistics.max_us = std::max(statistics.max_us, us);
+    if (us > (uint32_t)frame_duration_ms * 1000) {
+        statistics.over_budget_count++;
+    }
+}
+
+bool AudioService::DecodeOnePacket() {
+    /* Wait until the playback queue has room for all the tasks of one decoded frame */
+    if (audio_playback_queue_.capacity() - audio_playback_queue_.size() < PLAYBACK_SLOTS_PER_FRAME) {
+        return false;
+    }
+    /* Local sounds go first, then server audio at the pace the playback queue drains */
+    std::unique_ptr<AudioStreamPacket> packet;
+    bool from_jitter_buffer = false;
+    if (audio_decode_queue_.TryPop(packet)) {
+        xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_SPACE);
+    } else if (jitter_buffer_.Pop(packet, esp_timer_get_time()) == kJitterBufferEmpty) {
+        return false;
+    } else {
+        from_jitter_buffer = true;
+    }
+
+    auto task = AcquirePlaybackTask(0);
+
+    /* Only server audio (from the jitter buffer) is timed for the first audio latency */
+    int64_t decode_start_us = esp_timer_get_time();
+
+    bool decoded;
+    if (packet != nullptr) {
+        task->timestamp = packet->timestamp;
+        SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+        decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+    } else {
+        /* The jitter buffer lost this frame, an empty payload asks Opus for packet loss concealment */
+        std::vector<uint8_t> lost;
+        decoded = opus_decoder_->Decode(std::move(lost), task->pcm);
+        if (!decoded) {
+            task->pcm.assign(opus_decoder_->sample_rate() * opus_decoder_->duration_ms() / 1000, 0);
+            decoded = true;
         }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
+    }
+    if (decoded) {
+        if (from_jitter_buffer) {
+            task->decode_start_us = decode_start_us;
+        }
+#if CONFIG_USE_LOW_LATENCY_PLAYBACK
+        PushDecodedChunksToPlaybackQueue(std::move(task));
+#else
+        // Resample if the sample rate is different
+        if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+            int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
+            auto resampled = output_frame_pool_.Acquire(target_size);
+            output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
+            output_frame_pool_.Release(std::move(task->pcm));
+            task->pcm = std::move(resampled);
+        }
+        task->decode_end_us = esp_timer_get_time();
+        PushTaskToPlaybackQueue(std::move(task));
+#endif
+    } else {
+        ESP_LOGE(TAG, "Failed to decode audio");
+        ReleasePlaybackTask(std::move(task));
+    }
+    if (packet == nullptr && !decode_stack_logged_ && opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        decode_stack_logged_ = true;
+        ESP_LOGI(TAG, "Decode stack after concealment and resampling: %u bytes free",
+            (unsigned)uxTaskGetStackHighWaterMark(NULL));
+    }
+    AudioPacketPool::GetInstance().Release(std::move(packet));
+    AddCodecTime(debug_statistics_.decode_time, esp_timer_get_time() - decode_start_us, opus_decoder_->duration_ms());
+    debug_statistics_.decode_count++;
+    return true;
+}
 
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
-            }
+std::unique_ptr<AudioTask> AudioService::AcquirePlaybackTask(size_t samples) {
+    std::unique_ptr<AudioTask> task;
+    {
+        std::lock_guard<std::mutex> lock(playback_task_mutex_);
+        if (!free_playback_tasks_.empty()) {
+            task = std::move(free_playback_tasks_.back());
+            free_playback_tasks_.pop_back();
+        }
+    }
+    if (task == nullptr) {
+        task = std::make_unique<AudioTask>();
+        playback_task_alloc_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+    task->timestamp = 0;
+    task->decode_start_us = 0;
+    task->decode_end_us = 0;
+    task->pcm = output_frame_pool_.Acquire(samples);
+    return task;
+}
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
-            }
+void AudioService::ReleasePlaybackTask(std::unique_ptr<AudioTask>&& task) {
+    if (task == nullptr) {
+        return;
+    }
+    output_frame_pool_.Release(std::move(task->pcm));
+    std::lock_guard<std::mutex> lock(playback_task_mutex_);
+    if (free_playback_tasks_.size() < PLAYBACK_TASK_POOL_SIZE) {
+        free_playback_tasks_.push_back(std::move(task));
+    }
+}
+
+void AudioService::PushTaskToPlaybackQueue(std::unique_ptr<AudioTask> task) {
+    if (!audio_playback_queue_.TryPush(std::move(task))) {
+        ESP_LOGW(TAG, "Playback queue is still releasing discarded frames, dropping frame");
+        ReleasePlaybackTask(std::move(task));
+    }
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_PLAYBACK_AVAILABLE);
+}
+
+#if CONFIG_USE_LOW_LATENCY_PLAYBACK
+void AudioService::PushDecodedChunksToPlaybackQueue(std::unique_ptr<AudioTask> frame) {
+    /* Slice the frame so each chunk fills one I2S DMA buffer after resampling,
+     * the output task starts writing as soon as the first chunk is queued */
+    size_t input_chunk = AUDIO_CODEC_DMA_FRAME_NUM * opus_decoder_->sample_rate() / codec_->output_sample_rate();
+    bool resample = opus_decoder_->sample_rate() != codec_->output_sample_rate();
+    for (size_t offset = 0; offset < frame->pcm.size(); offset += input_chunk) {
+        size_t samples = std::min(input_chunk, frame->pcm.size() - offset);
+        auto chunk = AcquirePlaybackTask(resample ? output_resampler_.GetOutputSamples(samples) : samples);
+        if (frame->timestamp > 0) {
+            chunk->timestamp = frame->timestamp + offset * 1000 / opus_decoder_->sample_rate();
+        }
+        if (offset == 0) {
+            chunk->decode_start_us = frame->decode_start_us;
+        }
+        if (resample) {
+            output_resampler_.Process(frame->pcm.data() + offset, samples, chunk->pcm.data());
+        } else {
+            std::copy(frame->pcm.begin() + offset, frame->pcm.begin() + offset + samples, chunk->pcm.begin());
+        }
+        if (offset == 0) {
+            chunk->decode_end_us = esp_timer_get_time();
+        }
+        PushTaskToPlaybackQueue(std::move(chunk));
+    }
+    ReleasePlaybackTask(std::move(frame));
+}
+#endif
+
+bool AudioService::EncodeOneTask() {
+    if (uplink_profile_changed_.exchange(false)) {
+        ApplyUplinkProfile();
+    }
+    if (audio_send_queue_.size() >= (size_t)(MAX_SEND_DURATION_MS / uplink_profile_.frame_duration)) {
+        return false;
+    }
+    AudioTask task;
+    if (!audio_encode_queue_.TryPop(task)) {
+        return false;
+    }
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_SPACE);
+
+    /* Frames captured before a profile change have the old length */
+    if (task.pcm.size() != (size_t)(uplink_profile_.frame_duration * 16000 / 1000)) {
+        ESP_LOGW(TAG, "Dropping a frame of %u samples captured before the uplink profile change", task.pcm.size());
+        input_frame_pool_.Release(std::move(task.pcm));
+        return true;
+    }
+
+    /* Packets for the server keep room for the transport header in front of the Opus data */
+    size_t headroom = task.type == kAudioTaskTypeEncodeToSendQueue ? uplink_headroom_.load() : 0;
+    auto packet = AudioPacketPool::GetInstance().Acquire(0);
+    packet->frame_duration = uplink_profile_.frame_duration;
+    packet->sample_rate = 16000;
+    packet->timestamp = task.timestamp;
+    int64_t encode_start_us = esp_timer_get_time();
+    bool encoded;
+    if (headroom == 0) {
+        encoded = opus_encoder_->Encode(std::move(task.pcm), packet->payload);
+    } else {
+        /* The encoder always writes from the start of its output vector */
+        encoded = opus_encoder_->Encode(std::move(task.pcm), encode_buffer_);
+        if (encoded) {
+            packet->payload.resize(headroom + encode_buffer_.size());
+            std::memcpy(packet->payload.data() + headroom, encode_buffer_.data(), encode_buffer_.size());
+            packet->headroom = headroom;
+        }
+    }
+    AddCodecTime(debug_statistics_.encode_time, esp_timer_get_time() - encode_start_us, uplink_profile_.frame_duration);
+    input_frame_pool_.Release(std::move(task.pcm));
+    if (!encoded) {
+        ESP_LOGE(TAG, "Failed to encode audio");
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+        return true;
+    }
+
+    if (task.type == kAudioTaskTypeEncodeToSendQueue) {
+        if (!PassUplinkGate(packet)) {
+            /* Suppressed packets go back to the pool, pre-roll ones were moved out */
+            AudioPacketPool::GetInstance().Release(std::move(packet));
             debug_statistics_.encode_count++;
-            lock.lock();
+            return true;
+        }
+        PushToSendQueue(std::move(packet));
+        if (callbacks_.on_send_queue_available) {
+            callbacks_.on_send_queue_available();
+        }
+    } else if (task.type == kAudioTaskTypeEncodeToTestingQueue) {
+        if (!audio_testing_queue_.TryPush(std::move(packet))) {
+            AudioPacketPool::GetInstance().Release(std::move(packet));
         }
     }
+    debug_statistics_.encode_count++;
+    return true;
+}
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+void AudioService::PushToSendQueue(std::unique_ptr<AudioStreamPacket>&& packet) {
+    /* A packet the full queue did not take is still ours */
+    if (!audio_send_queue_.TryPush(std::move(packet))) {
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+    }
+}
+
+void AudioService::ReleaseUplinkPreroll(size_t keep_frames) {
+    while (uplink_preroll_.size() > keep_frames) {
+        AudioPacketPool::GetInstance().Release(std::move(uplink_preroll_.front()));
+        uplink_preroll_.pop_front();
+    }
+}
+
+bool AudioService::PassUplinkGate(std::unique_ptr<AudioStreamPacket>& packet) {
+    if (!uplink_gate_enabled_) {
+        ReleaseUplinkPreroll(0);
+        return true;
+    }
+
+    /* Nothing to send in a DTX frame, the server conceals the gap */
+    if (uplink_profile_.dtx && packet->payload.size() - packet->headroom <= OPUS_DTX_PACKET_MAX_BYTES) {
+        debug_statistics_.uplink_suppressed_count++;
+        return false;
+    }
+
+    if (voice_detected_) {
+        uplink_hangover_frames_ = UPLINK_VAD_HANGOVER_MS / uplink_profile_.frame_duration;
+        /* Send the pre-roll first so the server gets the speech onset the VAD needed to detect it */
+        while (!uplink_preroll_.empty()) {
+            PushToSendQueue(std::move(uplink_preroll_.front()));
+            uplink_preroll_.pop_front();
+        }
+        return true;
+    }
+    if (uplink_hangover_frames_ > 0) {
+        uplink_hangover_frames_--;
+        return true;
+    }
+
+    size_t preroll_frames = UPLINK_VAD_PREROLL_MS / uplink_profile_.frame_duration;
+    uplink_preroll_.push_back(std::move(packet));
+    if (uplink_preroll_.size() > preroll_frames) {
+        debug_statistics_.uplink_suppressed_count += uplink_preroll_.size() - preroll_frames;
+        ReleaseUplinkPreroll(preroll_frames);
+    }
+    return false;
+}
+
+void AudioService::SetUplinkProfile(const UplinkProfile& profile) {
+    {
+        std::lock_guard<std::mutex> lock(uplink_profile_mutex_);
+        if (profile == pending_uplink_profile_) {
+            return;
+        }
+        pending_uplink_profile_ = profile;
+    }
+    uplink_frame_duration_ms_ = profile.frame_duration;
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(profile.frame_duration);
+    }
+    /* The encoder is owned by the encode task, let it rebuild before the next frame */
+    uplink_profile_changed_ = true;
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_AVAILABLE);
+}
+
+void AudioService::ApplyUplinkProfile() {
+    {
+        std::lock_guard<std::mutex> lock(uplink_profile_mutex_);
+        uplink_profile_ = pending_uplink_profile_;
+    }
+    opus_encoder_.reset();
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, uplink_profile_.frame_duration);
+    opus_encoder_->SetComplexity(uplink_profile_.complexity);
+    opus_encoder_->SetDtx(uplink_profile_.dtx);
+    ESP_LOGI(TAG, "Uplink profile: %d ms, complexity %d, dtx %d", uplink_profile_.frame_duration,
+        uplink_profile_.complexity, uplink_profile_.dtx);
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
@@ -386,51 +735,53 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
-    task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, uint32_t timestamp) {
+    AudioTask task;
+    task.type = type;
+    task.pcm = std::move(pcm);
+    task.timestamp = timestamp;
 
-    /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    /* Push the task to the encode queue */
+    std::lock_guard<std::mutex> lock(encode_producer_mutex_);
+    while (!audio_encode_queue_.TryPush(std::move(task))) {
+        if (service_stopped_) {
+            input_frame_pool_.Release(std::move(task.pcm));
+            return;
         }
-        timestamp_queue_.pop_front();
+        xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_SPACE, pdTRUE, pdFALSE, portMAX_DELAY);
     }
-
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_ENCODE_AVAILABLE);
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+    std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+    while (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE || !audio_decode_queue_.TryPush(std::move(packet))) {
+        if (!wait || service_stopped_) {
             return false;
         }
+        xEventGroupWaitBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_SPACE, pdTRUE, pdFALSE, portMAX_DELAY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_AVAILABLE);
+    return true;
+}
+
+bool AudioService::PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet) {
+    if (first_audio_pending_ && first_packet_time_us_ == 0) {
+        first_packet_time_us_ = esp_timer_get_time();
+    }
+    if (!jitter_buffer_.Push(std::move(packet), esp_timer_get_time())) {
+        return false;
+    }
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_AVAILABLE);
     return true;
 }
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    if (!audio_send_queue_.TryPop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_SEND_SPACE);
     return packet;
 }
 
@@ -465,6 +816,7 @@ void AudioService::EnableWakeWordDetection(bool enable) {
                 return;
             }
             wake_word_initialized_ = true;
+            ReserveInputFrames(wake_word_->GetFeedSize());
         }
         wake_word_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
@@ -478,8 +830,9 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, uplink_frame_duration_ms_, models_list_);
             audio_processor_initialized_ = true;
+            ReserveInputFrames(audio_processor_->GetFeedSize());
         }
 
         /* We should make sure no audio is playing */
@@ -499,23 +852,41 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Move audio_testing_queue_ to audio_decode_queue_ */
+        std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+        audio_decode_queue_.Clear();
+        std::unique_ptr<AudioStreamPacket> packet;
+        while (audio_testing_queue_.TryPop(packet)) {
+            audio_decode_queue_.TryPush(std::move(packet));
+        }
+        xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_AVAILABLE);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, uplink_frame_duration_ms_, models_list_);
         audio_processor_initialized_ = true;
+        ReserveInputFrames(audio_processor_->GetFeedSize());
     }
 
     audio_processor_->EnableDeviceAec(enable);
 }
 
+void AudioService::SetUplinkHeadroom(size_t headroom) {
+    uplink_headroom_ = headroom;
+}
+
+void AudioService::SetDownlinkReorderDepth(uint32_t depth) {
+    jitter_buffer_.SetReorderDepth(depth);
+}
+
+void AudioService::EnableUplinkGate(bool enable) {
+    ESP_LOGI(TAG, "%s uplink gate", enable ? "Enabling" : "Disabling");
+    uplink_gate_enabled_ = enable;
+}
+
 void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
@@ -620,18 +991,39 @@ void AudioService::PlaySound(const std::string_view& ogg) {
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty() &&
+        jitter_buffer_.empty();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    playback_clock_.Reset();
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+    jitter_buffer_.Clear();
+    first_packet_time_us_ = 0;
+    first_audio_pending_ = true;
+    /* Let the consumers release the discarded slots and the producers refill them */
+    xEventGroupSetBits(queue_event_group_, AS_QUEUE_EVENT_DECODE_AVAILABLE | AS_QUEUE_EVENT_DECODE_SPACE |
+        AS_QUEUE_EVENT_PLAYBACK_AVAILABLE | AS_QUEUE_EVENT_PLAYBACK_SPACE);
+}
+
+void AudioService::RecordFirstAudioLatency(const AudioTask& task, int64_t output_us) {
+    int64_t first_packet_us = first_packet_time_us_;
+    first_audio_pending_ = false;
+    if (first_packet_us == 0 || first_packet_us > task.decode_start_us) {
+        return;
+    }
+    uint32_t total_ms = (output_us - first_packet_us) / 1000;
+    debug_statistics_.last_first_audio_latency_ms = total_ms;
+    debug_statistics_.last_buffering_ms = (task.decode_start_us - first_packet_us) / 1000;
+    debug_statistics_.last_decode_ms = (task.decode_end_us - task.decode_start_us) / 1000;
+    debug_statistics_.last_output_ms = (output_us - task.decode_end_us) / 1000;
+    size_t bucket = std::min<size_t>(total_ms / FIRST_AUDIO_LATENCY_BUCKET_MS, FIRST_AUDIO_LATENCY_BUCKETS - 1);
+    debug_statistics_.first_audio_latency_histogram[bucket]++;
+    ESP_LOGI(TAG, "First audio latency: %lu ms (buffering %lu ms, decode %lu ms, output %lu ms)",
+        total_ms, debug_statistics_.last_buffering_ms, debug_statistics_.last_decode_ms, debug_statistics_.last_output_ms);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -649,6 +1041,32 @@ void AudioService::CheckAndUpdateAudioPowerState() {
     }
 }
 
+void AudioService::ReserveInputFrames(int samples) {
+    /* A pooled frame first holds the raw codec read, which is the largest form of the frame */
+    int raw_samples = samples * std::max(codec_->input_sample_rate(), 16000) / 16000 * codec_->input_channels();
+    input_frame_pool_.Reserve(raw_samples);
+}
+
+DebugStatistics AudioService::GetDebugStatistics() const {
+    DebugStatistics statistics = debug_statistics_;
+    statistics.heap_alloc_count = input_frame_pool_.allocation_count();
+    statistics.packet_alloc_count = AudioPacketPool::GetInstance().allocation_count();
+    statistics.playback_alloc_count = output_frame_pool_.allocation_count() + playback_task_alloc_count_.load(std::memory_order_relaxed);
+    auto jitter_statistics = jitter_buffer_.GetStatistics();
+    statistics.jitter_underrun_count = jitter_statistics.underrun_count;
+    statistics.jitter_late_count = jitter_statistics.late_count;
+    statistics.jitter_concealed_count = jitter_statistics.concealed_count;
+    statistics.jitter_ms = jitter_statistics.jitter_ms;
+    /* The tasks delete themselves once the service is stopped */
+    if (!service_stopped_ && opus_encode_task_handle_ != nullptr) {
+        statistics.encode_stack_free = uxTaskGetStackHighWaterMark(opus_encode_task_handle_);
+    }
+    if (!service_stopped_ && opus_decode_task_handle_ != nullptr) {
+        statistics.decode_stack_free = uxTaskGetStackHighWaterMark(opus_decode_task_handle_);
+    }
+    return statistics;
+}
+
 void AudioService::SetModelsList(srmodel_list_t* models_list) {
     models_list_ = models_list;
 
@@ -674,6 +1092,11 @@ void AudioService::SetModelsList(srmodel_list_t* models_list) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
+        wake_word_->OnSpeechStart([this]() {
+            if (callbacks_.on_wake_word_speech_start) {
+                callbacks_.on_wake_word_speech_start();
+            }
+        });
     }
 }
 
@@ -3,14 +3,15 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
+#include <soc/soc_caps.h>
 #include <model_path.h>
 
 #include <opus_encoder.h>
@@ -22,26 +23,73 @@
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
+#include "audio_packet_pool.h"
+#include "spsc_queue.h"
+#include "pcm_frame_pool.h"
+#include "jitter_buffer.h"
+#include "playback_clock.h"
 
 
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ *    (Local sounds / audio testing) -> {Decode Queue} ---^
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * We use one task for MIC / Speaker / Processors, and one task each for Opus Encoder and Opus Decoder,
+ * so that a long encode never delays the next decode (and the reverse) in realtime mode.
+ * Single core chips run both in one codec task, a second task would only cost its stack.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
  * 
+ * Every queue is a preallocated lock-free SPSC ring with its own wakeup bits in queue_event_group_,
+ * so a task waiting on one queue is never woken (or blocked) by traffic on another.
+ * Queues with more than one producer serialize the producers with a mutex the consumer never takes.
+ * 
  */
 
+// Default (and longest) frame, the uplink frame duration is picked at runtime by the UplinkProfile
 #define OPUS_FRAME_DURATION_MS 60
+#define OPUS_MIN_FRAME_DURATION_MS 20
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
 #define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define MAX_SEND_DURATION_MS 2400
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
-#define MAX_TIMESTAMPS_IN_QUEUE 3
+// Uplink rings are sized for the shortest frame, the limit in use follows the current frame duration
+#define MAX_SEND_PACKETS_IN_QUEUE (MAX_SEND_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+#define MAX_TESTING_PACKETS_IN_QUEUE (AUDIO_TESTING_MAX_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
+// Timestamped playback blocks remembered for server AEC, covers the DMA buffer and the playback queue
+#define PLAYBACK_CLOCK_ANCHORS 32
+// How often the decode task checks a jitter buffer that is waiting for its target delay
+#define JITTER_BUFFER_POLL_INTERVAL_MS 20
+// Frames in flight on the input path: reader + AFE output + encode queue + encoder
+#define PCM_FRAME_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + 4)
+#if CONFIG_USE_LOW_LATENCY_PLAYBACK
+// Decoded frames are sliced into DMA sized chunks, this many per frame at up to 48kHz output
+#define PLAYBACK_SLOTS_PER_FRAME (OPUS_FRAME_DURATION_MS * 48 / AUDIO_CODEC_DMA_FRAME_NUM)
+#else
+#define PLAYBACK_SLOTS_PER_FRAME 1
+#endif
+// Playback tasks in flight: playback queue + the frame being decoded + its chunk + the one being written
+#define PLAYBACK_TASK_POOL_SIZE (MAX_PLAYBACK_TASKS_IN_QUEUE * PLAYBACK_SLOTS_PER_FRAME + 3)
+// VAD gated uplink: audio kept from before the speech onset, and sent after the speech ends
+#define UPLINK_VAD_PREROLL_MS 300
+#define UPLINK_VAD_HANGOVER_MS 600
+// Opus DTX frames are 1 or 2 bytes and carry no audio
+#define OPUS_DTX_PACKET_MAX_BYTES 2
+// Server audio first audio latency histogram, from the first packet received to the first sample played
+#define FIRST_AUDIO_LATENCY_BUCKETS 10
+#define FIRST_AUDIO_LATENCY_BUCKET_MS 50
+
+// Codec task stacks in bytes, check them against the free stack reported in DebugStatistics
+#define OPUS_ENCODE_TASK_STACK_SIZE (2048 * 13)
+#define OPUS_DECODE_TASK_STACK_SIZE (2048 * 6)
+#if CONFIG_FREERTOS_UNICORE || SOC_CPU_CORES_NUM < 2
+#define OPUS_SEPARATE_DECODE_TASK 0
+#else
+#define OPUS_SEPARATE_DECODE_TASK 1
+#endif
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -52,9 +100,19 @@
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
 
+#define AS_QUEUE_EVENT_ENCODE_AVAILABLE     (1 << 0)
+#define AS_QUEUE_EVENT_ENCODE_SPACE         (1 << 1)
+#define AS_QUEUE_EVENT_DECODE_AVAILABLE     (1 << 2)
+#define AS_QUEUE_EVENT_DECODE_SPACE         (1 << 3)
+#define AS_QUEUE_EVENT_PLAYBACK_AVAILABLE   (1 << 4)
+#define AS_QUEUE_EVENT_PLAYBACK_SPACE       (1 << 5)
+#define AS_QUEUE_EVENT_SEND_SPACE           (1 << 6)
+#define AS_QUEUE_EVENT_ALL                  ((1 << 7) - 1)
+
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
+    std::function<void(void)> on_wake_word_speech_start;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
 };
@@ -67,9 +125,21 @@ enum AudioTaskType {
 };
 
 struct AudioTask {
-    AudioTaskType type;
+    AudioTaskType type = kAudioTaskTypeEncodeToSendQueue;
     std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    uint32_t timestamp = 0;
+    // Set on the first playback task of a server audio frame, for the first audio latency
+    int64_t decode_start_us = 0;
+    int64_t decode_end_us = 0;
+};
+
+// Time spent on each frame by the encode or decode task, the budget of a frame is its own duration
+struct CodecTimeStatistics {
+    uint32_t frame_count = 0;
+    uint32_t last_us = 0;
+    uint32_t average_us = 0;
+    uint32_t max_us = 0;
+    uint32_t over_budget_count = 0;
 };
 
 struct DebugStatistics {
@@ -77,6 +147,30 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    // Heap allocations taken by the PCM input path, should stop growing after warmup
+    uint32_t heap_alloc_count = 0;
+    // Heap allocations taken by Opus packets (both directions), should stop growing after warmup
+    uint32_t packet_alloc_count = 0;
+    // Heap allocations taken by the playback path (decoded frames and chunks), should stop growing after warmup
+    uint32_t playback_alloc_count = 0;
+    // Server audio jitter buffer
+    uint32_t jitter_underrun_count = 0;
+    uint32_t jitter_late_count = 0;
+    uint32_t jitter_concealed_count = 0;
+    uint32_t jitter_ms = 0;
+    // First audio latency of each utterance, the last bucket also counts everything slower
+    uint32_t first_audio_latency_histogram[FIRST_AUDIO_LATENCY_BUCKETS] = {};
+    uint32_t last_first_audio_latency_ms = 0;
+    uint32_t last_buffering_ms = 0;
+    uint32_t last_decode_ms = 0;
+    uint32_t last_output_ms = 0;
+    // Uplink packets not sent because of the VAD gate or DTX
+    uint32_t uplink_suppressed_count = 0;
+    CodecTimeStatistics encode_time;
+    CodecTimeStatistics decode_time;
+    // Lowest free stack of the codec tasks so far, in bytes (the same task on single core chips)
+    uint32_t encode_stack_free = 0;
+    uint32_t decode_stack_free = 0;
 };
 
 class AudioService {
@@ -100,15 +194,27 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Only send audio around detected speech, the server must be told the gaps are intentional
+    void EnableUplinkGate(bool enable);
+    // Room the transport needs in front of the Opus data to build its header in place
+    void SetUplinkHeadroom(size_t headroom);
+    // How late reordered server packets arrive, in packets, from the transport statistics
+    void SetDownlinkReorderDepth(uint32_t depth);
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    bool PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
     void PlaySound(const std::string_view& sound);
-    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
+    // timestamp, if given, receives the server timestamp being played when the first sample was captured
+    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, uint32_t* timestamp = nullptr);
+    void CaptureTimestamp(uint32_t* timestamp, int64_t duration_us);
     void ResetDecoder();
     void SetModelsList(srmodel_list_t* models_list);
+    // Rebuild the encoder and the input frame size, takes effect from the next encoded frame
+    void SetUplinkProfile(const UplinkProfile& profile);
+    DebugStatistics GetDebugStatistics() const;
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -125,20 +231,55 @@ private:
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
+    EventGroupHandle_t queue_event_group_;
 
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
+    SpscQueue<AudioTask> audio_encode_queue_;
+    SpscQueue<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    JitterBuffer jitter_buffer_;
+    // Serialize the producers of the multi-producer queues
+    std::mutex decode_producer_mutex_;
+    std::mutex encode_producer_mutex_;
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    PlaybackClock playback_clock_;
+    // Uplink profile, uplink_profile_ belongs to the encode task, the others are written by SetUplinkProfile
+    UplinkProfile uplink_profile_;
+    std::mutex uplink_profile_mutex_;
+    UplinkProfile pending_uplink_profile_;
+    std::atomic<bool> uplink_profile_changed_{false};
+    std::atomic<int> uplink_frame_duration_ms_{OPUS_FRAME_DURATION_MS};
+    std::atomic<bool> uplink_gate_enabled_{false};
+    std::atomic<size_t> uplink_headroom_{0};
+    // Encode task only
+    std::vector<uint8_t> encode_buffer_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> uplink_preroll_;
+    int uplink_hangover_frames_ = 0;
+
+    // First audio latency, armed by ResetDecoder for the next utterance
+    std::atomic<bool> first_audio_pending_{true};
+    // The decode stack is logged once, after the deepest path (concealment plus resampling)
+    bool decode_stack_logged_ = false;
+    std::atomic<int64_t> first_packet_time_us_{0};
+
+    // Input path buffers, reused for every frame
+    PcmFramePool input_frame_pool_;
+    std::vector<int16_t> mic_channel_;
+    std::vector<int16_t> reference_channel_;
+    std::vector<int16_t> resampled_mic_;
+    std::vector<int16_t> resampled_reference_;
+
+    // Playback path tasks and buffers, taken by the decode task and given back by the output task
+    PcmFramePool output_frame_pool_;
+    std::mutex playback_task_mutex_;
+    std::vector<std::unique_ptr<AudioTask>> free_playback_tasks_;
+    std::atomic<uint32_t> playback_task_alloc_count_{0};
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -152,10 +293,29 @@ private:
 
     void AudioInputTask();
     void AudioOutputTask();
+#if OPUS_SEPARATE_DECODE_TASK
+    void OpusEncodeTask();
+    void OpusDecodeTask();
+#else
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+#endif
+    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm, uint32_t timestamp = 0);
+    bool DecodeOnePacket();
+    bool EncodeOneTask();
+    std::unique_ptr<AudioTask> AcquirePlaybackTask(size_t samples);
+    void ReleasePlaybackTask(std::unique_ptr<AudioTask>&& task);
+    void PushTaskToPlaybackQueue(std::unique_ptr<AudioTask> task);
+#if CONFIG_USE_LOW_LATENCY_PLAYBACK
+    void PushDecodedChunksToPlaybackQueue(std::unique_ptr<AudioTask> frame);
+#endif
+    void ApplyUplinkProfile();
+    bool PassUplinkGate(std::unique_ptr<AudioStreamPacket>& packet);
+    void PushToSendQueue(std::unique_ptr<AudioStreamPacket>&& packet);
+    void ReleaseUplinkPreroll(size_t keep_frames);
+    void RecordFirstAudioLatency(const AudioTask& task, int64_t output_us);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckAndUpdateAudioPowerState();
+    void ReserveInputFrames(int samples);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "pcm_kernels.h"
+
+#include <cstring>
+
+/*
+ * Both Xtensa and RISC-V targets are little-endian, so a 32-bit word loaded from an
+ * interleaved buffer holds the left sample in the low half and the right one in the high half.
+ * memcpy on an aligned pointer compiles to a single word load / store.
+ */
+static inline uint32_t LoadWord(const int16_t* p) {
+    uint32_t word;
+    memcpy(&word, __builtin_assume_aligned(p, 4), sizeof(word));
+    return word;
+}
+
+static inline void StoreWord(int16_t* p, uint32_t word) {
+    memcpy(__builtin_assume_aligned(p, 4), &word, sizeof(word));
+}
+
+static inline bool IsWordAligned(const void* p) {
+    return (reinterpret_cast<uintptr_t>(p) & 3) == 0;
+}
+
+void PcmDeinterleaveStereoScalar(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        left[i] = in[j];
+        right[i] = in[j + 1];
+    }
+}
+
+void PcmDeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    if (!IsWordAligned(in) || !IsWordAligned(left) || !IsWordAligned(right)) {
+        PcmDeinterleaveStereoScalar(in, left, right, frames);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        uint32_t w0 = LoadWord(in + i * 2);
+        uint32_t w1 = LoadWord(in + i * 2 + 2);
+        uint32_t w2 = LoadWord(in + i * 2 + 4);
+        uint32_t w3 = LoadWord(in + i * 2 + 6);
+        StoreWord(left + i, (w0 & 0xFFFF) | (w1 << 16));
+        StoreWord(left + i + 2, (w2 & 0xFFFF) | (w3 << 16));
+        StoreWord(right + i, (w0 >> 16) | (w1 & 0xFFFF0000));
+        StoreWord(right + i + 2, (w2 >> 16) | (w3 & 0xFFFF0000));
+    }
+    PcmDeinterleaveStereoScalar(in + i * 2, left + i, right + i, frames - i);
+}
+
+void PcmInterleaveStereoScalar(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        out[j] = left[i];
+        out[j + 1] = right[i];
+    }
+}
+
+void PcmInterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    if (!IsWordAligned(left) || !IsWordAligned(right) || !IsWordAligned(out)) {
+        PcmInterleaveStereoScalar(left, right, out, frames);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        uint32_t l0 = LoadWord(left + i);
+        uint32_t l1 = LoadWord(left + i + 2);
+        uint32_t r0 = LoadWord(right + i);
+        uint32_t r1 = LoadWord(right + i + 2);
+        StoreWord(out + i * 2, (l0 & 0xFFFF) | (r0 << 16));
+        StoreWord(out + i * 2 + 2, (l0 >> 16) | (r0 & 0xFFFF0000));
+        StoreWord(out + i * 2 + 4, (l1 & 0xFFFF) | (r1 << 16));
+        StoreWord(out + i * 2 + 6, (l1 >> 16) | (r1 & 0xFFFF0000));
+    }
+    PcmInterleaveStereoScalar(left + i, right + i, out + i * 2, frames - i);
+}
+
+void PcmExtractLeftScalar(const int16_t* in, int16_t* out, size_t frames) {
+    for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+        out[i] = in[j];
+    }
+}
+
+void PcmExtractLeft(const int16_t* in, int16_t* out, size_t frames) {
+    if (!IsWordAligned(in) || !IsWordAligned(out)) {
+        PcmExtractLeftScalar(in, out, frames);
+        return;
+    }
+
+    // Output word k only depends on input words 2k and 2k+1, which are loaded first,
+    // so writing in place is safe
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        uint32_t w0 = LoadWord(in + i * 2);
+        uint32_t w1 = LoadWord(in + i * 2 + 2);
+        uint32_t w2 = LoadWord(in + i * 2 + 4);
+        uint32_t w3 = LoadWord(in + i * 2 + 6);
+        StoreWord(out + i, (w0 & 0xFFFF) | (w1 << 16));
+        StoreWord(out + i + 2, (w2 & 0xFFFF) | (w3 << 16));
+    }
+    PcmExtractLeftScalar(in + i * 2, out + i, frames - i);
+}
@@ -0,0 +1,28 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Channel layout kernels for 16-bit PCM.
+ *
+ * Each kernel has a plain scalar reference version (the *Scalar functions) and a fast
+ * version that moves two samples per 32-bit word when the buffers are word aligned.
+ * Both produce bit-identical output; the fast version falls back to the scalar one
+ * for unaligned buffers and for the odd tail frame.
+ */
+
+// in: L R L R ... (frames * 2 samples) -> left / right: frames samples each
+void PcmDeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, size_t frames);
+void PcmDeinterleaveStereoScalar(const int16_t* in, int16_t* left, int16_t* right, size_t frames);
+
+// left / right: frames samples each -> out: L R L R ...
+void PcmInterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, size_t frames);
+void PcmInterleaveStereoScalar(const int16_t* left, const int16_t* right, int16_t* out, size_t frames);
+
+// in: L R L R ... -> out: L L ...; out may be the same buffer as in
+void PcmExtractLeft(const int16_t* in, int16_t* out, size_t frames);
+void PcmExtractLeftScalar(const int16_t* in, int16_t* out, size_t frames);
+
+#endif // PCM_KERNELS_H
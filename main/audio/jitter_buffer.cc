@@ -0,0 +1,186 @@
+#include "jitter_buffer.h"
+
+#include <algorithm>
+
+JitterBuffer::JitterBuffer(size_t capacity) : capacity_(capacity) {
+    // A power of two slot count keeps sequence % size continuous across the 32 bit wrap
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    slots_.resize(slots);
+}
+
+bool JitterBuffer::Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!packet->has_sequence) {
+        packet->sequence = ++arrival_sequence_;
+        packet->has_sequence = true;
+    }
+    if (packet->frame_duration > 0) {
+        frame_duration_ms_ = packet->frame_duration;
+    }
+    uint32_t sequence = packet->sequence;
+
+    // Already played or concealed
+    if (has_played_ && (int32_t)(sequence - last_played_sequence_) <= 0) {
+        statistics_.late_count++;
+        return false;
+    }
+
+    if (drained_) {
+        // The stream did not end when the buffer ran empty
+        drained_ = false;
+        statistics_.underrun_count++;
+    }
+
+    UpdateJitter(sequence, now_us);
+
+    if (buffered_ == 0) {
+        if (!playing_) {
+            next_sequence_ = sequence;
+            first_arrival_us_ = now_us;
+        }
+        highest_sequence_ = sequence;
+    } else if (!playing_ && (int32_t)(sequence - next_sequence_) < 0) {
+        // Reordered before playout started, move the start back if it still fits
+        if (highest_sequence_ - sequence >= capacity_) {
+            statistics_.overflow_count++;
+            return false;
+        }
+        next_sequence_ = sequence;
+    }
+
+    if ((int32_t)(sequence - next_sequence_) < 0) {
+        statistics_.late_count++;
+        return false;
+    }
+    if (sequence - next_sequence_ >= capacity_) {
+        statistics_.overflow_count++;
+        return false;
+    }
+
+    auto& slot = slots_[sequence & (slots_.size() - 1)];
+    if (slot != nullptr && slot->sequence == sequence) {
+        // Duplicate
+        statistics_.late_count++;
+        return false;
+    }
+    slot = std::move(packet);
+    buffered_++;
+    if ((int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    return true;
+}
+
+JitterBufferResult JitterBuffer::Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffered_ == 0) {
+        if (playing_) {
+            // Either the end of the stream or an underrun, the next Push tells
+            playing_ = false;
+            drained_ = true;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    if (!playing_) {
+        int target_delay_ms = TargetDelayMs();
+        bool enough_audio = (int)buffered_ * frame_duration_ms_ >= target_delay_ms;
+        bool waited_long_enough = now_us - first_arrival_us_ >= (int64_t)target_delay_ms * 1000;
+        // Underruns later in the stream still rebuild the target delay
+        bool start_now = fast_start_ && !has_played_;
+        if (!enough_audio && !waited_long_enough && !start_now) {
+            return kJitterBufferEmpty;
+        }
+        // Do not conceal across an underrun, resume from whatever arrived first
+        next_sequence_ = LowestBufferedSequence();
+        statistics_.target_delay_ms = target_delay_ms;
+        playing_ = true;
+    }
+
+    uint32_t sequence = next_sequence_++;
+    last_played_sequence_ = sequence;
+    has_played_ = true;
+
+    auto& slot = slots_[sequence & (slots_.size() - 1)];
+    if (slot != nullptr && slot->sequence == sequence) {
+        packet = std::move(slot);
+        buffered_--;
+        return kJitterBufferPacket;
+    }
+    statistics_.concealed_count++;
+    return kJitterBufferConceal;
+}
+
+void JitterBuffer::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    buffered_ = 0;
+    playing_ = false;
+    drained_ = false;
+    has_played_ = false;
+    has_last_arrival_ = false;
+}
+
+void JitterBuffer::SetFastStart(bool fast_start) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fast_start_ = fast_start;
+}
+
+void JitterBuffer::SetReorderDepth(uint32_t depth) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reorder_depth_ = depth;
+}
+
+bool JitterBuffer::empty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffered_ == 0;
+}
+
+bool JitterBuffer::IsBuffering() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !playing_ && buffered_ > 0;
+}
+
+JitterBufferStatistics JitterBuffer::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto statistics = statistics_;
+    statistics.jitter_ms = jitter_us_ / 1000;
+    return statistics;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_us) {
+    if (has_last_arrival_) {
+        // D = difference between the arrival spacing and the send spacing of two packets
+        int64_t send_spacing_us = (int64_t)(int32_t)(sequence - last_arrival_sequence_) * frame_duration_ms_ * 1000;
+        int64_t d = (now_us - last_arrival_us_) - send_spacing_us;
+        if (d < 0) {
+            d = -d;
+        }
+        jitter_us_ += (d - jitter_us_) / 16;
+    }
+    has_last_arrival_ = true;
+    last_arrival_us_ = now_us;
+    last_arrival_sequence_ = sequence;
+}
+
+int JitterBuffer::TargetDelayMs() const {
+    int target = frame_duration_ms_ + (int)(JITTER_BUFFER_JITTER_FACTOR * jitter_us_ / 1000);
+    // A packet reorder_depth_ sequences late still arrives before its turn
+    target = std::max(target, (int)(reorder_depth_ + 1) * frame_duration_ms_);
+    return std::min(target, JITTER_BUFFER_MAX_DELAY_MS);
+}
+
+uint32_t JitterBuffer::LowestBufferedSequence() const {
+    uint32_t lowest = highest_sequence_;
+    for (const auto& slot : slots_) {
+        if (slot != nullptr && (int32_t)(slot->sequence - lowest) < 0) {
+            lowest = slot->sequence;
+        }
+    }
+    return lowest;
+}
@@ -0,0 +1,92 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MAX_DELAY_MS 600
+// Target delay = one frame + JITTER_BUFFER_JITTER_FACTOR * measured arrival jitter
+#define JITTER_BUFFER_JITTER_FACTOR 3
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,     // Nothing to play yet (buffering, or the stream has ended)
+    kJitterBufferPacket,    // The next packet in sequence order
+    kJitterBufferConceal,   // The next packet is missing, conceal one frame
+};
+
+struct JitterBufferStatistics {
+    uint32_t underrun_count = 0;    // Ran out of packets and more of the same stream came later
+    uint32_t late_count = 0;
+    uint32_t concealed_count = 0;
+    uint32_t overflow_count = 0;
+    uint32_t jitter_ms = 0;
+    uint32_t target_delay_ms = 0;
+};
+
+/*
+ * Reorders incoming server audio by sequence number and releases it at the pace it is pulled
+ * (the decoder pulls whenever the playback queue has room, i.e. at the playback rate).
+ *
+ * Playout starts once the buffered audio covers the target delay, which adapts to the
+ * arrival jitter measured as in RFC 3550, and to the reordering reported by the transport. A hole in the sequence is reported as
+ * kJitterBufferConceal so the decoder can run packet loss concealment; running out of
+ * packets stops playout until the buffer fills up to the target delay again. It only counts
+ * as an underrun once a later packet shows the stream had not ended; Clear() starts a new stream.
+ *
+ * Packets without has_sequence (e.g. WebSocket) are numbered by arrival, sequence 0 is a valid number.
+ * Time is passed in by the caller so the buffer can be driven by a simulated clock.
+ */
+class JitterBuffer {
+public:
+    explicit JitterBuffer(size_t capacity);
+
+    // Returns false if the packet is dropped (late, duplicate or the buffer is full)
+    bool Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_us);
+    JitterBufferResult Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_us);
+    void Clear();
+    // Start playout on the first packet of a stream instead of waiting for the target delay
+    void SetFastStart(bool fast_start);
+    // Packets arrive up to this many sequences late, the target delay covers them
+    void SetReorderDepth(uint32_t depth);
+
+    bool empty() const;
+    // True while there is audio waiting for the target delay to be reached
+    bool IsBuffering() const;
+    JitterBufferStatistics GetStatistics() const;
+
+private:
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> slots_;
+    size_t buffered_ = 0;
+    bool playing_ = false;
+    // Ran empty while playing, an underrun if the stream goes on
+    bool drained_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    uint32_t last_played_sequence_ = 0;
+    bool has_played_ = false;
+    bool fast_start_ = false;
+    uint32_t arrival_sequence_ = 0;
+    int64_t first_arrival_us_ = 0;
+
+    // Arrival jitter estimate, in microseconds
+    bool has_last_arrival_ = false;
+    int64_t last_arrival_us_ = 0;
+    uint32_t last_arrival_sequence_ = 0;
+    int64_t jitter_us_ = 0;
+    int frame_duration_ms_ = 60;
+    uint32_t reorder_depth_ = 0;
+
+    JitterBufferStatistics statistics_;
+
+    void UpdateJitter(uint32_t sequence, int64_t now_us);
+    int TargetDelayMs() const;
+    uint32_t LowestBufferedSequence() const;
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,52 @@
+#include "pcm_frame_pool.h"
+
+PcmFramePool::PcmFramePool(size_t frame_count) : frame_count_(frame_count) {
+    free_frames_.reserve(frame_count_);
+    for (size_t i = 0; i < frame_count_; i++) {
+        free_frames_.emplace_back();
+    }
+}
+
+void PcmFramePool::Reserve(size_t frame_samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frame_samples <= frame_samples_) {
+        return;
+    }
+    frame_samples_ = frame_samples;
+    for (auto& frame : free_frames_) {
+        frame.reserve(frame_samples_);
+    }
+}
+
+std::vector<int16_t> PcmFramePool::Acquire(size_t samples) {
+    std::vector<int16_t> frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_frames_.empty()) {
+            frame = std::move(free_frames_.back());
+            free_frames_.pop_back();
+        }
+    }
+    Resize(frame, samples);
+    return frame;
+}
+
+void PcmFramePool::Release(std::vector<int16_t>&& frame) {
+    // Moved-from frames have nothing to give back
+    if (frame.capacity() == 0) {
+        return;
+    }
+    frame.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_frames_.size() < frame_count_) {
+        free_frames_.push_back(std::move(frame));
+    }
+}
+
+void PcmFramePool::Resize(std::vector<int16_t>& frame, size_t samples) {
+    if (samples > frame.capacity()) {
+        allocation_count_.fetch_add(1, std::memory_order_relaxed);
+        frame.reserve(samples > frame_samples_ ? samples : frame_samples_);
+    }
+    frame.resize(samples);
+}
@@ -0,0 +1,42 @@
+#ifndef PCM_FRAME_POOL_H
+#define PCM_FRAME_POOL_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * A fixed set of reusable PCM frame buffers.
+ *
+ * Frames are handed out as plain std::vector<int16_t> so they can be moved through the
+ * existing Feed / OnOutput / encode queue interfaces, and are given back with Release()
+ * once the consumer is done. A released vector keeps its capacity, so in steady state
+ * Acquire() never touches the heap. Every time the heap is used anyway (pool exhausted
+ * or a frame has to grow), allocation_count() is incremented.
+ */
+class PcmFramePool {
+public:
+    explicit PcmFramePool(size_t frame_count);
+
+    // Make sure every pooled frame can hold at least frame_samples without reallocation
+    void Reserve(size_t frame_samples);
+    std::vector<int16_t> Acquire(size_t samples);
+    void Release(std::vector<int16_t>&& frame);
+
+    // Resize a frame that is already in use, counting the reallocation if it needs one
+    void Resize(std::vector<int16_t>& frame, size_t samples);
+
+    inline uint32_t allocation_count() const { return allocation_count_.load(std::memory_order_relaxed); }
+    inline size_t frame_samples() const { return frame_samples_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::vector<int16_t>> free_frames_;
+    size_t frame_count_;
+    size_t frame_samples_ = 0;
+    std::atomic<uint32_t> allocation_count_{0};
+};
+
+#endif // PCM_FRAME_POOL_H
@@ -0,0 +1,76 @@
+#include "playback_clock.h"
+
+#include <algorithm>
+
+PlaybackClock::PlaybackClock(size_t capacity, int dma_samples)
+    : anchors_(capacity), dma_samples_(dma_samples) {
+}
+
+void PlaybackClock::SetSampleRate(int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sample_rate_ = sample_rate;
+}
+
+void PlaybackClock::OnOutput(uint32_t timestamp_ms, size_t samples, int64_t write_start_us, int64_t write_end_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Everything written before has been played, the DMA started again from silence
+    if (PositionLocked(write_start_us) >= written_) {
+        sync_position_ = written_;
+        sync_us_ = write_start_us;
+    }
+
+    if (timestamp_ms != 0) {
+        auto& anchor = anchors_[next_anchor_];
+        anchor.position = written_;
+        anchor.samples = samples;
+        anchor.timestamp_ms = timestamp_ms;
+        next_anchor_ = (next_anchor_ + 1) % anchors_.size();
+    }
+    written_ += samples;
+
+    // A write that had to wait returned as soon as the DMA had room for its last block,
+    // so the DMA is full and this is the I2S clock, not the system timer
+    int64_t duration_us = (int64_t)samples * 1000000 / sample_rate_;
+    if (written_ >= (uint64_t)dma_samples_ && write_end_us - write_start_us > duration_us / 4) {
+        sync_position_ = written_ - dma_samples_;
+        sync_us_ = write_end_us;
+    }
+}
+
+uint32_t PlaybackClock::GetTimestamp(int64_t now_us) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t position = PositionLocked(now_us);
+    for (const auto& anchor : anchors_) {
+        if (anchor.samples != 0 && position >= anchor.position && position < anchor.position + anchor.samples) {
+            return anchor.timestamp_ms + (uint32_t)((position - anchor.position) * 1000 / sample_rate_);
+        }
+    }
+    return 0;
+}
+
+void PlaybackClock::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& anchor : anchors_) {
+        anchor.samples = 0;
+    }
+}
+
+uint64_t PlaybackClock::written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+uint64_t PlaybackClock::GetPosition(int64_t now_us) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return PositionLocked(now_us);
+}
+
+uint64_t PlaybackClock::PositionLocked(int64_t now_us) const {
+    uint64_t position = sync_position_;
+    if (now_us > sync_us_) {
+        position += (uint64_t)(now_us - sync_us_) * sample_rate_ / 1000000;
+    }
+    // The DMA never holds more than dma_samples_, and nothing plays before it is written
+    uint64_t lowest = written_ > (uint64_t)dma_samples_ ? written_ - dma_samples_ : 0;
+    return std::clamp(position, lowest, written_);
+}
@@ -0,0 +1,58 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Sample-accurate playback position for server-side AEC.
+ *
+ * The output task reports every block it hands to the codec. The sample counter advances
+ * at the I2S clock because the codec write blocks once its DMA buffer is full, and at that
+ * moment exactly dma_samples are waiting to be played. Between writes, the position is
+ * interpolated with the system timer, so timer drift never accumulates beyond one write.
+ *
+ * The input side asks which server timestamp is being played right now, interpolated
+ * inside the frame that contains the audible sample, or 0 if nothing is playing.
+ * Time is passed in by the caller so the clock can be driven by a simulated one.
+ */
+class PlaybackClock {
+public:
+    PlaybackClock(size_t capacity, int dma_samples);
+
+    void SetSampleRate(int sample_rate);
+    // Output side, call after the codec write returns. timestamp_ms is the server timestamp of the first sample
+    void OnOutput(uint32_t timestamp_ms, size_t samples, int64_t write_start_us, int64_t write_end_us);
+    // Input side
+    uint32_t GetTimestamp(int64_t now_us) const;
+    // Forget the timestamps of the audio still queued, e.g. when playback is aborted
+    void Reset();
+
+    // Total samples written to the codec, and the estimated position of the sample being played
+    uint64_t written() const;
+    uint64_t GetPosition(int64_t now_us) const;
+
+private:
+    struct Anchor {
+        uint64_t position = 0;
+        uint32_t samples = 0;
+        uint32_t timestamp_ms = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Anchor> anchors_;
+    size_t next_anchor_ = 0;
+    int dma_samples_;
+    int sample_rate_ = 16000;
+
+    uint64_t written_ = 0;
+    // The audible position was sync_position_ at sync_us_
+    uint64_t sync_position_ = 0;
+    int64_t sync_us_ = 0;
+
+    uint64_t PositionLocked(int64_t now_us) const;
+};
+
+#endif // PLAYBACK_CLOCK_H
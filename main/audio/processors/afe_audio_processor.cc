@@ -1,5 +1,6 @@
 #include "afe_audio_processor.h"
 #include <esp_log.h>
+#include <algorithm>
 
 #define PROCESSOR_RUNNING 0x01
 
@@ -88,10 +89,15 @@ size_t AfeAudioProcessor::GetFeedSize() {
     return afe_iface_->get_feed_chunksize(afe_data_);
 }
 
-void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
+void AfeAudioProcessor::Feed(std::vector<int16_t>&& data, uint32_t timestamp) {
     if (afe_data_ == nullptr) {
         return;
     }
+    timeline_.Append(data.size() / codec_->input_channels(), timestamp);
     afe_iface_->feed(afe_data_, data.data());
 }
 
@@ -104,16 +110,22 @@ void AfeAudioProcessor::Stop() {
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+    // The buffered input is gone, start counting samples again
+    timeline_.Reset();
 }
 
 bool AfeAudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data, uint32_t timestamp)> callback) {
     output_callback_ = callback;
 }
 
+void AfeAudioProcessor::SetFramePool(PcmFramePool* pool) {
+    frame_pool_ = pool;
+}
+
 void AfeAudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callback) {
     vad_state_change_callback_ = callback;
 }
@@ -124,6 +136,9 @@ void AfeAudioProcessor::AudioProcessorTask() {
     ESP_LOGI(TAG, "Audio communication task started, feed size: %d fetch size: %d",
         feed_size, fetch_size);
 
+    // Room for a partial frame plus one fetch, so appending never reallocates
+    output_buffer_.reserve(frame_samples_ + fetch_size);
+
     while (true) {
         xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
 
@@ -149,6 +164,11 @@ void AfeAudioProcessor::AudioProcessorTask() {
             }
         }
 
+        if (timeline_.ConsumeReset()) {
+            output_buffer_.clear();
+            output_position_ = 0;
+        }
+
         if (output_callback_) {
             size_t samples = res->data_size / sizeof(int16_t);
             
@@ -156,18 +176,18 @@ void AfeAudioProcessor::AudioProcessorTask() {
             output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
             
             // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
+            size_t frame_samples = frame_samples_;
+            while (output_buffer_.size() >= frame_samples) {
+                // Copy one frame into a pooled buffer and keep output_buffer_ (and its capacity) here
+                auto frame = frame_pool_ != nullptr ? frame_pool_->Acquire(frame_samples) : std::vector<int16_t>(frame_samples);
+                std::copy(output_buffer_.begin(), output_buffer_.begin() + frame_samples, frame.begin());
+                output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
+                uint32_t timestamp = timeline_.GetTimestamp(output_position_);
+                output_position_ += frame_samples;
+                output_callback_(std::move(frame), timestamp);
             }
+        } else {
+            output_position_ += res->data_size / sizeof(int16_t);
         }
     }
 }
@@ -9,9 +9,14 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "sample_timeline.h"
+
+// Fed chunks whose timestamps are remembered, enough for the AFE ring buffer plus one output frame
+#define AFE_FEED_ANCHORS 32
 
 class AfeAudioProcessor : public AudioProcessor {
 public:
@@ -19,11 +24,13 @@ public:
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) override;
-    void Feed(std::vector<int16_t>&& data) override;
+    void SetFrameDuration(int frame_duration_ms) override;
+    void Feed(std::vector<int16_t>&& data, uint32_t timestamp) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(std::vector<int16_t>&& data, uint32_t timestamp)> callback) override;
+    void SetFramePool(PcmFramePool* pool) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
@@ -32,12 +39,18 @@ private:
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(std::vector<int16_t>&& data, uint32_t timestamp)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    std::atomic<int> frame_samples_{0};
     bool is_speaking_ = false;
     std::vector<int16_t> output_buffer_;
+    PcmFramePool* frame_pool_ = nullptr;
+
+    // Server timestamps of the fed chunks, output frames look theirs up by input sample position
+    SampleTimeline timeline_{AFE_FEED_ANCHORS, 16000};
+    // Input sample position of output_buffer_[0], only used by the processor task
+    uint64_t output_position_ = 0;
 
     void AudioProcessorTask();
 };
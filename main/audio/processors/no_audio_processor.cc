@@ -1,4 +1,5 @@
 #include "no_audio_processor.h"
+#include "dsp/pcm_kernels.h"
 #include <esp_log.h>
 
 #define TAG "NoAudioProcessor"
@@ -8,21 +9,22 @@ void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srmo
     frame_samples_ = frame_duration_ms * 16000 / 1000;
 }
 
-void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
+void NoAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
+void NoAudioProcessor::Feed(std::vector<int16_t>&& data, uint32_t timestamp) {
     if (!is_running_ || !output_callback_) {
         return;
     }
 
     if (codec_->input_channels() == 2) {
-        // If input channels is 2, we need to fetch the left channel data
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-        output_callback_(std::move(mono_data));
-    } else {
-        output_callback_(std::move(data));
+        // If input channels is 2, we need to fetch the left channel data (in place)
+        PcmExtractLeft(data.data(), data.data(), data.size() / 2);
+        data.resize(data.size() / 2);
     }
+    // One input frame is one output frame, so the timestamp stays as it is
+    output_callback_(std::move(data), timestamp);
 }
 
 void NoAudioProcessor::Start() {
@@ -37,10 +39,14 @@ bool NoAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data, uint32_t timestamp)> callback) {
     output_callback_ = callback;
 }
 
+void NoAudioProcessor::SetFramePool(PcmFramePool* pool) {
+    // The input frame is forwarded as it is, nothing to allocate
+}
+
 void NoAudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callback) {
     vad_state_change_callback_ = callback;
 }
@@ -0,0 +1,49 @@
+#include "sample_timeline.h"
+
+SampleTimeline::SampleTimeline(size_t capacity, int sample_rate)
+    : anchors_(capacity), sample_rate_(sample_rate) {
+}
+
+void SampleTimeline::Append(uint32_t samples, uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& anchor = anchors_[next_anchor_];
+    anchor.position = fed_;
+    anchor.samples = samples;
+    anchor.timestamp = timestamp;
+    next_anchor_ = (next_anchor_ + 1) % anchors_.size();
+    fed_ += samples;
+}
+
+uint32_t SampleTimeline::GetTimestamp(uint64_t position) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& anchor : anchors_) {
+        if (anchor.samples != 0 && position >= anchor.position && position < anchor.position + anchor.samples) {
+            if (anchor.timestamp == 0) {
+                return 0;
+            }
+            return anchor.timestamp + (uint32_t)((position - anchor.position) * 1000 / sample_rate_);
+        }
+    }
+    return 0;
+}
+
+void SampleTimeline::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& anchor : anchors_) {
+        anchor.samples = 0;
+    }
+    fed_ = 0;
+    reset_pending_ = true;
+}
+
+bool SampleTimeline::ConsumeReset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool reset = reset_pending_;
+    reset_pending_ = false;
+    return reset;
+}
+
+uint64_t SampleTimeline::fed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return fed_;
+}
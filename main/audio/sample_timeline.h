@@ -0,0 +1,46 @@
+#ifndef SAMPLE_TIMELINE_H
+#define SAMPLE_TIMELINE_H
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Server timestamps of the chunks fed to an audio processor, by input sample position.
+ *
+ * A processor that outputs one sample per input sample (the AFE does, whatever its delay)
+ * finds the timestamp of an output frame from the input position of its first sample,
+ * interpolated inside the chunk that contains it. Feeding and lookups run on different tasks.
+ */
+class SampleTimeline {
+public:
+    SampleTimeline(size_t capacity, int sample_rate);
+
+    // Input side, timestamp is that of the first sample of the chunk, 0 if none
+    void Append(uint32_t samples, uint32_t timestamp);
+    // Output side, 0 if the position is no longer remembered or its chunk had no timestamp
+    uint32_t GetTimestamp(uint64_t position) const;
+    // Forget the chunks fed so far and count from 0 again, e.g. when the processor drops its buffers
+    void Reset();
+    // Output side, true once after each Reset() so the reader restarts its own position too
+    bool ConsumeReset();
+
+    uint64_t fed() const;
+
+private:
+    struct Anchor {
+        uint64_t position = 0;
+        uint32_t samples = 0;
+        uint32_t timestamp = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Anchor> anchors_;
+    size_t next_anchor_ = 0;
+    int sample_rate_;
+    uint64_t fed_ = 0;
+    bool reset_pending_ = false;
+};
+
+#endif // SAMPLE_TIMELINE_H
@@ -0,0 +1,120 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Fixed-capacity single-producer / single-consumer ring buffer.
+ *
+ * All slots are allocated once in the constructor, so Push / Pop never touch the heap.
+ * Only one task may call TryPush and only one task may call TryPop at a time.
+ * Clear() may be called from any task: it marks everything pushed so far as discarded.
+ * The producer may refill the queue right away, and the consumer skips the discarded
+ * slots on its next TryPop, handing each item to the discard handler. There are twice
+ * as many slots as the capacity, so new items never land on slots still being skipped.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : capacity_(capacity), mask_(RoundUpToPowerOfTwo(capacity * 2) - 1), slots_(new T[mask_ + 1]) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    inline size_t capacity() const { return capacity_; }
+
+    // Receives discarded items on the consumer task, e.g. to give them back to a pool.
+    // Set before the queue is used. Without a handler discarded items are destroyed.
+    void SetDiscardHandler(std::function<void(T&&)> handler) { on_discard_ = std::move(handler); }
+
+    // Producer side. The item is only moved from if it is pushed.
+    bool TryPush(T&& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t discard = discard_until_.load(std::memory_order_acquire);
+        // Discarded items do not count, but their slots stay with the consumer until it skips them
+        uint32_t live_tail = (int32_t)(discard - tail) > 0 ? discard : tail;
+        if (head - live_tail >= capacity_ || head - tail > mask_) {
+            return false;
+        }
+        slots_[head & mask_] = std::move(item);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool TryPop(T& item) {
+        uint32_t tail = ReleaseDiscarded();
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        item = std::move(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Any task. Discarded items are passed to the discard handler by the consumer.
+    void Clear() {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t discard = discard_until_.load(std::memory_order_relaxed);
+        while ((int32_t)(head - discard) > 0 &&
+            !discard_until_.compare_exchange_weak(discard, head, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Number of live (not discarded) items, exact when called from either end.
+    size_t size() const {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t discard = discard_until_.load(std::memory_order_acquire);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if ((int32_t)(discard - tail) > 0) {
+            tail = discard;
+        }
+        return (int32_t)(head - tail) > 0 ? head - tail : 0;
+    }
+
+    inline bool empty() const { return size() == 0; }
+
+private:
+    const size_t capacity_;
+    // Slot count is a power of two so the free-running indices stay valid across wraparound
+    const uint32_t mask_;
+    std::unique_ptr<T[]> slots_;
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> discard_until_{0};
+    std::function<void(T&&)> on_discard_;
+
+    static uint32_t RoundUpToPowerOfTwo(size_t value) {
+        uint32_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    uint32_t ReleaseDiscarded() {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t discard = discard_until_.load(std::memory_order_acquire);
+        if ((int32_t)(discard - tail) <= 0) {
+            return tail;
+        }
+        while (tail != discard) {
+            T item = std::move(slots_[tail & mask_]);
+            if (on_discard_) {
+                on_discard_(std::move(item));
+            }
+            tail++;
+        }
+        tail_.store(tail, std::memory_order_release);
+        return tail;
+    }
+};
+
+#endif // SPSC_QUEUE_H
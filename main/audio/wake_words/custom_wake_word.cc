@@ -2,6 +2,7 @@
 #include "audio_service.h"
 #include "system_info.h"
 #include "assets.h"
+#include "dsp/pcm_kernels.h"
 
 #include <esp_log.h>
 #include <esp_mn_iface.h>
@@ -147,9 +148,7 @@ void CustomWakeWord::Feed(const std::vector<int16_t>& data) {
     // If input channels is 2, we need to fetch the left channel data
     if (codec_->input_channels() == 2) {
         auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
+        PcmExtractLeft(data.data(), mono_data.data(), mono_data.size());
 
         StoreWakeWordData(mono_data);
         mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(mono_data.data()));
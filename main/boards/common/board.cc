@@ -62,6 +62,23 @@ Camera* Board::GetCamera() {
     return nullptr;
 }
 
+UplinkProfile Board::GetUplinkProfile() {
+    // Spend the spare CPU of the dual core chips on shorter frames (lower latency) and encoder quality,
+    // the other chips keep the long frames that cost the least per second of audio
+    UplinkProfile profile;
+#if CONFIG_IDF_TARGET_ESP32P4
+    profile.frame_duration = 20;
+    profile.complexity = 5;
+#elif CONFIG_IDF_TARGET_ESP32S3
+    profile.frame_duration = 40;
+    profile.complexity = 3;
+#else
+    profile.frame_duration = 60;
+    profile.complexity = 0;
+#endif
+    return profile;
+}
+
 Led* Board::GetLed() {
     static NoLed led;
     return &led;
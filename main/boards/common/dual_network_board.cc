@@ -61,6 +61,10 @@ std::string DualNetworkBoard::GetBoardType() {
     return current_board_->GetBoardType();
 }
 
+UplinkProfile DualNetworkBoard::GetUplinkProfile() {
+    return current_board_->GetUplinkProfile();
+}
+
 void DualNetworkBoard::StartNetwork() {
     auto display = Board::GetInstance().GetDisplay();
     
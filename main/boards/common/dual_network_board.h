@@ -54,6 +54,7 @@ public:
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual std::string GetBoardJson() override;
     virtual std::string GetDeviceStatusJson() override;
+    virtual UplinkProfile GetUplinkProfile() override;
 };
 
 #endif // DUAL_NETWORK_BOARD_H 
\ No newline at end of file
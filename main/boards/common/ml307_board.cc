@@ -18,6 +18,15 @@ std::string Ml307Board::GetBoardType() {
     return "ml307";
 }
 
+UplinkProfile Ml307Board::GetUplinkProfile() {
+    // Every packet pays the cellular per-packet overhead, so keep the longest frames whatever the chip,
+    // and save data during silence
+    auto profile = Board::GetUplinkProfile();
+    profile.frame_duration = 60;
+    profile.dtx = true;
+    return profile;
+}
+
 void Ml307Board::StartNetwork() {
     auto& application = Application::GetInstance();
     auto display = Board::GetInstance().GetDisplay();
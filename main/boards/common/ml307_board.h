@@ -23,6 +23,7 @@ public:
     virtual const char* GetNetworkStateIcon() override;
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
+    virtual UplinkProfile GetUplinkProfile() override;
     virtual std::string GetDeviceStatusJson() override;
 };
 
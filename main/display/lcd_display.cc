@@ -945,8 +945,9 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         
         if (gif_controller_->IsLoaded()) {
             // Set up frame update callback
-            gif_controller_->SetFrameCallback([this]() {
-                lv_image_set_src(emoji_image_, gif_controller_->image_dsc());
+            gif_controller_->SetFrameCallback([this](const lv_area_t& area) {
+                // 只重绘这一帧变化的区域
+                gif_controller_->InvalidateArea(emoji_image_, area);
             });
             
             // Set initial frame and start animation
@@ -33,6 +33,7 @@ typedef struct _gd_GIF {
     uint16_t width, height;
     uint16_t depth;
     int32_t loop_count;
+    int32_t frame_index;  /* 当前帧在一遍动画中的序号，读到第一帧前为 -1 */
     gd_GCE gce;
     gd_Palette * palette;
     gd_Palette lct, gct;
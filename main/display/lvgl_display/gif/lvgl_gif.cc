@@ -1,9 +1,50 @@
 #include "lvgl_gif.h"
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <sdkconfig.h>
 #include <cstring>
+#include <algorithm>
 
 #define TAG "LvglGif"
 
+// Endless GIFs whose frames fit in this many bytes of PSRAM are decoded twice and then
+// played from the cache by switching the image buffer; 0 disables the cache
+#ifndef GIF_FRAME_CACHE_MAX_BYTES
+#if CONFIG_SPIRAM
+#define GIF_FRAME_CACHE_MAX_BYTES (1024 * 1024)
+#else
+#define GIF_FRAME_CACHE_MAX_BYTES 0
+#endif
+#endif
+
+// Area of the current frame clipped to the canvas, empty if the frame is outside
+static lv_area_t GetFrameArea(const gd_GIF* gif) {
+    lv_area_t area;
+    area.x1 = gif->fx;
+    area.y1 = gif->fy;
+    area.x2 = std::min<int32_t>(gif->fx + gif->fw, gif->width) - 1;
+    area.y2 = std::min<int32_t>(gif->fy + gif->fh, gif->height) - 1;
+    return area;
+}
+
+static bool IsAreaEmpty(const lv_area_t& area) {
+    return area.x2 < area.x1 || area.y2 < area.y1;
+}
+
+static void JoinArea(lv_area_t& area, const lv_area_t& other) {
+    if (IsAreaEmpty(other)) {
+        return;
+    }
+    if (IsAreaEmpty(area)) {
+        area = other;
+        return;
+    }
+    area.x1 = std::min(area.x1, other.x1);
+    area.y1 = std::min(area.y1, other.y1);
+    area.x2 = std::max(area.x2, other.x2);
+    area.y2 = std::max(area.y2, other.y2);
+}
+
 LvglGif::LvglGif(const lv_img_dsc_t* img_dsc)
     : gif_(nullptr), timer_(nullptr), last_call_(0), playing_(false), loaded_(false) {
     if (!img_dsc || !img_dsc->data) {
@@ -33,6 +74,7 @@ LvglGif::LvglGif(const lv_img_dsc_t* img_dsc)
         gd_render_frame(gif_, gif_->canvas);
     }
 
+    cache_disabled_ = GIF_FRAME_CACHE_MAX_BYTES == 0;
     loaded_ = true;
     ESP_LOGD(TAG, "GIF loaded from image descriptor: %dx%d", gif_->width, gif_->height);
 }
@@ -104,7 +146,17 @@ void LvglGif::Stop() {
         lv_timer_pause(timer_);
     }
 
+    if (cache_ready_) {
+        // The next frame is the first cached one, drawn in full over the current frame
+        cache_index_ = frame_count_ - 1;
+        full_redraw_ = true;
+        ESP_LOGD(TAG, "GIF animation stopped and rewound");
+        return;
+    }
+
     if (gif_) {
+        // Frames are counted again from the first one
+        ReleaseFrameCache();
         gd_rewind(gif_);
         NextFrame();
         ESP_LOGD(TAG, "GIF animation stopped and rewound");
@@ -131,6 +183,11 @@ void LvglGif::SetLoopCount(int32_t count) {
         ESP_LOGW(TAG, "GIF not loaded, cannot set loop count");
         return;
     }
+    if (count != 0) {
+        // Only endless GIFs are cached
+        ReleaseFrameCache();
+        cache_disabled_ = true;
+    }
     gif_->loop_count = count;
 }
 
@@ -148,15 +205,46 @@ uint16_t LvglGif::height() const {
     return gif_->height;
 }
 
-void LvglGif::SetFrameCallback(std::function<void()> callback) {
+bool LvglGif::IsFrameCached() const {
+    return cache_ready_;
+}
+
+void LvglGif::SetFrameCallback(std::function<void(const lv_area_t& area)> callback) {
     frame_callback_ = callback;
 }
 
+void LvglGif::InvalidateArea(lv_obj_t* image, const lv_area_t& area) const {
+    // LVGL caches images by descriptor, the frame data changed in place or moved to another buffer
+    lv_image_cache_drop(&img_dsc_);
+    if (IsAreaEmpty(area)) {
+        return;
+    }
+
+    lv_area_t coords;
+    lv_obj_get_content_coords(image, &coords);
+    // Only an image drawn 1:1 at the object's origin maps to screen coordinates by an offset
+    if (lv_image_get_scale(image) != LV_SCALE_NONE || lv_image_get_rotation(image) != 0 ||
+        lv_image_get_offset_x(image) != 0 || lv_image_get_offset_y(image) != 0 ||
+        lv_area_get_width(&coords) != img_dsc_.header.w || lv_area_get_height(&coords) != img_dsc_.header.h) {
+        lv_obj_invalidate(image);
+        return;
+    }
+
+    lv_area_t screen_area = area;
+    lv_area_move(&screen_area, coords.x1, coords.y1);
+    lv_obj_invalidate_area(image, &screen_area);
+}
+
 void LvglGif::NextFrame() {
     if (!loaded_ || !gif_ || !playing_) {
         return;
     }
 
+    if (cache_ready_) {
+        NextCachedFrame();
+        return;
+    }
+
     // Check if enough time has passed for the next frame
     uint32_t elapsed = lv_tick_elaps(last_call_);
     if (elapsed < gif_->gce.delay * 10) {
@@ -165,6 +253,16 @@ void LvglGif::NextFrame() {
 
     last_call_ = lv_tick_get();
 
+    // Disposal only changes the previous frame's area when it is restored to the background,
+    // the other methods leave the canvas as it is
+    lv_area_t area = { 0, 0, -1, -1 };
+    if (full_redraw_) {
+        area = { 0, 0, gif_->width - 1, gif_->height - 1 };
+        full_redraw_ = false;
+    } else if (gif_->gce.disposal == 2) {
+        area = GetFrameArea(gif_);
+    }
+
     // Get next frame
     int has_next = gd_get_frame(gif_);
     if (has_next == 0) {
@@ -179,14 +277,118 @@ void LvglGif::NextFrame() {
     // Render current frame
     if (gif_->canvas) {
         gd_render_frame(gif_, gif_->canvas);
+        JoinArea(area, GetFrameArea(gif_));
+
+        if (has_next == 1) {
+            CacheFrame(area);
+        } else {
+            ReleaseFrameCache();
+        }
         
         // Call frame callback if set
         if (frame_callback_) {
-            frame_callback_();
+            frame_callback_(area);
         }
     }
 }
 
+void LvglGif::NextCachedFrame() {
+    uint32_t elapsed = lv_tick_elaps(last_call_);
+    if (elapsed < cached_frames_[cache_index_].delay * 10) {
+        return;
+    }
+
+    last_call_ = lv_tick_get();
+
+    cache_index_ = (cache_index_ + 1) % frame_count_;
+    img_dsc_.data = cache_buffer_ + cache_index_ * img_dsc_.data_size;
+
+    lv_area_t area = cached_frames_[cache_index_].area;
+    if (full_redraw_) {
+        area = { 0, 0, gif_->width - 1, gif_->height - 1 };
+        full_redraw_ = false;
+    }
+    if (frame_callback_) {
+        frame_callback_(area);
+    }
+}
+
+void LvglGif::CacheFrame(const lv_area_t& area) {
+    if (cache_disabled_) {
+        return;
+    }
+
+    int32_t index = gif_->frame_index;
+    if (index == 0) {
+        loops_++;
+    }
+    if (loops_ <= 1) {
+        frame_count_ = index + 1;
+        return;
+    }
+
+    // Frames of the first loop are drawn over the initial canvas. From the second loop on,
+    // every pixel is last written by the same frame each loop, so the second loop repeats exactly
+    if (loops_ == 2 && index == 0) {
+        size_t size = (size_t)frame_count_ * img_dsc_.data_size;
+        if (gif_->loop_count != 0 || size > GIF_FRAME_CACHE_MAX_BYTES ||
+            heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) < size * 2) {
+            ESP_LOGD(TAG, "Not caching %ld GIF frames of %lu bytes", (long)frame_count_, (unsigned long)size);
+            cache_disabled_ = true;
+            return;
+        }
+        cache_buffer_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (cache_buffer_ == nullptr) {
+            ESP_LOGW(TAG, "Failed to allocate %lu bytes for the GIF frame cache", (unsigned long)size);
+            cache_disabled_ = true;
+            return;
+        }
+        cached_frames_.resize(frame_count_);
+    }
+    if (cache_buffer_ == nullptr) {
+        return;
+    }
+    if (index >= frame_count_) {
+        ESP_LOGW(TAG, "GIF has more frames in the second loop than in the first");
+        ReleaseFrameCache();
+        cache_disabled_ = true;
+        return;
+    }
+
+    uint8_t* frame = cache_buffer_ + index * img_dsc_.data_size;
+    memcpy(frame, gif_->canvas, img_dsc_.data_size);
+    cached_frames_[index] = { area, gif_->gce.delay };
+    if (frame_count_ == 1) {
+        // A still image repeated by the loop never changes
+        cached_frames_[index].area = { 0, 0, -1, -1 };
+    }
+
+    if (index == frame_count_ - 1) {
+        // The canvas holds the same pixels, so switching buffers does not change the image
+        cache_ready_ = true;
+        cache_index_ = index;
+        img_dsc_.data = frame;
+        ESP_LOGI(TAG, "Cached %ld GIF frames, %lu bytes", (long)frame_count_,
+                 (unsigned long)(frame_count_ * img_dsc_.data_size));
+    }
+}
+
+void LvglGif::ReleaseFrameCache() {
+    if (cache_ready_) {
+        // The decoder continues from the canvas, which no longer matches the image shown
+        memcpy(gif_->canvas, img_dsc_.data, img_dsc_.data_size);
+        img_dsc_.data = gif_->canvas;
+        full_redraw_ = true;
+        cache_ready_ = false;
+    }
+    if (cache_buffer_) {
+        heap_caps_free(cache_buffer_);
+        cache_buffer_ = nullptr;
+    }
+    cached_frames_.clear();
+    loops_ = 0;
+}
+
 void LvglGif::Cleanup() {
     // Stop and delete timer
     if (timer_) {
@@ -194,6 +396,8 @@ void LvglGif::Cleanup() {
         timer_ = nullptr;
     }
 
+    ReleaseFrameCache();
+
     // Close GIF decoder
     if (gif_) {
         gd_close_gif(gif_);
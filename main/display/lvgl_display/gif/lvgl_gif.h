@@ -5,6 +5,7 @@
 #include <lvgl.h>
 #include <memory>
 #include <functional>
+#include <vector>
 
 /**
  * C++ implementation of LVGL GIF widget
@@ -64,10 +65,24 @@ public:
     uint16_t width() const;
     uint16_t height() const;
 
+    /**
+     * Check if frames are played from the frame cache instead of being decoded
+     */
+    bool IsFrameCached() const;
+
     /**
      * Set frame update callback
+     * @param callback Receives the area of the image changed by the frame, in image
+     *                 coordinates; the area is empty if no pixel changed
+     */
+    void SetFrameCallback(std::function<void(const lv_area_t& area)> callback);
+
+    /**
+     * Redraw the part of an image object showing this GIF that a frame changed
+     * @param image Image object whose source is image_dsc()
+     * @param area  Area passed to the frame callback
      */
-    void SetFrameCallback(std::function<void()> callback);
+    void InvalidateArea(lv_obj_t* image, const lv_area_t& area) const;
 
 private:
     // GIF decoder instance
@@ -87,12 +102,41 @@ private:
     bool loaded_;
     
     // Frame update callback
-    std::function<void()> frame_callback_;
+    std::function<void(const lv_area_t& area)> frame_callback_;
+
+    // Decoded frame cache, filled during the second loop of an endless GIF
+    struct CachedFrame {
+        lv_area_t area;
+        uint16_t delay;
+    };
+    uint8_t* cache_buffer_ = nullptr;
+    std::vector<CachedFrame> cached_frames_;
+    int32_t frame_count_ = 0;
+    int32_t loops_ = 0;
+    int32_t cache_index_ = 0;
+    bool cache_ready_ = false;
+    bool cache_disabled_ = false;
+    bool full_redraw_ = false;
     
     /**
      * Update to next frame
      */
     void NextFrame();
+
+    /**
+     * Show the next frame from the frame cache
+     */
+    void NextCachedFrame();
+
+    /**
+     * Count frames in the first loop and copy them to the cache in the second
+     */
+    void CacheFrame(const lv_area_t& area);
+
+    /**
+     * Free the frame cache and go back to decoding
+     */
+    void ReleaseFrameCache();
     
     /**
      * Cleanup resources
@@ -4,16 +4,34 @@
 #include <stddef.h>
 #include <string.h>
 #include <memory>
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include <esp_attr.h>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
+#include <esp_pthread.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include "jpeg_encoder.h"  // 使用新的JPEG编码器
+#include "jpeg_backend.h"
 #include "image_to_jpeg.h"
 
 
 #define TAG "image_to_jpeg"
 
+// 并行编码的线程数，默认每个核一个。图像按 MCU 行切成同样多的条带，条带之间用 RSTn 分隔
+#ifndef JPEG_ENCODE_THREADS
+#define JPEG_ENCODE_THREADS portNUM_PROCESSORS
+#endif
+// 编码器和行缓冲都在堆上，工作线程只需要很小的栈
+#define JPEG_ENCODE_STACK_SIZE 4096
+// 工作线程会被固定到另一个核，那里跑着 Opus 解码（优先级 3）和编码（2）任务。
+// 工作线程的优先级取调用者优先级和这个值中较小的一个，保证拍照编码只用空闲的 CPU，不会让播放断音
+#define JPEG_ENCODE_WORKER_PRIORITY 1
+
 static void *_malloc(size_t size)
 {
     void * res = malloc(size);
@@ -28,60 +46,47 @@ static void *_malloc(size_t size)
     return NULL;
 }
 
-static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uint8_t * dst, size_t width, size_t in_channels, size_t line)
+static void *_realloc(void *ptr, size_t size)
+{
+    void * res = realloc(ptr, size);
+    if(res) {
+        return res;
+    }
+
+#if (CONFIG_SPIRAM_SUPPORT && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    return heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+    return NULL;
+}
+
+// 只有 RGB888 还逐行转换成编码器的输入，其它格式由 process_frame 直接从整帧读取
+static IRAM_ATTR void convert_line_format(uint8_t * src, uint8_t * dst, size_t width, size_t line)
 {
     int i=0, o=0, l=0;
-    if(format == PIXFORMAT_GRAYSCALE) {
-        memcpy(dst, src + line * width, width);
-    } else if(format == PIXFORMAT_RGB888) {
-        l = width * 3;
-        src += l * line;
-        for(i=0; i<l; i+=3) {
-            dst[o++] = src[i+2];
-            dst[o++] = src[i+1];
-            dst[o++] = src[i];
-        }
-    } else if(format == PIXFORMAT_RGB565) {
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=2) {
-            dst[o++] = src[i] & 0xF8;
-            dst[o++] = (src[i] & 0x07) << 5 | (src[i+1] & 0xE0) >> 3;
-            dst[o++] = (src[i+1] & 0x1F) << 3;
-        }
-    } else if(format == PIXFORMAT_YUV422) {
-        // YUV422转RGB的简化实现
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=4) {
-            int y0 = src[i];
-            int u = src[i+1];
-            int y1 = src[i+2];
-            int v = src[i+3];
-
-            // 简化的YUV到RGB转换
-            int c = y0 - 16;
-            int d = u - 128;
-            int e = v - 128;
-            
-            int r = (298 * c + 409 * e + 128) >> 8;
-            int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
-            int b = (298 * c + 516 * d + 128) >> 8;
-            
-            dst[o++] = (r < 0) ? 0 : ((r > 255) ? 255 : r);
-            dst[o++] = (g < 0) ? 0 : ((g > 255) ? 255 : g);
-            dst[o++] = (b < 0) ? 0 : ((b > 255) ? 255 : b);
-
-            // Y1像素
-            c = y1 - 16;
-            r = (298 * c + 409 * e + 128) >> 8;
-            g = (298 * c - 100 * d - 208 * e + 128) >> 8;
-            b = (298 * c + 516 * d + 128) >> 8;
-            
-            dst[o++] = (r < 0) ? 0 : ((r > 255) ? 255 : r);
-            dst[o++] = (g < 0) ? 0 : ((g > 255) ? 255 : g);
-            dst[o++] = (b < 0) ? 0 : ((b > 255) ? 255 : b);
-        }
+    l = width * 3;
+    src += l * line;
+    for(i=0; i<l; i+=3) {
+        dst[o++] = src[i+2];
+        dst[o++] = src[i+1];
+        dst[o++] = src[i];
+    }
+}
+
+// 可直接读取整帧的格式返回 true
+static bool get_frame_format(pixformat_t format, jpge2_simple::frame_format_t *frame_format)
+{
+    switch (format) {
+    case PIXFORMAT_GRAYSCALE:
+        *frame_format = jpge2_simple::FRAME_GRAYSCALE;
+        return true;
+    case PIXFORMAT_RGB565:
+        *frame_format = jpge2_simple::FRAME_RGB565;
+        return true;
+    case PIXFORMAT_YUV422:
+        *frame_format = jpge2_simple::FRAME_YUYV;
+        return true;
+    default:
+        return false;
     }
 }
 
@@ -140,15 +145,63 @@ public:
     }
 };
 
-// 使用优化的JPEG编码器进行图像转换，必须在堆上创建编码器
-static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge2_simple::output_stream *dst_stream)
+// 可增长的内存流 - 并行编码时暂存一个条带的数据，按顺序拼接到输出流
+class segment_stream : public jpge2_simple::output_stream {
+protected:
+    uint8_t *out_buf;
+    size_t capacity, index;
+
+public:
+    segment_stream() : out_buf(NULL), capacity(0), index(0) { }
+
+    virtual ~segment_stream()
+    {
+        free(out_buf);
+    }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (!pBuf) {
+            return true;
+        }
+        if (index + len > capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 4096;
+            while (new_capacity < index + len) {
+                new_capacity *= 2;
+            }
+            uint8_t *new_buf = (uint8_t *)_realloc(out_buf, new_capacity);
+            if (!new_buf) {
+                ESP_LOGE(TAG, "JPG segment realloc of %u bytes failed", new_capacity);
+                return false;
+            }
+            out_buf = new_buf;
+            capacity = new_capacity;
+        }
+        memcpy(out_buf + index, pBuf, len);
+        index += len;
+        return true;
+    }
+
+    virtual jpge2_simple::uint get_size() const
+    {
+        return static_cast<jpge2_simple::uint>(index);
+    }
+
+    const uint8_t *data() const
+    {
+        return out_buf;
+    }
+};
+
+static jpge2_simple::params make_params(pixformat_t format, uint8_t quality, int *num_channels)
 {
-    int num_channels = 3;
-    jpge2_simple::subsampling_t subsampling = jpge2_simple::H2V2;
+    jpge2_simple::params comp_params = jpge2_simple::params();
+    comp_params.m_subsampling = jpge2_simple::H2V2;
+    *num_channels = 3;
 
     if(format == PIXFORMAT_GRAYSCALE) {
-        num_channels = 1;
-        subsampling = jpge2_simple::Y_ONLY;
+        *num_channels = 1;
+        comp_params.m_subsampling = jpge2_simple::Y_ONLY;
     }
 
     if(!quality) {
@@ -156,28 +209,36 @@ static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixform
     } else if(quality > 100) {
         quality = 100;
     }
-
-    jpge2_simple::params comp_params = jpge2_simple::params();
-    comp_params.m_subsampling = subsampling;
     comp_params.m_quality = quality;
+    return comp_params;
+}
 
-    // ⚠️ 关键：必须在堆上创建编码器！约8KB内存从堆分配
-    auto dst_image = std::make_unique<jpge2_simple::jpeg_encoder>();
+// 把第 first_line 行开始的 lines 行送进已经初始化好的编码器，并结束编码
+static bool encode_lines(jpge2_simple::jpeg_encoder *encoder, uint8_t *src, uint16_t width, pixformat_t format, int num_channels, int first_line, int lines)
+{
+    jpge2_simple::frame_format_t frame_format;
+    if (get_frame_format(format, &frame_format)) {
+        int stride = width * (format == PIXFORMAT_GRAYSCALE ? 1 : 2);
+        if (!encoder->process_frame(src + first_line * stride, stride, frame_format)) {
+            ESP_LOGE(TAG, "JPG process frame failed");
+            return false;
+        }
+        return true;
+    }
 
-    if (!dst_image->init(dst_stream, width, height, num_channels, comp_params)) {
-        ESP_LOGE(TAG, "JPG encoder init failed");
+    if (format != PIXFORMAT_RGB888) {
+        ESP_LOGE(TAG, "Unsupported pixel format %d", format);
         return false;
     }
-
     uint8_t* line = (uint8_t*)_malloc(width * num_channels);
     if(!line) {
         ESP_LOGE(TAG, "Scan line malloc failed");
         return false;
     }
 
-    for (int i = 0; i < height; i++) {
-        convert_line_format(src, format, line, width, num_channels, i);
-        if (!dst_image->process_scanline(line)) {
+    for (int i = first_line; i < first_line + lines; i++) {
+        convert_line_format(src, line, width, i);
+        if (!encoder->process_scanline(line)) {
             ESP_LOGE(TAG, "JPG process line %u failed", i);
             free(line);
             return false;
@@ -185,15 +246,261 @@ static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixform
     }
     free(line);
 
-    if (!dst_image->process_scanline(NULL)) {
+    if (!encoder->process_scanline(NULL)) {
         ESP_LOGE(TAG, "JPG image finish failed");
         return false;
     }
-    
-    // dst_image会在unique_ptr销毁时自动释放内存
     return true;
 }
 
+// 使用优化的JPEG编码器进行图像转换，必须在堆上创建编码器
+static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge2_simple::output_stream *dst_stream)
+{
+    int num_channels;
+    jpge2_simple::params comp_params = make_params(format, quality, &num_channels);
+
+    // ⚠️ 关键：必须在堆上创建编码器！约8KB内存从堆分配
+    auto dst_image = std::make_unique<jpge2_simple::jpeg_encoder>();
+
+    if (!dst_image->init(dst_stream, width, height, num_channels, comp_params)) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        return false;
+    }
+
+    // dst_image会在unique_ptr销毁时自动释放内存
+    return encode_lines(dst_image.get(), src, width, format, num_channels, 0, height);
+}
+
+/*
+ * 多核并行编码：图像按 MCU 行切成最多 JPEG_ENCODE_THREADS 个条带，每个条带正好是一个重启间隔。
+ * 重启间隔开始时 DC 预测清零、比特流按字节对齐，所以各条带可以独立编码，
+ * 按顺序拼接并在中间插入 RST0..RST7 后，就是一个带 DRI 的标准 baseline JPEG，
+ * 与单线程设置同样重启间隔编码出的结果逐字节相同。
+ * 第一个条带由当前线程直接写入输出流，其余条带在工作线程中编码到内存，最后依次拼接。
+ */
+static bool convert_image_parallel(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                                   jpge2_simple::output_stream *dst_stream, int stripe_mcu_rows)
+{
+    int num_channels;
+    jpge2_simple::params comp_params = make_params(format, quality, &num_channels);
+
+    int mcu_size = comp_params.m_subsampling == jpge2_simple::H2V2 ? 16 : 8;
+    int stripe_lines = stripe_mcu_rows * mcu_size;
+    int stripes = (height + stripe_lines - 1) / stripe_lines;
+    comp_params.m_restart_interval = (width + mcu_size - 1) / mcu_size * stripe_mcu_rows;
+
+    std::vector<std::unique_ptr<segment_stream>> segments(stripes);
+    std::vector<std::thread> workers;
+    std::unique_ptr<bool[]> results(new bool[stripes]());
+
+    auto thread_config = esp_pthread_get_default_config();
+    thread_config.thread_name = "jpeg_encoder";
+    thread_config.stack_size = JPEG_ENCODE_STACK_SIZE;
+    thread_config.prio = std::min((int)uxTaskPriorityGet(NULL), JPEG_ENCODE_WORKER_PRIORITY);
+    int core = xPortGetCoreID();
+    for (int i = 1; i < stripes; i++) {
+        segments[i] = std::make_unique<segment_stream>();
+        int first_line = i * stripe_lines;
+        int lines = std::min(stripe_lines, height - first_line);
+        thread_config.pin_to_core = (core + i) % portNUM_PROCESSORS;
+        esp_pthread_set_cfg(&thread_config);
+        workers.emplace_back([&, i, first_line, lines]() {
+            auto encoder = std::make_unique<jpge2_simple::jpeg_encoder>();
+            if (!encoder->init_segment(segments[i].get(), width, lines, num_channels, comp_params)) {
+                ESP_LOGE(TAG, "JPG segment %d init failed", i);
+                return;
+            }
+            results[i] = encode_lines(encoder.get(), src, width, format, num_channels, first_line, lines);
+        });
+    }
+    thread_config = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&thread_config);
+
+    auto encoder = std::make_unique<jpge2_simple::jpeg_encoder>();
+    if (encoder->init_headers(dst_stream, width, height, num_channels, comp_params) &&
+        encoder->init_segment(dst_stream, width, stripe_lines, num_channels, comp_params)) {
+        results[0] = encode_lines(encoder.get(), src, width, format, num_channels, 0, stripe_lines);
+    } else {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+    }
+    encoder.reset();
+
+    bool success = results[0];
+    for (int i = 1; i < stripes; i++) {
+        workers[i - 1].join();
+        success = success && results[i];
+        if (success) {
+            const uint8_t marker[2] = { 0xFF, static_cast<uint8_t>(0xD0 + ((i - 1) & 7)) };
+            success = dst_stream->put_buf(marker, sizeof(marker));
+            // 与直接编码时一样分块输出，回调每次收到的数据量不变
+            size_t size = segments[i]->get_size();
+            for (size_t offset = 0; success && offset < size; offset += JPEG_BACKEND_CHUNK_SIZE) {
+                success = dst_stream->put_buf(segments[i]->data() + offset, std::min<size_t>(JPEG_BACKEND_CHUNK_SIZE, size - offset));
+            }
+        }
+        segments[i].reset();
+    }
+    if (!success) {
+        return false;
+    }
+    const uint8_t eoi[2] = { 0xFF, 0xD9 };
+    return dst_stream->put_buf(eoi, sizeof(eoi)) && dst_stream->put_buf(NULL, 0);
+}
+
+// 返回每个条带的 MCU 行数，条带不足两个或者重启间隔超出 16 位时返回 0，只用单线程编码
+static int get_stripe_mcu_rows(uint16_t width, uint16_t height, pixformat_t format, int threads)
+{
+    int mcu_size = format == PIXFORMAT_GRAYSCALE ? 8 : 16;
+    int mcu_rows = (height + mcu_size - 1) / mcu_size;
+    int stripe_mcu_rows = (mcu_rows + threads - 1) / threads;
+    if (threads < 2 || mcu_rows < 2 || (width + mcu_size - 1) / mcu_size * stripe_mcu_rows > 0xFFFF) {
+        return 0;
+    }
+    return stripe_mcu_rows;
+}
+
+static bool convert_image_auto(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge2_simple::output_stream *dst_stream)
+{
+    int stripe_mcu_rows = get_stripe_mcu_rows(width, height, format, JPEG_ENCODE_THREADS);
+    if (stripe_mcu_rows > 0) {
+        return convert_image_parallel(src, width, height, format, quality, dst_stream, stripe_mcu_rows);
+    }
+    return convert_image(src, width, height, format, quality, dst_stream);
+}
+
+// 软件编码器后端，支持所有格式，总是最后一个
+class SoftwareJpegBackend : public JpegBackend {
+public:
+    const char* name() const override
+    {
+        return "software";
+    }
+
+    bool Supports(pixformat_t format, uint16_t width, uint16_t height) const override
+    {
+        jpge2_simple::frame_format_t frame_format;
+        return format == PIXFORMAT_RGB888 || get_frame_format(format, &frame_format);
+    }
+
+    bool Encode(const uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                jpge2_simple::output_stream *dst) override
+    {
+        return convert_image_auto(const_cast<uint8_t *>(src), width, height, format, quality, dst);
+    }
+};
+
+static std::vector<JpegBackend*> backends_override;
+
+const std::vector<JpegBackend*>& jpeg_get_backends()
+{
+    static SoftwareJpegBackend software_backend;
+    static const std::vector<JpegBackend*> default_backends = []() {
+        std::vector<JpegBackend*> backends;
+        if (auto hardware_backend = jpeg_get_hardware_backend()) {
+            backends.push_back(hardware_backend);
+        }
+        backends.push_back(&software_backend);
+        return backends;
+    }();
+    return backends_override.empty() ? default_backends : backends_override;
+}
+
+void jpeg_set_backends(const std::vector<JpegBackend*>& backends)
+{
+    backends_override = backends;
+}
+
+// 依次尝试支持这种输入的后端，已经输出了数据的失败不能再重试
+static bool encode_image(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge2_simple::output_stream *dst_stream)
+{
+    for (auto backend : jpeg_get_backends()) {
+        if (!backend->Supports(format, width, height)) {
+            continue;
+        }
+        if (backend->Encode(src, src_len, width, height, format, quality, dst_stream)) {
+            return true;
+        }
+        if (dst_stream->get_size() > 0) {
+            return false;
+        }
+        ESP_LOGW(TAG, "JPG %s encoder failed, trying the next one", backend->name());
+    }
+    ESP_LOGE(TAG, "No JPG encoder for format %d (%ux%u)", format, width, height);
+    return false;
+}
+
+// 只统计大小的输出流，用于测速
+class counting_stream : public jpge2_simple::output_stream {
+protected:
+    size_t index;
+
+public:
+    counting_stream() : index(0) { }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (pBuf) {
+            index += len;
+        }
+        return true;
+    }
+
+    virtual jpge2_simple::uint get_size() const
+    {
+        return static_cast<jpge2_simple::uint>(index);
+    }
+};
+
+std::vector<JpegBenchmarkResult> jpeg_benchmark(uint16_t width, uint16_t height, uint8_t quality, int frames)
+{
+    std::vector<JpegBenchmarkResult> results;
+    if (width > JPEG_BENCHMARK_MAX_WIDTH || height > JPEG_BENCHMARK_MAX_HEIGHT || frames > JPEG_BENCHMARK_MAX_FRAMES) {
+        ESP_LOGE(TAG, "Benchmark limited to %ux%u and %d frames", JPEG_BENCHMARK_MAX_WIDTH, JPEG_BENCHMARK_MAX_HEIGHT,
+            JPEG_BENCHMARK_MAX_FRAMES);
+        return results;
+    }
+    size_t frame_size = (size_t)width * height * 2;
+    uint8_t *frame = (uint8_t *)_malloc(frame_size);
+    if (!frame) {
+        ESP_LOGE(TAG, "Benchmark frame malloc failed");
+        return results;
+    }
+    // 渐变加上细节，接近界面截图的压缩难度
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint16_t pixel = ((x * 31 / width) << 11) | ((y * 63 / height) << 5) | (((x ^ y) >> 2) & 0x1F);
+            frame[(y * width + x) * 2] = pixel >> 8;
+            frame[(y * width + x) * 2 + 1] = pixel & 0xFF;
+        }
+    }
+
+    for (auto backend : jpeg_get_backends()) {
+        if (!backend->Supports(PIXFORMAT_RGB565, width, height)) {
+            continue;
+        }
+        size_t jpeg_size = 0;
+        int64_t start_time = esp_timer_get_time();
+        int encoded = 0;
+        for (; encoded < frames; encoded++) {
+            counting_stream stream;
+            if (!backend->Encode(frame, frame_size, width, height, PIXFORMAT_RGB565, quality, &stream)) {
+                break;
+            }
+            jpeg_size = stream.get_size();
+        }
+        int64_t elapsed = esp_timer_get_time() - start_time;
+        if (encoded == 0) {
+            ESP_LOGW(TAG, "JPG %s encoder failed in benchmark", backend->name());
+            continue;
+        }
+        float fps = encoded * 1000000.0f / (elapsed > 0 ? elapsed : 1);
+        ESP_LOGI(TAG, "JPG %s encoder: %ux%u q%u, %.1f fps, %u bytes", backend->name(), width, height, quality, fps, jpeg_size);
+        results.push_back({backend->name(), fps, jpeg_size});
+    }
+    free(frame);
+    return results;
+}
+
 // 🚀 主要函数：高效的图像到JPEG转换实现，节省8KB SRAM
 bool image_to_jpeg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
 {
@@ -209,7 +516,7 @@ bool image_to_jpeg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height
     }
     memory_stream dst_stream(jpg_buf, jpg_buf_len);
 
-    if(!convert_image(src, width, height, format, quality, &dst_stream)) {
+    if(!encode_image(src, src_len, width, height, format, quality, &dst_stream)) {
         free(jpg_buf);
         return false;
     }
@@ -223,6 +530,6 @@ bool image_to_jpeg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height
 bool image_to_jpeg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg)
 {
     callback_stream dst_stream(cb, arg);
-    return convert_image(src, width, height, format, quality, &dst_stream);
+    return encode_image(src, src_len, width, height, format, quality, &dst_stream);
 }
 
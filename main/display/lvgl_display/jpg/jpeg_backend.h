@@ -0,0 +1,53 @@
+// jpeg_backend.h - image_to_jpeg / image_to_jpeg_cb 使用的 JPEG 编码后端
+// 有硬件 JPEG 编码器的芯片（ESP32-P4）优先用硬件，其它情况和硬件不支持的输入使用软件编码器
+
+#ifndef JPEG_BACKEND_H
+#define JPEG_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_camera.h>
+
+#include <string>
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+// 硬件后端一次编码出整幅图像，再按这个大小分块写入输出流，与软件编码器的输出缓冲一致
+#define JPEG_BACKEND_CHUNK_SIZE 512
+
+class JpegBackend {
+public:
+    virtual ~JpegBackend() = default;
+
+    virtual const char* name() const = 0;
+    // 不支持的格式或尺寸由下一个后端编码
+    virtual bool Supports(pixformat_t format, uint16_t width, uint16_t height) const = 0;
+    // 把整幅图像编码写入 dst，最后调用 dst->put_buf(NULL, 0)。
+    // 失败时如果还没有向 dst 写入数据，会改用下一个后端编码
+    virtual bool Encode(const uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                        jpge2_simple::output_stream *dst) = 0;
+};
+
+struct JpegBenchmarkResult {
+    std::string backend;
+    float fps;
+    size_t jpeg_size;
+};
+
+// 按优先级排列的可用后端，软件编码器总在最后
+const std::vector<JpegBackend*>& jpeg_get_backends();
+// 替换后端列表，用于测试；传入空列表恢复默认。不能和编码同时调用
+void jpeg_set_backends(const std::vector<JpegBackend*>& backends);
+// 硬件 JPEG 编码器，芯片没有时返回 nullptr
+JpegBackend* jpeg_get_hardware_backend();
+
+// 基准测试的上限，覆盖常见的摄像头和屏幕分辨率，避免占用过多内存和 CPU 时间
+#define JPEG_BENCHMARK_MAX_WIDTH 800
+#define JPEG_BENCHMARK_MAX_HEIGHT 600
+#define JPEG_BENCHMARK_MAX_FRAMES 20
+
+// 用合成的 RGB565 图像让每个可用后端各编码 frames 帧，返回各自的帧率。超出上限时返回空列表
+std::vector<JpegBenchmarkResult> jpeg_benchmark(uint16_t width, uint16_t height, uint8_t quality, int frames);
+
+#endif // JPEG_BACKEND_H
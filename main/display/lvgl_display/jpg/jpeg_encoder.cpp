@@ -34,10 +34,12 @@ namespace jpge2_simple {
     static inline void jpge_free(void *p) { free(p); }
 
     // Various JPEG enums and tables.
-    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
+    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_RST0 = 0xD0, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_DRI = 0xDD, M_APP0 = 0xE0 };
     enum { DC_LUM_CODES = 12, AC_LUM_CODES = 256, DC_CHROMA_CODES = 12, AC_CHROMA_CODES = 256, MAX_HUFF_SYMBOLS = 257, MAX_HUFF_CODESIZE = 32 };
 
     static const uint8 s_zag[64] = { 0,1,8,16,9,2,3,10,17,24,32,25,18,11,4,5,12,19,26,33,40,48,41,34,27,20,13,6,7,14,21,28,35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
+    // Inverse of s_zag: zigzag position of each coefficient in natural order
+    static const uint8 s_zag_inv[64] = { 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,24,31,40,44,53,10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
     static const int16 s_std_lum_quant[64] = { 16,11,12,14,12,10,16,14,13,14,18,17,16,19,24,40,26,24,22,22,24,49,35,37,29,40,58,51,61,60,57,51,56,55,64,72,92,78,64,68,87,69,55,56,80,109,81,87,95,98,103,104,103,62,77,113,121,112,100,120,92,101,103,99 };
     static const int16 s_std_croma_quant[64] = { 17,18,18,24,21,24,47,26,26,47,99,66,56,66,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99 };
     static const uint8 s_dc_lum_bits[17] = { 0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
@@ -97,6 +99,46 @@ namespace jpge2_simple {
         }
     }
 
+    // Converts n pixels of a frame row to Y, Cb and Cr planes, pixels past count repeat the last one.
+    // RGB565 expands like the RGB888 path, so both give the same samples. YUYV is BT.601 video range and
+    // is scaled to the full range JFIF expects, the same result as going through RGB without its clipping.
+    static void frame_row_to_YCC(const uint8 *pSrc, frame_format_t format, int count, int n, uint8 *pY, uint8 *pCb, uint8 *pCr) {
+        if (format == FRAME_RGB565) {
+            for (int i = 0; i < count; i++, pSrc += 2) {
+                const int r = pSrc[0] & 0xF8, g = ((pSrc[0] & 0x07) << 5) | ((pSrc[1] & 0xE0) >> 3), b = (pSrc[1] & 0x1F) << 3;
+                pY[i] = static_cast<uint8>((r * YR + g * YG + b * YB + 32768) >> 16);
+                if (pCb) {
+                    pCb[i] = clamp(128 + ((r * CB_R + g * CB_G + b * CB_B + 32768) >> 16));
+                    pCr[i] = clamp(128 + ((r * CR_R + g * CR_G + b * CR_B + 32768) >> 16));
+                }
+            }
+        } else if (format == FRAME_YUYV) {
+            for (int i = 0; i < count; i += 2, pSrc += 4) {
+                pY[i] = clamp((298 * (pSrc[0] - 16) + 128) >> 8);
+                pY[i + 1] = clamp((298 * (pSrc[2] - 16) + 128) >> 8);
+                if (pCb) {
+                    pCb[i] = pCb[i + 1] = clamp(128 + ((291 * (pSrc[1] - 128) + 128) >> 8));
+                    pCr[i] = pCr[i + 1] = clamp(128 + ((291 * (pSrc[3] - 128) + 128) >> 8));
+                }
+            }
+        } else {
+            for (int i = 0; i < count; i++) {
+                pY[i] = pSrc[i];
+            }
+            if (pCb) {
+                memset(pCb, 128, n);
+                memset(pCr, 128, n);
+            }
+        }
+        for (int i = count; i < n; i++) {
+            pY[i] = pY[count - 1];
+            if (pCb) {
+                pCb[i] = pCb[count - 1];
+                pCr[i] = pCr[count - 1];
+            }
+        }
+    }
+
     // Forward DCT - DCT derived from jfdctint.
     enum { CONST_BITS = 13, ROW_BITS = 2 };
 #define DCT_DESCALE(x, n) (((x) + (((int32)1) << ((n) - 1))) >> (n))
@@ -117,19 +159,33 @@ namespace jpge2_simple {
     u3 += z5; u4 += z5; \
     s0 = t10 + t11; s1 = t7 + u1 + u4; s3 = t6 + u2 + u3; s4 = t10 - t11; s5 = t5 + u2 + u4; s7 = t4 + u1 + u3;
 
-    static void DCT2D(int32 *p) {
-        int32 c, *q = p;
-        for (c = 7; c >= 0; c--, q += 8) {
-            int32 s0 = q[0], s1 = q[1], s2 = q[2], s3 = q[3], s4 = q[4], s5 = q[5], s6 = q[6], s7 = q[7];
+    // Quantization by multiplying with a reciprocal: (n * ceil(2^20 / q)) >> 20 == n / q for every
+    // q <= 255 and n < 4096. The DCT output stays within +-1024, so n = |x| + q / 2 is always in range
+    // and the result matches the integer division bit for bit.
+    enum { QUANT_RECIP_BITS = 20 };
+#define DCT_QUANTIZE(x, i) { \
+        int32 v = (x), sign = v >> 31; \
+        int32 r = static_cast<int32>(((static_cast<uint32>((v ^ sign) - sign) + round[i]) * recip[i]) >> QUANT_RECIP_BITS); \
+        pDst[s_zag_inv[i]] = static_cast<int16>((r ^ sign) - sign); }
+
+    // Forward DCT fused with quantization. The samples stay 16 bit, the row pass results go to
+    // a 32 bit scratch block, and the column pass quantizes each result straight into its zigzag slot.
+    static void DCT2D_quantize(const int16 *pSrc, int16 *pDst, const uint32 *recip, const uint8 *round) {
+        int32 tmp[64];
+        int32 c, *q = tmp;
+        for (c = 7; c >= 0; c--, q += 8, pSrc += 8) {
+            int32 s0 = pSrc[0], s1 = pSrc[1], s2 = pSrc[2], s3 = pSrc[3], s4 = pSrc[4], s5 = pSrc[5], s6 = pSrc[6], s7 = pSrc[7];
             DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0] = s0 << ROW_BITS; q[1] = DCT_DESCALE(s1, CONST_BITS-ROW_BITS); q[2] = DCT_DESCALE(s2, CONST_BITS-ROW_BITS); q[3] = DCT_DESCALE(s3, CONST_BITS-ROW_BITS);
-            q[4] = s4 << ROW_BITS; q[5] = DCT_DESCALE(s5, CONST_BITS-ROW_BITS); q[6] = DCT_DESCALE(s6, CONST_BITS-ROW_BITS); q[7] = DCT_DESCALE(s7, CONST_BITS-ROW_BITS);
+            q[0] = s0 * (1 << ROW_BITS); q[1] = DCT_DESCALE(s1, CONST_BITS-ROW_BITS); q[2] = DCT_DESCALE(s2, CONST_BITS-ROW_BITS); q[3] = DCT_DESCALE(s3, CONST_BITS-ROW_BITS);
+            q[4] = s4 * (1 << ROW_BITS); q[5] = DCT_DESCALE(s5, CONST_BITS-ROW_BITS); q[6] = DCT_DESCALE(s6, CONST_BITS-ROW_BITS); q[7] = DCT_DESCALE(s7, CONST_BITS-ROW_BITS);
         }
-        for (q = p, c = 7; c >= 0; c--, q++) {
+        for (q = tmp, c = 0; c < 8; c++, q++) {
             int32 s0 = q[0*8], s1 = q[1*8], s2 = q[2*8], s3 = q[3*8], s4 = q[4*8], s5 = q[5*8], s6 = q[6*8], s7 = q[7*8];
             DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0*8] = DCT_DESCALE(s0, ROW_BITS+3); q[1*8] = DCT_DESCALE(s1, CONST_BITS+ROW_BITS+3); q[2*8] = DCT_DESCALE(s2, CONST_BITS+ROW_BITS+3); q[3*8] = DCT_DESCALE(s3, CONST_BITS+ROW_BITS+3);
-            q[4*8] = DCT_DESCALE(s4, ROW_BITS+3); q[5*8] = DCT_DESCALE(s5, CONST_BITS+ROW_BITS+3); q[6*8] = DCT_DESCALE(s6, CONST_BITS+ROW_BITS+3); q[7*8] = DCT_DESCALE(s7, CONST_BITS+ROW_BITS+3);
+            DCT_QUANTIZE(DCT_DESCALE(s0, ROW_BITS+3), c + 0*8); DCT_QUANTIZE(DCT_DESCALE(s1, CONST_BITS+ROW_BITS+3), c + 1*8);
+            DCT_QUANTIZE(DCT_DESCALE(s2, CONST_BITS+ROW_BITS+3), c + 2*8); DCT_QUANTIZE(DCT_DESCALE(s3, CONST_BITS+ROW_BITS+3), c + 3*8);
+            DCT_QUANTIZE(DCT_DESCALE(s4, ROW_BITS+3), c + 4*8); DCT_QUANTIZE(DCT_DESCALE(s5, CONST_BITS+ROW_BITS+3), c + 5*8);
+            DCT_QUANTIZE(DCT_DESCALE(s6, CONST_BITS+ROW_BITS+3), c + 6*8); DCT_QUANTIZE(DCT_DESCALE(s7, CONST_BITS+ROW_BITS+3), c + 7*8);
         }
     }
 
@@ -187,19 +243,51 @@ namespace jpge2_simple {
         }
     }
 
-    void jpeg_encoder::put_bits(uint bits, uint len)
+    // Stores 32 finished bits of entropy coded data, a 0xFF byte is followed by a stuffed 0
+    void jpeg_encoder::emit_bit_word(uint32 w)
     {
-        uint8 c = 0;
-        m_bit_buffer |= ((uint32)bits << (24 - (m_bits_in += len)));
-        while (m_bits_in >= 8) {
-            c = (uint8)((m_bit_buffer >> 16) & 0xFF);
+        // Fast path: no byte of the word is 0xFF and the buffer does not fill up
+        uint32 t = ~w;
+        if ((((t - 0x01010101u) & ~t & 0x80808080u) == 0) && (m_out_buf_left > 4)) {
+            m_pOut_buf[0] = static_cast<uint8>(w >> 24); m_pOut_buf[1] = static_cast<uint8>(w >> 16);
+            m_pOut_buf[2] = static_cast<uint8>(w >> 8);  m_pOut_buf[3] = static_cast<uint8>(w);
+            m_pOut_buf += 4;
+            m_out_buf_left -= 4;
+            return;
+        }
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            uint8 c = static_cast<uint8>(w >> shift);
             emit_byte(c);
             if (c == 0xFF) {
                 emit_byte(0);
             }
-            m_bit_buffer <<= 8;
+        }
+    }
+
+    // Appends len <= 32 bits, bits must not have any bit set above len. The accumulator keeps
+    // fewer than 32 pending bits in its low end, so only whole words are written out.
+    inline void jpeg_encoder::put_bits(uint bits, uint len)
+    {
+        m_bit_buffer = (m_bit_buffer << len) | bits;
+        m_bits_in += len;
+        if (m_bits_in >= 32) {
+            m_bits_in -= 32;
+            emit_bit_word(static_cast<uint32>(m_bit_buffer >> m_bits_in));
+        }
+    }
+
+    // Writes the whole bytes still pending, the remaining bits are padding
+    void jpeg_encoder::flush_bits()
+    {
+        while (m_bits_in >= 8) {
             m_bits_in -= 8;
+            uint8 c = static_cast<uint8>(m_bit_buffer >> m_bits_in);
+            emit_byte(c);
+            if (c == 0xFF) {
+                emit_byte(0);
+            }
         }
+        m_bits_in = 0;
     }
 
     void jpeg_encoder::emit_word(uint i)
@@ -308,6 +396,25 @@ namespace jpge2_simple {
         emit_byte(0);
     }
 
+    // Emit define restart interval
+    void jpeg_encoder::emit_dri()
+    {
+        emit_marker(M_DRI);
+        emit_word(4);
+        emit_word(m_params.m_restart_interval);
+    }
+
+    // Ends a restart interval: pad the last byte with 1 bits, emit RSTn and restart DC prediction
+    void jpeg_encoder::emit_restart()
+    {
+        put_bits(0x7F, 7);
+        flush_bits();
+        emit_marker(M_RST0 + (m_next_restart_num & 7));
+        m_next_restart_num++;
+        memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+        m_mcus_left_in_interval = m_params.m_restart_interval;
+    }
+
     void jpeg_encoder::load_block_8_8_grey(int x)
     {
         uint8 *pSrc;
@@ -368,34 +475,9 @@ namespace jpge2_simple {
         }
     }
 
-    void jpeg_encoder::load_quantized_coefficients(int component_num)
-    {
-        int32 *q = m_quantization_tables[component_num > 0];
-        int16 *pDst = m_coefficient_array;
-        for (int i = 0; i < 64; i++)
-        {
-            sample_array_t j = m_sample_array[s_zag[i]];
-            if (j < 0)
-            {
-                if ((j = -j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>(-(j / *q));
-            }
-            else
-            {
-                if ((j = j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>((j / *q));
-            }
-            q++;
-        }
-    }
-
     void jpeg_encoder::code_coefficients_pass_two(int component_num)
     {
-        int i, j, run_len, nbits, temp1, temp2;
+        int i, j, run_len, nbits, temp1, temp2, last;
         int16 *pSrc = m_coefficient_array;
         uint *codes[2];
         uint8 *code_sizes[2];
@@ -419,18 +501,16 @@ namespace jpge2_simple {
             temp1 = -temp1; temp2--;
         }
 
-        nbits = 0;
-        while (temp1)
-        {
-            nbits++; temp1 >>= 1;
-        }
+        // A Huffman code is at most 16 bits and a value at most 12, so both go out in one put_bits
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        put_bits((codes[0][nbits] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[0][nbits] + nbits);
 
-        put_bits(codes[0][nbits], code_sizes[0][nbits]);
-        if (nbits) put_bits(temp2 & ((1 << nbits) - 1), nbits);
+        // The trailing zeros are covered by the end of block code, they are not scanned
+        for (last = 63; (last > 0) && (pSrc[last] == 0); last--) { }
 
-        for (run_len = 0, i = 1; i < 64; i++)
+        for (run_len = 0, i = 1; i <= last; i++)
         {
-            if ((temp1 = m_coefficient_array[i]) == 0)
+            if ((temp1 = pSrc[i]) == 0)
                 run_len++;
             else
             {
@@ -444,32 +524,92 @@ namespace jpge2_simple {
                     temp1 = -temp1;
                     temp2--;
                 }
-                nbits = 1;
-                while (temp1 >>= 1)
-                    nbits++;
+                nbits = 32 - __builtin_clz(temp1);
                 j = (run_len << 4) + nbits;
-                put_bits(codes[1][j], code_sizes[1][j]);
-                put_bits(temp2 & ((1 << nbits) - 1), nbits);
+                put_bits((codes[1][j] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[1][j] + nbits);
                 run_len = 0;
             }
         }
-        if (run_len)
+        if (last < 63)
             put_bits(codes[1][0], code_sizes[1][0]);
     }
 
     void jpeg_encoder::code_block(int component_num)
     {
-        DCT2D(m_sample_array);
-        load_quantized_coefficients(component_num);
+        code_block(component_num, m_sample_array);
+    }
+
+    void jpeg_encoder::code_block(int component_num, const sample_array_t *pSamples)
+    {
+        int table = component_num > 0;
+        DCT2D_quantize(pSamples, m_coefficient_array, m_quantization_recip[table], m_quantization_round[table]);
         code_coefficients_pass_two(component_num);
     }
 
+    // Loads the MCU at (x, y) of a frame into m_mcu_samples. Pixels outside the image repeat the last
+    // column and row, and H2V2 chroma is averaged with the same alternating rounding as load_block_16_8.
+    void jpeg_encoder::load_frame_mcu(const uint8 *pFrame, int stride, frame_format_t format, int x, int y)
+    {
+        uint8 luma[16], cb[16], cr[16];
+        const int bytes_per_pixel = (format == FRAME_GRAYSCALE) ? 1 : 2;
+        const int count = JPGE_MIN(m_mcu_x, m_image_x - x);
+        pFrame += x * bytes_per_pixel;
+
+        if (m_num_components == 1)
+        {
+            for (int r = 0; r < 8; r++)
+            {
+                frame_row_to_YCC(pFrame + JPGE_MIN(y + r, m_image_y - 1) * stride, format, count, 8, luma, NULL, NULL);
+                sample_array_t *pDst = m_mcu_samples[0] + r * 8;
+                for (int c = 0; c < 8; c++)
+                    pDst[c] = luma[c] - 128;
+            }
+            return;
+        }
+
+        int cb_sum[64], cr_sum[64];
+        memset(cb_sum, 0, sizeof(cb_sum));
+        memset(cr_sum, 0, sizeof(cr_sum));
+        for (int r = 0; r < 16; r++)
+        {
+            frame_row_to_YCC(pFrame + JPGE_MIN(y + r, m_image_y - 1) * stride, format, count, 16, luma, cb, cr);
+            sample_array_t *pLeft = m_mcu_samples[(r >> 3) * 2] + (r & 7) * 8;
+            sample_array_t *pRight = m_mcu_samples[(r >> 3) * 2 + 1] + (r & 7) * 8;
+            int *pCb = cb_sum + (r >> 1) * 8, *pCr = cr_sum + (r >> 1) * 8;
+            for (int c = 0; c < 8; c++)
+            {
+                pLeft[c] = luma[c] - 128;
+                pRight[c] = luma[c + 8] - 128;
+                pCb[c] += cb[c * 2] + cb[c * 2 + 1];
+                pCr[c] += cr[c * 2] + cr[c * 2 + 1];
+            }
+        }
+        for (int i = 0; i < 64; i++)
+        {
+            const int bias = (((i >> 3) + i) & 1) ? 2 : 0;
+            m_mcu_samples[4][i] = ((cb_sum[i] + bias) >> 2) - 128;
+            m_mcu_samples[5][i] = ((cr_sum[i] + bias) >> 2) - 128;
+        }
+    }
+
+    // Called before every MCU, starts a new restart interval when the current one is full
+    inline void jpeg_encoder::begin_mcu()
+    {
+        if (m_params.m_restart_interval) {
+            if (m_mcus_left_in_interval == 0) {
+                emit_restart();
+            }
+            m_mcus_left_in_interval--;
+        }
+    }
+
     void jpeg_encoder::process_mcu_row()
     {
         if (m_num_components == 1)
         {
             for (int i = 0; i < m_mcus_per_row; i++)
             {
+                begin_mcu();
                 load_block_8_8_grey(i); code_block(0);
             }
         }
@@ -477,6 +617,7 @@ namespace jpge2_simple {
         {
             for (int i = 0; i < m_mcus_per_row; i++)
             {
+                begin_mcu();
                 load_block_8_8(i, 0, 0); code_block(0); load_block_8_8(i, 0, 1); code_block(1); load_block_8_8(i, 0, 2); code_block(2);
             }
         }
@@ -484,6 +625,7 @@ namespace jpge2_simple {
         {
             for (int i = 0; i < m_mcus_per_row; i++)
             {
+                begin_mcu();
                 load_block_8_8(i * 2 + 0, 0, 0); code_block(0); load_block_8_8(i * 2 + 1, 0, 0); code_block(0);
                 load_block_16_8_8(i, 1); code_block(1); load_block_16_8_8(i, 2); code_block(2);
             }
@@ -492,6 +634,7 @@ namespace jpge2_simple {
         {
             for (int i = 0; i < m_mcus_per_row; i++)
             {
+                begin_mcu();
                 load_block_8_8(i * 2 + 0, 0, 0); code_block(0); load_block_8_8(i * 2 + 1, 0, 0); code_block(0);
                 load_block_8_8(i * 2 + 0, 1, 0); code_block(0); load_block_8_8(i * 2 + 1, 1, 0); code_block(0);
                 load_block_16_8(i, 1); code_block(1); load_block_16_8(i, 2); code_block(2);
@@ -538,7 +681,7 @@ namespace jpge2_simple {
     }
 
     // Quantization table generation.
-    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    void jpeg_encoder::compute_quant_table(int table, const int16 *pSrc)
     {
         int32 q;
         if (m_params.m_quality < 50)
@@ -548,7 +691,11 @@ namespace jpge2_simple {
         for (int i = 0; i < 64; i++)
         {
             int32 j = *pSrc++; j = (j * q + 50L) / 100L;
-            *pDst++ = JPGE_MIN(JPGE_MAX(j, 1), 255);
+            j = JPGE_MIN(JPGE_MAX(j, 1), 255);
+            m_quantization_tables[table][i] = static_cast<uint8>(j);
+            // The quantizer works on coefficients in natural order
+            m_quantization_recip[table][s_zag[i]] = ((1u << QUANT_RECIP_BITS) + j - 1) / j;
+            m_quantization_round[table][s_zag[i]] = static_cast<uint8>(j >> 1);
         }
     }
 
@@ -599,16 +746,10 @@ namespace jpge2_simple {
         m_image_bpl_mcu  = m_image_x_mcu * m_num_components;
         m_mcus_per_row   = m_image_x_mcu / m_mcu_x;
 
-        if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
-            return false;
-        }
-        for (int i = 1; i < m_mcu_y; i++)
-            m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
-
         if(m_last_quality != m_params.m_quality){
             m_last_quality = m_params.m_quality;
-            compute_quant_table(m_quantization_tables[0], s_std_lum_quant);
-            compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
+            compute_quant_table(0, s_std_lum_quant);
+            compute_quant_table(1, s_std_croma_quant);
         }
 
         if(!m_huff_initialized){
@@ -632,6 +773,12 @@ namespace jpge2_simple {
         m_mcu_y_ofs = 0;
         m_pass_num = 2;
         memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+        m_mcus_left_in_interval = m_params.m_restart_interval;
+        m_next_restart_num = 0;
+
+        if (m_mode == MODE_SEGMENT) {
+            return true;
+        }
 
         // Emit all markers at beginning of image file.
         emit_marker(M_SOI);
@@ -639,8 +786,15 @@ namespace jpge2_simple {
         emit_dqt();
         emit_sof();
         emit_dhts();
+        if (m_params.m_restart_interval) {
+            emit_dri();
+        }
         emit_sos();
 
+        if (m_mode == MODE_HEADERS) {
+            flush_output_buffer();
+            m_pass_num = 3; // no scanlines follow
+        }
         return m_all_stream_writes_succeeded;
     }
 
@@ -656,9 +810,14 @@ namespace jpge2_simple {
         }
 
         put_bits(0x7F, 7);
-        emit_marker(M_EOI);
+        flush_bits();
+        if (m_mode == MODE_IMAGE) {
+            emit_marker(M_EOI);
+        }
         flush_output_buffer();
-        m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
+        if (m_mode == MODE_IMAGE) {
+            m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
+        }
         m_pass_num++; // purposely bump up m_pass_num, for debugging
         return true;
     }
@@ -667,6 +826,7 @@ namespace jpge2_simple {
     {
         m_mcu_lines[0] = NULL;
         m_pass_num = 0;
+        m_mode = MODE_IMAGE;
         m_all_stream_writes_succeeded = true;
         
         // 简单版本：成员变量自动初始化，不需要额外处理
@@ -684,7 +844,7 @@ namespace jpge2_simple {
         deinit();
     }
 
-    bool jpeg_encoder::init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    bool jpeg_encoder::start(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, mode_t mode)
     {
         deinit();
         if (((!pStream) || (width < 1) || (height < 1)) || ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) || (!comp_params.check())) return false;
@@ -692,9 +852,29 @@ namespace jpge2_simple {
         // 简单版本：不需要动态分配内存，成员变量已经存在
         m_pStream = pStream;
         m_params = comp_params;
+        m_mode = mode;
+        if (mode == MODE_SEGMENT) {
+            // 一段就是一个重启间隔，段内不再插入 RSTn
+            m_params.m_restart_interval = 0;
+        }
         return jpg_open(width, height, src_channels);
     }
 
+    bool jpeg_encoder::init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    {
+        return start(pStream, width, height, src_channels, comp_params, MODE_IMAGE);
+    }
+
+    bool jpeg_encoder::init_headers(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    {
+        return start(pStream, width, height, src_channels, comp_params, MODE_HEADERS);
+    }
+
+    bool jpeg_encoder::init_segment(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    {
+        return start(pStream, width, height, src_channels, comp_params, MODE_SEGMENT);
+    }
+
     void jpeg_encoder::deinit()
     {
         jpge_free(m_mcu_lines[0]);
@@ -713,10 +893,53 @@ namespace jpge2_simple {
                     return false;
                 }
             } else {
+                // MCU 行缓冲在第一条扫描线时才分配，process_frame 和只写标记时都用不到
+                if (!m_mcu_lines[0]) {
+                    if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
+                        return false;
+                    }
+                    for (int i = 1; i < m_mcu_y; i++)
+                        m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
+                }
                 load_mcu(pScanline);
             }
         }
         return m_all_stream_writes_succeeded;
     }
 
+    bool jpeg_encoder::process_frame(const void *pFrame, int stride, frame_format_t format)
+    {
+        if ((m_pass_num != 2) || m_mcu_y_ofs || !pFrame) {
+            return false;
+        }
+        if ((m_num_components == 3) && ((m_comp_h_samp[0] != 2) || (m_comp_v_samp[0] != 2))) {
+            return false;
+        }
+        // YUYV 的色度成对存放，奇数宽度时最后一个像素没有 V
+        if ((format == FRAME_YUYV) && (m_image_x & 1)) {
+            return false;
+        }
+
+        const uint8 *pSrc = static_cast<const uint8*>(pFrame);
+        for (int y = 0; (y < m_image_y) && m_all_stream_writes_succeeded; y += m_mcu_y)
+        {
+            for (int i = 0; i < m_mcus_per_row; i++)
+            {
+                begin_mcu();
+                load_frame_mcu(pSrc, stride, format, i * m_mcu_x, y);
+                if (m_num_components == 1) {
+                    code_block(0, m_mcu_samples[0]);
+                } else {
+                    code_block(0, m_mcu_samples[0]); code_block(0, m_mcu_samples[1]);
+                    code_block(0, m_mcu_samples[2]); code_block(0, m_mcu_samples[3]);
+                    code_block(1, m_mcu_samples[4]); code_block(2, m_mcu_samples[5]);
+                }
+            }
+        }
+        if (m_all_stream_writes_succeeded) {
+            process_end_of_image();
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
 } // namespace jpge2_simple
@@ -11,19 +11,26 @@ namespace jpge2_simple
     typedef signed int     int32;
     typedef unsigned short uint16;
     typedef unsigned int   uint32;
+    typedef unsigned long long uint64;
     typedef unsigned int   uint;
 
     enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 
+    // process_frame 直接读取的源格式：RGB565 为大端字节序，YUYV 为 Y0 U Y1 V（BT.601 视频范围）
+    enum frame_format_t { FRAME_GRAYSCALE = 0, FRAME_RGB565 = 1, FRAME_YUYV = 2 };
+
     struct params {
-        inline params() : m_quality(85), m_subsampling(H2V2) { }
+        inline params() : m_quality(85), m_subsampling(H2V2), m_restart_interval(0) { }
         inline bool check() const {
             if ((m_quality < 1) || (m_quality > 100)) return false;
             if ((uint)m_subsampling > (uint)H2V2) return false;
+            if ((m_restart_interval < 0) || (m_restart_interval > 0xFFFF)) return false;
             return true;
         }
         int m_quality;
         subsampling_t m_subsampling;
+        // 重启间隔（MCU 数），0 表示不写 DRI/RSTn
+        int m_restart_interval;
     };
     
     class output_stream {
@@ -44,15 +51,30 @@ namespace jpge2_simple
             bool process_scanline(const void* pScanline);
             void deinit();
 
+            // 并行编码用（见 image_to_jpeg.cpp）：init_headers 只写出整幅图像 SOS 之前的所有标记；
+            // init_segment 把若干 MCU 行编码成一个重启间隔的数据，前后都不写标记，DC 预测从 0 开始，最后一个字节补齐。
+            // 调用者在各段之间插入 RSTn，最后写 EOI 并调用 put_buf(NULL, 0) 结束输出流
+            bool init_headers(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
+            bool init_segment(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
+
+            // 代替逐行 process_scanline：按 MCU 直接从整帧读取像素并转换成 YCbCr，H2V2 的色度在读取时下采样，
+            // 不经过 RGB888 行缓冲和 MCU 行缓冲。pFrame 指向第一行，stride 为每行字节数，行数即 init 时的高度。
+            // 只支持 Y_ONLY 和 H2V2，编码结束后不需要再调用 process_scanline(NULL)
+            bool process_frame(const void *pFrame, int stride, frame_format_t format);
+
         private:
             jpeg_encoder(const jpeg_encoder &);
             jpeg_encoder &operator =(const jpeg_encoder &);
 
-            typedef int32 sample_array_t;
+            typedef int16 sample_array_t;
             enum { JPGE_OUT_BUF_SIZE = 512 };
+            enum mode_t { MODE_IMAGE = 0, MODE_HEADERS = 1, MODE_SEGMENT = 2 };
 
             output_stream *m_pStream;
             params m_params;
+            mode_t m_mode;
+            int m_mcus_left_in_interval;
+            uint8 m_next_restart_num;
             uint8 m_num_components;
             uint8 m_comp_h_samp[3], m_comp_v_samp[3];
             int m_image_x, m_image_y, m_image_bpp, m_image_bpl;
@@ -63,20 +85,23 @@ namespace jpge2_simple
             uint8 *m_mcu_lines[16];
             uint8 m_mcu_y_ofs;
             sample_array_t m_sample_array[64];
+            sample_array_t m_mcu_samples[6][64];     // process_frame 的一个 MCU：4 个 Y 块 + Cb + Cr
             int16 m_coefficient_array[64];
 
             int m_last_dc_val[3];
             uint8 m_out_buf[JPGE_OUT_BUF_SIZE];
             uint8 *m_pOut_buf;
             uint m_out_buf_left;
-            uint32 m_bit_buffer;
+            uint64 m_bit_buffer;
             uint m_bits_in;
             uint8 m_pass_num;
             bool m_all_stream_writes_succeeded;
 
             // 直接声明为类成员变量（约8KB）
             int32 m_last_quality;
-            int32 m_quantization_tables[2][64];      // 512 bytes
+            uint8 m_quantization_tables[2][64];      // 128 bytes, zigzag order
+            uint32 m_quantization_recip[2][64];      // 512 bytes, natural order
+            uint8 m_quantization_round[2][64];       // 128 bytes, natural order
             bool m_huff_initialized;
             uint m_huff_codes[4][256];               // 4096 bytes
             uint8 m_huff_code_sizes[4][256];         // 1024 bytes  
@@ -87,9 +112,12 @@ namespace jpge2_simple
             uint8 m_huff_size_temp[257];             // 257 bytes
             uint m_huff_code_temp[257];              // 1028 bytes
 
+            bool start(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, mode_t mode);
             bool jpg_open(int p_x_res, int p_y_res, int src_channels);
             void flush_output_buffer();
+            void emit_bit_word(uint32 w);
             void put_bits(uint bits, uint len);
+            void flush_bits();
             void emit_byte(uint8 i);
             void emit_word(uint i);
             void emit_marker(int marker);
@@ -99,14 +127,18 @@ namespace jpge2_simple
             void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
             void emit_dhts();
             void emit_sos();
-            void compute_quant_table(int32 *dst, const int16 *src);
-            void load_quantized_coefficients(int component_num);
+            void emit_dri();
+            void emit_restart();
+            void begin_mcu();
+            void compute_quant_table(int table, const int16 *src);
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
             void load_block_16_8(int x, int c);
             void load_block_16_8_8(int x, int c);
             void code_coefficients_pass_two(int component_num);
             void code_block(int component_num);
+            void code_block(int component_num, const sample_array_t *pSamples);
+            void load_frame_mcu(const uint8 *pFrame, int stride, frame_format_t format, int x, int y);
             void process_mcu_row();
             bool process_end_of_image();
             void load_mcu(const void* src);
@@ -0,0 +1,132 @@
+// jpeg_hw_backend.cpp - ESP32-P4 硬件 JPEG 编码器后端
+
+#include "jpeg_backend.h"
+
+#include <sdkconfig.h>
+
+#if CONFIG_SOC_JPEG_ENCODE_SUPPORTED
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <esp_log.h>
+#include <driver/jpeg_encode.h>
+
+#define TAG "JpegHwBackend"
+
+// 等待一帧编码完成的超时
+#define JPEG_HW_TIMEOUT_MS 1000
+
+class HardwareJpegBackend : public JpegBackend {
+public:
+    ~HardwareJpegBackend() {
+        if (engine_ != nullptr) {
+            jpeg_del_encoder_engine(engine_);
+        }
+    }
+
+    const char* name() const override {
+        return "hardware";
+    }
+
+    bool Supports(pixformat_t format, uint16_t width, uint16_t height) const override {
+        // 彩色图按 4:2:0 编码，硬件要求尺寸是 MCU 的整数倍
+        if (format == PIXFORMAT_RGB565) {
+            return (width % 16) == 0 && (height % 16) == 0;
+        }
+        if (format == PIXFORMAT_GRAYSCALE) {
+            return (width % 8) == 0 && (height % 8) == 0;
+        }
+        return false;
+    }
+
+    bool Encode(const uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                jpge2_simple::output_stream *dst) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (engine_ == nullptr) {
+            jpeg_encode_engine_cfg_t engine_config = {
+                .intr_priority = 0,
+                .timeout_ms = JPEG_HW_TIMEOUT_MS,
+            };
+            if (jpeg_new_encoder_engine(&engine_config, &engine_) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to create the JPEG encoder engine");
+                engine_ = nullptr;
+                return false;
+            }
+        }
+
+        size_t in_size = (size_t)width * height * (format == PIXFORMAT_GRAYSCALE ? 1 : 2);
+        if (src_len < in_size) {
+            ESP_LOGE(TAG, "Frame has %u bytes, expected %u", src_len, in_size);
+            return false;
+        }
+
+        // DMA 要求缓冲区按 cache 行对齐，帧先复制进来；RGB565 在复制时转回硬件读取的小端字节序
+        jpeg_encode_memory_alloc_cfg_t in_config = {
+            .buffer_direction = JPEG_ENC_ALLOC_INPUT_BUFFER,
+        };
+        jpeg_encode_memory_alloc_cfg_t out_config = {
+            .buffer_direction = JPEG_ENC_ALLOC_OUTPUT_BUFFER,
+        };
+        size_t in_allocated = 0, out_allocated = 0;
+        uint8_t *in_buf = (uint8_t *)jpeg_alloc_encoder_mem(in_size, &in_config, &in_allocated);
+        // 输出放不下时硬件报错，这时还没写出数据，会由软件编码器重新编码
+        uint8_t *out_buf = (uint8_t *)jpeg_alloc_encoder_mem(in_size, &out_config, &out_allocated);
+        if (in_buf == nullptr || out_buf == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes of JPEG DMA buffers", in_size * 2);
+            free(in_buf);
+            free(out_buf);
+            return false;
+        }
+        if (format == PIXFORMAT_RGB565) {
+            const uint16_t *pixels = (const uint16_t *)src;
+            uint16_t *out = (uint16_t *)in_buf;
+            for (size_t i = 0; i < in_size / 2; i++) {
+                out[i] = __builtin_bswap16(pixels[i]);
+            }
+        } else {
+            memcpy(in_buf, src, in_size);
+        }
+
+        jpeg_encode_cfg_t encode_config = {
+            .height = height,
+            .width = width,
+            .src_type = format == PIXFORMAT_GRAYSCALE ? JPEG_ENCODE_IN_FORMAT_GRAY : JPEG_ENCODE_IN_FORMAT_RGB565,
+            .sub_sample = format == PIXFORMAT_GRAYSCALE ? JPEG_DOWN_SAMPLING_GRAY : JPEG_DOWN_SAMPLING_YUV420,
+            .image_quality = quality,
+        };
+        uint32_t out_size = 0;
+        esp_err_t err = jpeg_encoder_process(engine_, &encode_config, in_buf, in_size, out_buf, out_allocated, &out_size);
+        free(in_buf);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Hardware JPEG encoding failed: %s", esp_err_to_name(err));
+            free(out_buf);
+            return false;
+        }
+
+        bool success = true;
+        for (uint32_t offset = 0; success && offset < out_size; offset += JPEG_BACKEND_CHUNK_SIZE) {
+            success = dst->put_buf(out_buf + offset, std::min<uint32_t>(JPEG_BACKEND_CHUNK_SIZE, out_size - offset));
+        }
+        free(out_buf);
+        return success && dst->put_buf(NULL, 0);
+    }
+
+private:
+    std::mutex mutex_;
+    jpeg_encoder_handle_t engine_ = nullptr;
+};
+
+JpegBackend* jpeg_get_hardware_backend() {
+    static HardwareJpegBackend backend;
+    return &backend;
+}
+
+#else
+
+JpegBackend* jpeg_get_hardware_backend() {
+    return nullptr;
+}
+
+#endif // CONFIG_SOC_JPEG_ENCODE_SUPPORTED
@@ -0,0 +1,322 @@
+#include "http_downloader.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_pthread.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#define TAG "HttpDownloader"
+
+HttpDownloader::HttpDownloader(std::function<std::unique_ptr<Http>()> create_http)
+    : create_http_(create_http) {
+}
+
+HttpDownloader::~HttpDownloader() {
+}
+
+void HttpDownloader::OnWrite(std::function<bool(size_t offset, const char* data, size_t size)> callback) {
+    on_write_ = callback;
+}
+
+void HttpDownloader::OnProgress(std::function<void(size_t written, size_t total, size_t speed)> callback) {
+    on_progress_ = callback;
+}
+
+void HttpDownloader::SetBuffers(size_t size, int count) {
+    buffer_size_ = size;
+    buffer_count_ = std::max(count, 2);
+}
+
+bool HttpDownloader::Download(const std::string& url, size_t max_size) {
+    auto http = create_http_();
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    if (http->GetStatusCode() != 200) {
+        ESP_LOGE(TAG, "Failed to get %s, status code: %d", url.c_str(), http->GetStatusCode());
+        return false;
+    }
+    content_length_ = http->GetBodyLength();
+    if (content_length_ == 0) {
+        ESP_LOGE(TAG, "Failed to get content length");
+        return false;
+    }
+    if (content_length_ > max_size) {
+        ESP_LOGE(TAG, "Content length (%u) is larger than %u", content_length_, max_size);
+        return false;
+    }
+    return Transfer(url, {{0, content_length_}}, std::move(http));
+}
+
+bool HttpDownloader::DownloadRanges(const std::string& url, const std::vector<HttpDownloadRange>& ranges) {
+    return Transfer(url, ranges, nullptr);
+}
+
+bool HttpDownloader::Fetch(const std::string& url, std::string& body, size_t max_size) {
+    auto http = create_http_();
+    if (!http->Open("GET", url)) {
+        return false;
+    }
+    if (http->GetStatusCode() != 200) {
+        http->Close();
+        return false;
+    }
+    size_t length = http->GetBodyLength();
+    if (length > max_size) {
+        ESP_LOGE(TAG, "Content length (%u) of %s is larger than %u", length, url.c_str(), max_size);
+        http->Close();
+        return false;
+    }
+
+    // Without a content length, stop as soon as the body grows past max_size
+    body.clear();
+    body.reserve(length);
+    char buffer[512];
+    while (true) {
+        int ret = http->Read(buffer, sizeof(buffer));
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read %s", url.c_str());
+            http->Close();
+            return false;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (body.size() + ret > max_size) {
+            ESP_LOGE(TAG, "Body of %s is larger than %u", url.c_str(), max_size);
+            http->Close();
+            return false;
+        }
+        body.append(buffer, ret);
+    }
+    http->Close();
+    return true;
+}
+
+std::unique_ptr<Http> HttpDownloader::OpenRange(const std::string& url, size_t offset, size_t end) {
+    auto http = create_http_();
+    http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-" + std::to_string(end - 1));
+    if (!http->Open("GET", url)) {
+        ESP_LOGW(TAG, "Failed to open HTTP connection for bytes %u-%u", offset, end - 1);
+        return nullptr;
+    }
+
+    int status_code = http->GetStatusCode();
+    if (status_code == 206) {
+        size_t length = http->GetBodyLength();
+        if (length != 0 && length != end - offset) {
+            ESP_LOGE(TAG, "Range response has %u bytes, expected %u", length, end - offset);
+            return nullptr;
+        }
+        return http;
+    }
+    if (status_code == 200) {
+        // The server ignored the range, skip to the offset in the full body
+        ESP_LOGW(TAG, "Range not supported, skipping %u bytes", offset);
+        char buffer[512];
+        size_t skipped = 0;
+        while (skipped < offset) {
+            int ret = http->Read(buffer, std::min(sizeof(buffer), offset - skipped));
+            if (ret <= 0) {
+                return nullptr;
+            }
+            skipped += ret;
+        }
+        return http;
+    }
+    ESP_LOGE(TAG, "Failed to get bytes %u-%u, status code: %d", offset, end - 1, status_code);
+    return nullptr;
+}
+
+bool HttpDownloader::Transfer(const std::string& url, const std::vector<HttpDownloadRange>& ranges, std::unique_ptr<Http> http) {
+    size_t total = 0;
+    for (auto& range : ranges) {
+        total += range.size;
+    }
+
+    std::vector<Buffer> buffers(buffer_count_);
+    free_buffers_.clear();
+    filled_buffers_.clear();
+    bool success = true;
+    for (auto& buffer : buffers) {
+#if CONFIG_SPIRAM
+        buffer.data = (char*)heap_caps_malloc(buffer_size_, MALLOC_CAP_SPIRAM);
+#else
+        buffer.data = (char*)heap_caps_malloc(buffer_size_, MALLOC_CAP_8BIT);
+#endif
+        if (buffer.data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for the download buffers", buffer_size_ * buffer_count_);
+            success = false;
+            break;
+        }
+        free_buffers_.push_back(&buffer);
+    }
+    if (!success) {
+        for (auto& buffer : buffers) {
+            heap_caps_free(buffer.data);
+        }
+        return false;
+    }
+    writer_stopped_ = false;
+    writer_failed_ = false;
+    written_ = 0;
+    statistics_ = HttpDownloadStatistics();
+    auto thread_config = esp_pthread_get_default_config();
+    thread_config.thread_name = "http_writer";
+    thread_config.stack_size = HTTP_DOWNLOADER_WRITER_STACK_SIZE;
+    esp_pthread_set_cfg(&thread_config);
+    std::thread writer_thread(&HttpDownloader::WriterThread, this);
+    thread_config = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&thread_config);
+
+    auto start_time = esp_timer_get_time();
+    auto last_progress_time = start_time;
+    size_t last_progress_bytes = 0;
+    size_t downloaded = 0;
+    int retries = 0;
+
+    for (auto& range : ranges) {
+        size_t position = range.offset;
+        size_t end = range.offset + range.size;
+        while (success && position < end) {
+            if (http == nullptr) {
+                if (retries > 0) {
+                    // Reconnect at once after a drop, back off when the connection keeps failing
+                    if (retries > 1) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(500 * (retries - 1)));
+                    }
+                    statistics_.reconnect_count++;
+                }
+                http = OpenRange(url, position, end);
+                if (http == nullptr) {
+                    success = ++retries <= HTTP_DOWNLOADER_MAX_RETRIES;
+                    continue;
+                }
+            }
+
+            Buffer* buffer;
+            {
+                auto wait_start = esp_timer_get_time();
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this]() { return !free_buffers_.empty() || writer_failed_; });
+                statistics_.writer_wait_ms += (esp_timer_get_time() - wait_start) / 1000;
+                if (writer_failed_) {
+                    success = false;
+                    break;
+                }
+                buffer = free_buffers_.front();
+                free_buffers_.pop_front();
+            }
+
+            // Fill the whole buffer, the writer works best with full sectors
+            buffer->offset = position;
+            buffer->size = 0;
+            size_t wanted = std::min(buffer_size_, end - position);
+            bool read_failed = false;
+            while (buffer->size < wanted) {
+                int ret = http->Read(buffer->data + buffer->size, wanted - buffer->size);
+                if (ret <= 0) {
+                    read_failed = true;
+                    break;
+                }
+                buffer->size += ret;
+            }
+            position += buffer->size;
+            downloaded += buffer->size;
+            if (buffer->size > 0) {
+                retries = 0;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (buffer->size > 0) {
+                    filled_buffers_.push_back(buffer);
+                } else {
+                    free_buffers_.push_back(buffer);
+                }
+            }
+            condition_.notify_all();
+
+            if (read_failed) {
+                ESP_LOGW(TAG, "Connection lost at %u, resuming", position);
+                http.reset();
+                success = ++retries <= HTTP_DOWNLOADER_MAX_RETRIES;
+            }
+
+            auto now = esp_timer_get_time();
+            if (now - last_progress_time >= 1000000) {
+                size_t written;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    written = written_;
+                }
+                size_t speed = (written - last_progress_bytes) * 1000000 / (now - last_progress_time);
+                if (on_progress_) {
+                    on_progress_(written, total, speed);
+                }
+                last_progress_time = now;
+                last_progress_bytes = written;
+            }
+        }
+        if (!success) {
+            break;
+        }
+        // Each range is a request of its own
+        http.reset();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        writer_stopped_ = true;
+    }
+    condition_.notify_all();
+    writer_thread.join();
+    success = success && !writer_failed_;
+    for (auto& buffer : buffers) {
+        heap_caps_free(buffer.data);
+    }
+
+    statistics_.bytes_received = downloaded;
+    statistics_.elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+    if (success && on_progress_) {
+        auto now = esp_timer_get_time();
+        on_progress_(written_, total, (written_ - last_progress_bytes) * 1000000 / std::max<int64_t>(now - last_progress_time, 1));
+    }
+    if (!success) {
+        ESP_LOGE(TAG, "Download failed after %u of %u bytes", downloaded, total);
+    }
+    return success;
+}
+
+void HttpDownloader::WriterThread() {
+    while (true) {
+        Buffer* buffer;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return !filled_buffers_.empty() || writer_stopped_; });
+            if (filled_buffers_.empty()) {
+                return;
+            }
+            buffer = filled_buffers_.front();
+            filled_buffers_.pop_front();
+            failed = writer_failed_;
+        }
+
+        // After a failure the remaining buffers are only returned
+        bool written = !failed && on_write_(buffer->offset, buffer->data, buffer->size);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (written) {
+                written_ += buffer->size;
+            } else {
+                writer_failed_ = true;
+            }
+            free_buffers_.push_back(buffer);
+        }
+        condition_.notify_all();
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef HTTP_DOWNLOADER_H
+#define HTTP_DOWNLOADER_H
+
+#include <http.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// Network reads fill one buffer while the writer thread stores the other
+#define HTTP_DOWNLOADER_BUFFER_SIZE 4096
+#define HTTP_DOWNLOADER_BUFFER_COUNT 2
+// The writer runs flash erases and writes, and the hashing done by the callers
+#define HTTP_DOWNLOADER_WRITER_STACK_SIZE 4096
+// Reconnects in a row without receiving anything before giving up
+#define HTTP_DOWNLOADER_MAX_RETRIES 5
+
+struct HttpDownloadRange {
+    size_t offset;
+    size_t size;
+};
+
+struct HttpDownloadStatistics {
+    size_t bytes_received = 0;
+    int reconnect_count = 0;
+    int64_t elapsed_ms = 0;
+    // Time the network side waited for a free buffer, i.e. for the writer
+    int64_t writer_wait_ms = 0;
+};
+
+/*
+ * Downloads a resource, or some byte ranges of it, into a writer callback.
+ *
+ * The writer runs on its own thread, so a flash erase or write overlaps the next network
+ * read instead of stalling it. After a read error or an early end of the body the request
+ * is reopened with a Range header from the first byte not received yet, the data already
+ * handed to the writer is kept.
+ */
+class HttpDownloader {
+public:
+    HttpDownloader(std::function<std::unique_ptr<Http>()> create_http);
+    ~HttpDownloader();
+
+    // Called with consecutive pieces of each range in increasing offset order, false aborts
+    void OnWrite(std::function<bool(size_t offset, const char* data, size_t size)> callback);
+    // Progress counts the bytes the writer has stored, so speed is the end to end throughput
+    void OnProgress(std::function<void(size_t written, size_t total, size_t speed)> callback);
+    // Larger buffers let the network run ahead of slow writes, they are taken from PSRAM when there is one
+    void SetBuffers(size_t size, int count);
+
+    // Downloads the whole resource, which may not be larger than max_size
+    bool Download(const std::string& url, size_t max_size);
+    // Downloads only the given ranges, which must be sorted and not overlap
+    bool DownloadRanges(const std::string& url, const std::vector<HttpDownloadRange>& ranges);
+    // Reads a small resource into memory, false if it is missing or larger than max_size
+    bool Fetch(const std::string& url, std::string& body, size_t max_size);
+
+    inline size_t content_length() const { return content_length_; }
+    inline const HttpDownloadStatistics& statistics() const { return statistics_; }
+
+private:
+    struct Buffer {
+        char* data = nullptr;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    std::function<std::unique_ptr<Http>()> create_http_;
+    std::function<bool(size_t offset, const char* data, size_t size)> on_write_;
+    std::function<void(size_t written, size_t total, size_t speed)> on_progress_;
+    size_t buffer_size_ = HTTP_DOWNLOADER_BUFFER_SIZE;
+    int buffer_count_ = HTTP_DOWNLOADER_BUFFER_COUNT;
+    size_t content_length_ = 0;
+    HttpDownloadStatistics statistics_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Buffer*> free_buffers_;
+    std::deque<Buffer*> filled_buffers_;
+    bool writer_stopped_ = false;
+    bool writer_failed_ = false;
+    size_t written_ = 0;
+
+    std::unique_ptr<Http> OpenRange(const std::string& url, size_t offset, size_t end);
+    bool Transfer(const std::string& url, const std::vector<HttpDownloadRange>& ranges, std::unique_ptr<Http> http);
+    void WriterThread();
+};
+
+#endif // HTTP_DOWNLOADER_H
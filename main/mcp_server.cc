@@ -17,17 +17,35 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#include "jpeg_backend.h"
 
 #define TAG "MCP"
 
+thread_local McpServer::ToolCall* McpServer::current_tool_call_ = nullptr;
+
 McpServer::McpServer() {
+    esp_timer_create_args_t tool_timeout_timer_args = {
+        .callback = [](void* arg) {
+            ((McpServer*)arg)->CheckToolCallTimeouts();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp_tool_timeout",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&tool_timeout_timer_args, &tool_timeout_timer_);
 }
 
 McpServer::~McpServer() {
+    if (tool_timeout_timer_ != nullptr) {
+        esp_timer_stop(tool_timeout_timer_);
+        esp_timer_delete(tool_timeout_timer_);
+    }
     for (auto tool : tools_) {
         delete tool;
     }
     tools_.clear();
+    tool_index_.clear();
 }
 
 void McpServer::AddCommonTools() {
@@ -99,7 +117,8 @@ void McpServer::AddCommonTools() {
 
     auto camera = board.GetCamera();
     if (camera) {
-        AddTool("self.camera.take_photo",
+        // The upload takes seconds, so it runs on a worker to keep the main loop free
+        auto take_photo = new McpTool("self.camera.take_photo",
             "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
             "Args:\n"
             "  `question`: The question that you want to ask about the photo.\n"
@@ -115,14 +134,22 @@ void McpServer::AddCommonTools() {
                 if (!camera->Capture()) {
                     throw std::runtime_error("Failed to capture photo");
                 }
+                if (McpServer::IsToolCallCancelled()) {
+                    throw std::runtime_error("Cancelled");
+                }
+                McpServer::ReportToolProgress(1, 2, "Photo captured");
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
             });
+        take_photo->set_async(true);
+        take_photo->set_timeout_ms(30000);
+        AddTool(take_photo);
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    InvalidateToolsList();
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -189,9 +216,10 @@ void McpServer::AddUserOnlyTools() {
             });
 
 #if CONFIG_LV_USE_SNAPSHOT
-        AddUserOnlyTool("self.screen.snapshot", "Snapshot the screen and upload it to a specific URL",
+        AddUserOnlyTool("self.screen.snapshot", "Snapshot the screen and upload it to a specific URL, "
+            "or return it as image content if no URL is given",
             PropertyList({
-                Property("url", kPropertyTypeString),
+                Property("url", kPropertyTypeString, std::string("")),
                 Property("quality", kPropertyTypeInteger, 80, 1, 100)
             }),
             [display](const PropertyList& properties) -> ReturnValue {
@@ -203,6 +231,11 @@ void McpServer::AddUserOnlyTools() {
                     throw std::runtime_error("Failed to snapshot screen");
                 }
 
+                if (url.empty()) {
+                    // The JPEG is moved, not copied, and sent as base64 chunk by chunk
+                    return new ImageContent("image/jpeg", std::move(jpeg_data));
+                }
+
                 ESP_LOGI(TAG, "Upload snapshot %u bytes to %s", jpeg_data.size(), url.c_str());
                 
                 // 构造multipart/form-data请求体
@@ -286,6 +319,35 @@ void McpServer::AddUserOnlyTools() {
     }
 #endif // HAVE_LVGL
 
+#if CONFIG_USE_JPEG_BENCHMARK_TOOL
+    // JPEG encoder benchmark, one result per backend
+    auto jpeg_benchmark_tool = new McpTool("self.jpeg.benchmark",
+        "Encode a synthetic RGB565 image with every available JPEG encoder and report the frames per second of each",
+        PropertyList({
+            Property("width", kPropertyTypeInteger, 320, 16, JPEG_BENCHMARK_MAX_WIDTH),
+            Property("height", kPropertyTypeInteger, 240, 16, JPEG_BENCHMARK_MAX_HEIGHT),
+            Property("quality", kPropertyTypeInteger, 80, 1, 100),
+            Property("frames", kPropertyTypeInteger, 10, 1, JPEG_BENCHMARK_MAX_FRAMES)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto results = jpeg_benchmark(properties["width"].value<int>(), properties["height"].value<int>(),
+                properties["quality"].value<int>(), properties["frames"].value<int>());
+            cJSON *json = cJSON_CreateArray();
+            for (auto& result : results) {
+                cJSON *item = cJSON_CreateObject();
+                cJSON_AddStringToObject(item, "backend", result.backend.c_str());
+                cJSON_AddNumberToObject(item, "fps", result.fps);
+                cJSON_AddNumberToObject(item, "jpeg_size", result.jpeg_size);
+                cJSON_AddItemToArray(json, item);
+            }
+            return json;
+        });
+    jpeg_benchmark_tool->set_user_only(true);
+    jpeg_benchmark_tool->set_async(true);
+    jpeg_benchmark_tool->set_timeout_ms(60000);
+    AddTool(jpeg_benchmark_tool);
+#endif // CONFIG_USE_JPEG_BENCHMARK_TOOL
+
     // Assets download url
     auto& assets = Assets::GetInstance();
     if (assets.partition_valid()) {
@@ -304,13 +366,23 @@ void McpServer::AddUserOnlyTools() {
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.find(tool->name()) != tool_index_.end()) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
     tools_.push_back(tool);
+    // The key points into the tool, which is never moved or deleted before the server
+    tool_index_.emplace(tool->name(), tool);
+    InvalidateToolsList();
+}
+
+void McpServer::InvalidateToolsList() {
+    tool_descriptors_.clear();
+    for (auto& pages : tools_list_pages_) {
+        pages = ToolsListPages();
+    }
 }
 
 void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
@@ -323,10 +395,10 @@ void McpServer::AddUserOnlyTool(const std::string& name, const std::string& desc
     AddTool(tool);
 }
 
-void McpServer::ParseMessage(const std::string& message) {
-    cJSON* json = cJSON_Parse(message.c_str());
+void McpServer::ParseMessage(std::string_view message) {
+    cJSON* json = cJSON_ParseWithLength(message.data(), message.size());
     if (json == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
+        ESP_LOGE(TAG, "Failed to parse MCP message: %.*s", (int)message.size(), message.data());
         return;
     }
     ParseMessage(json);
@@ -369,6 +441,13 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolCall(request_id->valueint);
+            }
+        }
         return;
     }
     
@@ -430,7 +509,15 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid arguments");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments);
+        std::string progress_token;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto token = cJSON_GetObjectItem(meta, "progressToken");
+        if (cJSON_IsString(token) || cJSON_IsNumber(token)) {
+            char* token_str = cJSON_PrintUnformatted(token);
+            progress_token = token_str;
+            cJSON_free(token_str);
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, progress_token);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
@@ -445,6 +532,23 @@ void McpServer::ReplyResult(int id, const std::string& result) {
     Application::GetInstance().SendMcpMessage(payload);
 }
 
+void McpServer::ReplyToolResult(int id, ReturnValue& return_value) {
+    if (!std::holds_alternative<ImageContent*>(return_value)) {
+        ReplyResult(id, McpTool::ResultToJson(return_value));
+        return;
+    }
+
+    // Stream the image so its base64 text is never held in full
+    std::shared_ptr<ImageContent> image(std::get<ImageContent*>(return_value));
+    return_value = false;
+    std::string head = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(id) + ",\"result\":{\"content\":[";
+    static const char tail[] = "],\"isError\":false}}";
+    size_t size_hint = head.size() + image->encoded_size() + 64 + sizeof(tail);
+    Application::GetInstance().SendMcpMessage([image, head](const TextWriter& write) {
+        return write(head.data(), head.size()) && image->Write(write) && write(tail, sizeof(tail) - 1);
+    }, size_hint);
+}
+
 void McpServer::ReplyError(int id, const std::string& message) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id);
@@ -454,75 +558,114 @@ void McpServer::ReplyError(int id, const std::string& message) {
     Application::GetInstance().SendMcpMessage(payload);
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
+const McpServer::ToolsListPages& McpServer::GetToolsListPages(bool list_user_only_tools) {
+    if (tool_descriptors_.size() != tools_.size()) {
+        tool_descriptors_.clear();
+        tool_descriptors_.reserve(tools_.size());
+        for (auto tool : tools_) {
+            tool_descriptors_.push_back(tool->to_json());
         }
+    }
 
-        if (!list_user_only_tools && (*it)->user_only()) {
-            ++it;
+    auto& result = tools_list_pages_[list_user_only_tools ? 1 : 0];
+    if (result.valid) {
+        return result;
+    }
+    result.valid = true;
+
+    // Same packing as the reply: {"tools":[a,b,...],"nextCursor":"..."}, 30 bytes kept for the tail
+    const size_t head_size = strlen("{\"tools\":[");
+    size_t page_size = head_size;
+    ToolsListPage page = {0, 0};
+    for (size_t i = 0; i < tools_.size(); i++) {
+        if (!list_user_only_tools && tools_[i]->user_only()) {
             continue;
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
+        size_t tool_size = tool_descriptors_[i].size() + 1;
+        if (page_size > head_size && page_size + tool_size + 30 > MCP_TOOLS_LIST_MAX_PAYLOAD_SIZE) {
+            // The next page starts at this tool
+            result.pages.push_back(page);
+            result.cursors.emplace(tools_[i]->name(), result.pages.size());
+            page = {i, i};
+            page_size = head_size;
+        }
+        if (head_size + tool_size + 30 > MCP_TOOLS_LIST_MAX_PAYLOAD_SIZE) {
+            // Its cursor, if any, points past the last page
+            result.oversized_tool = tools_[i]->name();
             break;
         }
-        
-        json += tool_json;
-        ++it;
+        page_size += tool_size;
+        page.end = i + 1;
     }
-    
-    if (json.back() == ',') {
-        json.pop_back();
+    if (page_size > head_size || (result.pages.empty() && result.oversized_tool.empty())) {
+        result.pages.push_back(page);
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+    return result;
+}
+
+void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
+    auto& result = GetToolsListPages(list_user_only_tools);
+
+    size_t page_index = 0;
+    if (!cursor.empty()) {
+        auto it = result.cursors.find(cursor);
+        if (it == result.cursors.end()) {
+            ESP_LOGE(TAG, "tools/list: Invalid cursor %s", cursor.c_str());
+            ReplyError(id, "Invalid cursor");
+            return;
+        }
+        page_index = it->second;
+    }
+
+    if (page_index >= result.pages.size()) {
+        ESP_LOGE(TAG, "tools/list: Failed to add tool %.*s because of payload size limit",
+            (int)result.oversized_tool.size(), result.oversized_tool.data());
+        ReplyError(id, "Failed to add tool " + std::string(result.oversized_tool) + " because of payload size limit");
         return;
     }
 
+    auto& page = result.pages[page_index];
+    std::string json;
+    json.reserve(MCP_TOOLS_LIST_MAX_PAYLOAD_SIZE);
+    json = "{\"tools\":[";
+    for (size_t i = page.begin; i < page.end; i++) {
+        if (!list_user_only_tools && tools_[i]->user_only()) {
+            continue;
+        }
+        json += tool_descriptors_[i];
+        json += ',';
+    }
+    if (json.back() == ',') {
+        json.pop_back();
+    }
+
+    std::string_view next_cursor;
+    if (page_index + 1 < result.pages.size()) {
+        next_cursor = tools_[result.pages[page_index + 1].begin]->name();
+    } else {
+        next_cursor = result.oversized_tool;
+    }
     if (next_cursor.empty()) {
         json += "]}";
     } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+        json += "],\"nextCursor\":\"";
+        json += next_cursor;
+        json += "\"}";
     }
-    
+
     ReplyResult(id, json);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const std::string& progress_token) {
+    auto tool_iter = tool_index_.find(tool_name);
+    if (tool_iter == tool_index_.end()) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    McpTool* tool = tool_iter->second;
+    PropertyList arguments = tool->properties();
     try {
         for (auto& argument : arguments) {
             bool found = false;
@@ -552,14 +695,156 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
         return;
     }
 
+    if (tool->async()) {
+        auto call = std::make_shared<ToolCall>();
+        call->id = id;
+        call->tool = tool;
+        call->arguments = std::move(arguments);
+        call->progress_token = progress_token;
+        call->deadline_us = esp_timer_get_time() + (int64_t)tool->timeout_ms() * 1000;
+        if (!QueueToolCall(call)) {
+            ESP_LOGE(TAG, "tools/call: Too many tool calls, %s rejected", tool_name.c_str());
+            ReplyError(id, "Too many tool calls in progress");
+        }
+        return;
+    }
+
     // Use main thread to call the tool
     auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
+    app.Schedule([this, id, tool, arguments = std::move(arguments)]() {
+        auto start_time = esp_timer_get_time();
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            ReturnValue return_value = tool->Invoke(arguments);
+            ReplyToolResult(id, return_value);
         } catch (const std::exception& e) {
             ESP_LOGE(TAG, "tools/call: %s", e.what());
             ReplyError(id, e.what());
         }
+        // A sync tool cannot be interrupted, it should be made async if this shows up
+        int elapsed_ms = (esp_timer_get_time() - start_time) / 1000;
+        if (elapsed_ms > tool->timeout_ms()) {
+            ESP_LOGW(TAG, "tools/call: %s blocked the main loop for %d ms", tool->name().c_str(), elapsed_ms);
+        }
     });
 }
+
+bool McpServer::QueueToolCall(std::shared_ptr<ToolCall> call) {
+    std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+    if (queued_tool_calls_.size() >= MCP_TOOL_MAX_QUEUED_CALLS) {
+        return false;
+    }
+    queued_tool_calls_.push_back(call);
+    active_tool_calls_[call->id] = call;
+    if (!esp_timer_is_active(tool_timeout_timer_)) {
+        esp_timer_start_periodic(tool_timeout_timer_, 100 * 1000);
+    }
+
+    // Workers are started on demand and exit when the queue is empty
+    if (tool_worker_count_ < MCP_TOOL_MAX_WORKERS) {
+        auto ret = xTaskCreate([](void* arg) {
+            ((McpServer*)arg)->ToolWorkerTask();
+            vTaskDelete(NULL);
+        }, "mcp_tool", MCP_TOOL_WORKER_STACK_SIZE, this, 2, NULL);
+        if (ret == pdPASS) {
+            tool_worker_count_++;
+        } else if (tool_worker_count_ == 0) {
+            queued_tool_calls_.pop_back();
+            active_tool_calls_.erase(call->id);
+            return false;
+        }
+    }
+    return true;
+}
+
+void McpServer::ToolWorkerTask() {
+    while (true) {
+        std::shared_ptr<ToolCall> call;
+        {
+            std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+            if (queued_tool_calls_.empty()) {
+                tool_worker_count_--;
+                return;
+            }
+            call = queued_tool_calls_.front();
+            queued_tool_calls_.pop_front();
+        }
+
+        // Cancelled or timed out while queued
+        if (!call->finished) {
+            current_tool_call_ = call.get();
+            try {
+                ReturnValue return_value = call->tool->Invoke(call->arguments);
+                if (!call->finished.exchange(true)) {
+                    ReplyToolResult(call->id, return_value);
+                } else {
+                    McpTool::FreeResult(return_value);
+                }
+            } catch (const std::exception& e) {
+                ESP_LOGE(TAG, "tools/call: %s", e.what());
+                if (!call->finished.exchange(true)) {
+                    ReplyError(call->id, e.what());
+                }
+            }
+            current_tool_call_ = nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+        auto it = active_tool_calls_.find(call->id);
+        if (it != active_tool_calls_.end() && it->second == call) {
+            active_tool_calls_.erase(it);
+        }
+        if (active_tool_calls_.empty()) {
+            esp_timer_stop(tool_timeout_timer_);
+        }
+    }
+}
+
+void McpServer::CheckToolCallTimeouts() {
+    auto now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+    for (auto& [id, call] : active_tool_calls_) {
+        if (now >= call->deadline_us && !call->finished.exchange(true)) {
+            // The tool keeps running until it returns, its result is dropped
+            call->cancelled = true;
+            ESP_LOGW(TAG, "tools/call: %s timed out after %d ms", call->tool->name().c_str(), call->tool->timeout_ms());
+            ReplyError(id, "Tool call timed out");
+        }
+    }
+}
+
+void McpServer::CancelToolCall(int id) {
+    std::lock_guard<std::mutex> lock(tool_calls_mutex_);
+    auto it = active_tool_calls_.find(id);
+    if (it == active_tool_calls_.end()) {
+        return;
+    }
+    // No response is sent for a cancelled request
+    ESP_LOGI(TAG, "tools/call: %s cancelled", it->second->tool->name().c_str());
+    it->second->cancelled = true;
+    it->second->finished = true;
+}
+
+bool McpServer::IsToolCallCancelled() {
+    return current_tool_call_ != nullptr && current_tool_call_->cancelled;
+}
+
+void McpServer::ReportToolProgress(int progress, int total, const std::string& message) {
+    auto call = current_tool_call_;
+    if (call == nullptr || call->progress_token.empty() || call->finished) {
+        return;
+    }
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\",\"params\":{\"progressToken\":";
+    payload += call->progress_token;
+    payload += ",\"progress\":" + std::to_string(progress);
+    payload += ",\"total\":" + std::to_string(total);
+    if (!message.empty()) {
+        cJSON* json_message = cJSON_CreateString(message.c_str());
+        char* message_str = cJSON_PrintUnformatted(json_message);
+        payload += ",\"message\":";
+        payload += message_str;
+        cJSON_free(message_str);
+        cJSON_Delete(json_message);
+    }
+    payload += "}}";
+    Application::GetInstance().SendMcpMessage(payload);
+}
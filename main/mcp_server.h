@@ -2,46 +2,76 @@
 #define MCP_SERVER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <algorithm>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <esp_timer.h>
 #include <mbedtls/base64.h>
 
 #include <cJSON.h>
 
+// Largest tools/list result, the tools are split into pages by this size
+#define MCP_TOOLS_LIST_MAX_PAYLOAD_SIZE 8000
+
+// Async tools run on at most this many worker tasks, further calls wait in a bounded queue
+#define MCP_TOOL_MAX_WORKERS 2
+#define MCP_TOOL_MAX_QUEUED_CALLS 4
+#define MCP_TOOL_WORKER_STACK_SIZE 8192
+#define MCP_TOOL_DEFAULT_TIMEOUT_MS 10000
+
+// Base64 text written per piece when an image result is streamed, a multiple of 4
+#define MCP_IMAGE_BASE64_CHUNK_SIZE 1024
+
 class ImageContent {
 private:
-    std::string encoded_data_;
+    // Kept as raw bytes, the base64 text only exists one chunk at a time while it is sent
+    std::string data_;
     std::string mime_type_;
 
-    static std::string Base64Encode(const std::string& data) {
-        size_t dlen = 0, olen = 0;
-        mbedtls_base64_encode((unsigned char*)nullptr, 0, &dlen, (const unsigned char*)data.data(), data.size());
-        std::string result(dlen, 0);
-        mbedtls_base64_encode((unsigned char*)result.data(), result.size(), &olen, (const unsigned char*)data.data(), data.size());
-        return result;
-    }
-
 public:
-    ImageContent(const std::string& mime_type, const std::string& data) {
-        mime_type_ = mime_type;
-        // base64 encode data
-        encoded_data_ = Base64Encode(data);
+    ImageContent(const std::string& mime_type, std::string data)
+        : data_(std::move(data)), mime_type_(mime_type) {}
+
+    inline size_t encoded_size() const { return (data_.size() + 2) / 3 * 4; }
+
+    // Writes {"type":"image","mimeType":"...","data":"..."} in pieces of bounded size
+    bool Write(const std::function<bool(const char* data, size_t size)>& write) const {
+        std::string head = "{\"type\":\"image\",\"mimeType\":\"" + mime_type_ + "\",\"data\":\"";
+        if (!write(head.data(), head.size())) {
+            return false;
+        }
+        // One more byte for the terminator mbedtls appends
+        unsigned char chunk[MCP_IMAGE_BASE64_CHUNK_SIZE + 1];
+        const size_t input_size = MCP_IMAGE_BASE64_CHUNK_SIZE / 4 * 3;
+        for (size_t offset = 0; offset < data_.size(); offset += input_size) {
+            size_t olen = 0;
+            size_t size = std::min(input_size, data_.size() - offset);
+            mbedtls_base64_encode(chunk, sizeof(chunk), &olen, (const unsigned char*)data_.data() + offset, size);
+            if (!write((const char*)chunk, olen)) {
+                return false;
+            }
+        }
+        return write("\"}", 2);
     }
 
     std::string to_json() const {
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "type", "image");
-        cJSON_AddStringToObject(json, "mimeType", mime_type_.c_str());
-        cJSON_AddStringToObject(json, "data", encoded_data_.c_str());
-        char* json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
+        std::string result;
+        result.reserve(encoded_size() + mime_type_.size() + 48);
+        Write([&result](const char* data, size_t size) {
+            result.append(data, size);
+            return true;
+        });
         return result;
     }
 };
@@ -212,6 +242,8 @@ private:
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    bool async_ = false;
+    int timeout_ms_ = MCP_TOOL_DEFAULT_TIMEOUT_MS;
 
 public:
     McpTool(const std::string& name, 
@@ -224,10 +256,15 @@ public:
         callback_(callback) {}
 
     void set_user_only(bool user_only) { user_only_ = user_only; }
+    // Async tools run on a worker task instead of the main event loop, use it for slow tools
+    void set_async(bool async) { async_ = async; }
+    void set_timeout_ms(int timeout_ms) { timeout_ms_ = timeout_ms; }
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
     inline bool user_only() const { return user_only_; }
+    inline bool async() const { return async_; }
+    inline int timeout_ms() const { return timeout_ms_; }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -269,39 +306,45 @@ public:
         return result;
     }
 
+    // The result is owned by the caller, see ResultToJson() and FreeResult()
+    ReturnValue Invoke(const PropertyList& properties) {
+        return callback_(properties);
+    }
+
     std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
+        ReturnValue return_value = Invoke(properties);
+        return ResultToJson(return_value);
+    }
+
+    // Formats and frees a tool result. Image results are better streamed, see McpServer
+    static std::string ResultToJson(ReturnValue& return_value) {
+        if (std::holds_alternative<ImageContent*>(return_value)) {
+            std::string result = "{\"content\":[" + std::get<ImageContent*>(return_value)->to_json() + "],\"isError\":false}";
+            FreeResult(return_value);
+            return result;
+        }
+
         // 返回结果
         cJSON* result = cJSON_CreateObject();
         cJSON* content = cJSON_CreateArray();
-
-        if (std::holds_alternative<ImageContent*>(return_value)) {
-            auto image_content = std::get<ImageContent*>(return_value);
-            cJSON* image = cJSON_CreateObject();
-            cJSON_AddStringToObject(image, "type", "image");
-            cJSON_AddStringToObject(image, "image", image_content->to_json().c_str());
-            cJSON_AddItemToArray(content, image);
-            delete image_content;
-        } else {
-            cJSON* text = cJSON_CreateObject();
-            cJSON_AddStringToObject(text, "type", "text");
-            if (std::holds_alternative<std::string>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
-            } else if (std::holds_alternative<bool>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
-            } else if (std::holds_alternative<int>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
-            } else if (std::holds_alternative<cJSON*>(return_value)) {
-                cJSON* json = std::get<cJSON*>(return_value);
-                char* json_str = cJSON_PrintUnformatted(json);
-                cJSON_AddStringToObject(text, "text", json_str);
-                cJSON_free(json_str);
-                cJSON_Delete(json);
-            }
-            cJSON_AddItemToArray(content, text);
+        cJSON* text = cJSON_CreateObject();
+        cJSON_AddStringToObject(text, "type", "text");
+        if (std::holds_alternative<std::string>(return_value)) {
+            cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
+        } else if (std::holds_alternative<bool>(return_value)) {
+            cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
+        } else if (std::holds_alternative<int>(return_value)) {
+            cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+        } else if (std::holds_alternative<cJSON*>(return_value)) {
+            cJSON* json = std::get<cJSON*>(return_value);
+            char* json_str = cJSON_PrintUnformatted(json);
+            cJSON_AddStringToObject(text, "text", json_str);
+            cJSON_free(json_str);
         }
+        cJSON_AddItemToArray(content, text);
         cJSON_AddItemToObject(result, "content", content);
         cJSON_AddBoolToObject(result, "isError", false);
+        FreeResult(return_value);
 
         auto json_str = cJSON_PrintUnformatted(result);
         std::string result_str(json_str);
@@ -309,6 +352,15 @@ public:
         cJSON_Delete(result);
         return result_str;
     }
+
+    static void FreeResult(ReturnValue& return_value) {
+        if (std::holds_alternative<ImageContent*>(return_value)) {
+            delete std::get<ImageContent*>(return_value);
+        } else if (std::holds_alternative<cJSON*>(return_value)) {
+            cJSON_Delete(std::get<cJSON*>(return_value));
+        }
+        return_value = false;
+    }
 };
 
 class McpServer {
@@ -324,21 +376,71 @@ public:
     void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void ParseMessage(const cJSON* json);
-    void ParseMessage(const std::string& message);
+    void ParseMessage(std::string_view message);
+
+    // For async tools, called from inside the tool callback
+    static bool IsToolCallCancelled();
+    static void ReportToolProgress(int progress, int total, const std::string& message = "");
 
 private:
+    struct ToolCall {
+        int id;
+        McpTool* tool;
+        PropertyList arguments;
+        // Raw JSON of params._meta.progressToken, empty if no progress is wanted
+        std::string progress_token;
+        int64_t deadline_us;
+        // Set once the reply is sent, or when no reply is due any more
+        std::atomic<bool> finished{false};
+        std::atomic<bool> cancelled{false};
+    };
+
     McpServer();
     ~McpServer();
 
     void ParseCapabilities(const cJSON* capabilities);
 
     void ReplyResult(int id, const std::string& result);
+    void ReplyToolResult(int id, ReturnValue& return_value);
     void ReplyError(int id, const std::string& message);
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const std::string& progress_token);
+    bool QueueToolCall(std::shared_ptr<ToolCall> call);
+    void ToolWorkerTask();
+    void CheckToolCallTimeouts();
+    void CancelToolCall(int id);
+
+    // A page of tools/list is a range of tools_, user only tools are skipped unless listed
+    struct ToolsListPage {
+        size_t begin;
+        size_t end;
+    };
+    struct ToolsListPages {
+        bool valid = false;
+        std::vector<ToolsListPage> pages;
+        // The first tool name of each page after the first one
+        std::unordered_map<std::string_view, size_t> cursors;
+        // A tool too large for any page, listing stops before it
+        std::string_view oversized_tool;
+    };
+
+    void InvalidateToolsList();
+    const ToolsListPages& GetToolsListPages(bool list_user_only_tools);
 
     std::vector<McpTool*> tools_;
+    std::unordered_map<std::string_view, McpTool*> tool_index_;
+    // Serialized descriptor of each tool in tools_, built on the first tools/list
+    std::vector<std::string> tool_descriptors_;
+    ToolsListPages tools_list_pages_[2];
+
+    std::mutex tool_calls_mutex_;
+    std::deque<std::shared_ptr<ToolCall>> queued_tool_calls_;
+    // Queued and running async calls by request id, for cancellation and timeouts
+    std::map<int, std::shared_ptr<ToolCall>> active_tool_calls_;
+    int tool_worker_count_ = 0;
+    esp_timer_handle_t tool_timeout_timer_ = nullptr;
+    static thread_local ToolCall* current_tool_call_;
 };
 
 #endif // MCP_SERVER_H
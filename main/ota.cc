@@ -1,6 +1,7 @@
 #include "ota.h"
 #include "system_info.h"
 #include "settings.h"
+#include "http_downloader.h"
 #include "assets/lang_config.h"
 
 #include <cJSON.h>
@@ -10,6 +11,7 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <mbedtls/sha256.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
@@ -217,6 +219,10 @@ bool Ota::CheckVersion() {
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
         }
+        cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+        if (cJSON_IsString(sha256)) {
+            firmware_sha256_ = sha256->valuestring;
+        }
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -260,7 +266,7 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-bool Ota::Upgrade(const std::string& firmware_url) {
+bool Ota::Upgrade(const std::string& firmware_url, const std::string& firmware_sha256) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
     esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
@@ -272,79 +278,92 @@ bool Ota::Upgrade(const std::string& firmware_url) {
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
     bool image_header_checked = false;
     std::string image_header;
+    const size_t image_header_size = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
 
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
-    }
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
-        return false;
-    }
+    // The image is hashed while it is written, so a SHA-256 from the server costs no extra pass
+    mbedtls_sha256_context sha256_ctx;
+    mbedtls_sha256_init(&sha256_ctx);
+    mbedtls_sha256_starts(&sha256_ctx, 0);
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
-        return false;
-    }
-
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
-        }
+    auto network = Board::GetInstance().GetNetwork();
+    HttpDownloader downloader([network]() { return network->CreateHttp(0); });
+#if CONFIG_SPIRAM
+    downloader.SetBuffers(OTA_BUFFER_SIZE, OTA_BUFFER_COUNT);
+#endif
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+    // Runs on the writer thread of the downloader, esp_ota_write erases and writes the flash
+    // while the next buffer is being received
+    downloader.OnWrite([&](size_t offset, const char* data, size_t size) {
+        mbedtls_sha256_update(&sha256_ctx, (const unsigned char*)data, size);
+        if (image_header_checked) {
+            auto err = esp_ota_write(update_handle, data, size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+                return false;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
+            return true;
         }
 
-        if (ret == 0) {
-            break;
+        image_header.append(data, size);
+        if (image_header.size() < image_header_size) {
+            return true;
         }
+        esp_app_desc_t new_app_info;
+        memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                
-                auto current_version = esp_app_get_description()->version;
-                ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return false;
-                }
+        auto current_version = esp_app_get_description()->version;
+        ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
 
-                image_header_checked = true;
-                std::string().swap(image_header);
-            }
+        if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
+            esp_ota_abort(update_handle);
+            ESP_LOGE(TAG, "Failed to begin OTA");
+            return false;
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
+        image_header_checked = true;
+
+        auto err = esp_ota_write(update_handle, image_header.data(), image_header.size());
+        std::string().swap(image_header);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
             return false;
         }
+        return true;
+    });
+    downloader.OnProgress([this](size_t written, size_t total, size_t speed) {
+        size_t progress = written * 100 / total;
+        ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, written, total, speed);
+        if (upgrade_callback_) {
+            upgrade_callback_(progress, speed);
+        }
+    });
+
+    bool success = downloader.Download(firmware_url, update_partition->size);
+    uint8_t sha256[32];
+    mbedtls_sha256_finish(&sha256_ctx, sha256);
+    mbedtls_sha256_free(&sha256_ctx);
+    if (!success || !image_header_checked) {
+        if (image_header_checked) {
+            esp_ota_abort(update_handle);
+        } else if (success) {
+            ESP_LOGE(TAG, "Firmware is too small");
+        }
+        return false;
     }
-    http->Close();
+
+    auto& statistics = downloader.statistics();
+    ESP_LOGI(TAG, "Firmware downloaded, %u bytes in %lld ms, %d reconnects, %lld ms waiting for flash",
+             statistics.bytes_received, statistics.elapsed_ms, statistics.reconnect_count, statistics.writer_wait_ms);
+
+    char sha256_hex[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(sha256_hex + i * 2, 3, "%02x", sha256[i]);
+    }
+    if (!firmware_sha256.empty() && strcasecmp(firmware_sha256.c_str(), sha256_hex) != 0) {
+        ESP_LOGE(TAG, "Firmware SHA-256 %s does not match %s", sha256_hex, firmware_sha256.c_str());
+        esp_ota_abort(update_handle);
+        return false;
+    }
+    ESP_LOGI(TAG, "Firmware SHA-256: %s", sha256_hex);
 
     esp_err_t err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
@@ -368,12 +387,13 @@ bool Ota::Upgrade(const std::string& firmware_url) {
 
 bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    return Upgrade(firmware_url_);
+    return Upgrade(firmware_url_, firmware_sha256_);
 }
 
 bool Ota::StartUpgradeFromUrl(const std::string& url, std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    return Upgrade(url);
+    // The SHA-256 from the version check only applies to its own url
+    return Upgrade(url, url == firmware_url_ ? firmware_sha256_ : "");
 }
 
 std::vector<int> Ota::ParseVersion(const std::string& version) {
@@ -7,6 +7,10 @@
 #include <esp_err.h>
 #include "board.h"
 
+// With PSRAM the download may run up to this many bytes ahead of the flash writes
+#define OTA_BUFFER_SIZE (32 * 1024)
+#define OTA_BUFFER_COUNT 4
+
 class Ota {
 public:
     Ota();
@@ -44,11 +48,12 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    std::string firmware_sha256_;
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
 
-    bool Upgrade(const std::string& firmware_url);
+    bool Upgrade(const std::string& firmware_url, const std::string& firmware_sha256);
     std::function<void(int progress, size_t speed)> upgrade_callback_;
     std::vector<int> ParseVersion(const std::string& version);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
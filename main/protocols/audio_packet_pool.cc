@@ -0,0 +1,41 @@
+#include "audio_packet_pool.h"
+
+AudioPacketPool::AudioPacketPool() {
+    free_packets_.reserve(AUDIO_PACKET_POOL_SIZE);
+}
+
+std::unique_ptr<AudioStreamPacket> AudioPacketPool::Acquire(size_t payload_size) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_packets_.empty()) {
+            packet = std::move(free_packets_.back());
+            free_packets_.pop_back();
+        }
+    }
+    if (packet == nullptr) {
+        allocation_count_.fetch_add(1, std::memory_order_relaxed);
+        packet = std::make_unique<AudioStreamPacket>();
+        packet->payload.reserve(AUDIO_PACKET_PAYLOAD_RESERVE);
+    } else {
+        // Keep the payload and its capacity, reset everything else
+        auto payload = std::move(packet->payload);
+        *packet = AudioStreamPacket();
+        packet->payload = std::move(payload);
+    }
+    if (payload_size > packet->payload.capacity()) {
+        allocation_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    packet->payload.resize(payload_size);
+    return packet;
+}
+
+void AudioPacketPool::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    if (packet == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_packets_.size() < AUDIO_PACKET_POOL_SIZE) {
+        free_packets_.push_back(std::move(packet));
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+// Packets kept for reuse, enough for a full jitter buffer plus the send queue of a busy uplink
+#define AUDIO_PACKET_POOL_SIZE 64
+// Payload capacity given to every new packet, a 60ms Opus frame with a transport header fits
+#define AUDIO_PACKET_PAYLOAD_RESERVE 512
+
+/*
+ * Recycles AudioStreamPacket objects together with their payload capacity.
+ *
+ * The encode task and the transports acquire packets here, and the last owner of a packet
+ * (the transport after sending, the decoder after decoding) releases it. Packets that are
+ * dropped anywhere else are simply freed, so releasing is an optimization, never required.
+ * In steady state neither the packet nor its payload touches the heap;
+ * allocation_count() counts the times it does.
+ */
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
+
+    // The payload holds payload_size bytes, the other fields are reset
+    std::unique_ptr<AudioStreamPacket> Acquire(size_t payload_size);
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+
+    inline uint32_t allocation_count() const { return allocation_count_.load(std::memory_order_relaxed); }
+
+private:
+    AudioPacketPool();
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> free_packets_;
+    std::atomic<uint32_t> allocation_count_{0};
+};
+
+// Releases the packet to the pool when the scope ends, so a sender returns it on every exit path
+class ScopedAudioPacketRelease {
+public:
+    explicit ScopedAudioPacketRelease(std::unique_ptr<AudioStreamPacket>& packet) : packet_(packet) {}
+    ~ScopedAudioPacketRelease() { AudioPacketPool::GetInstance().Release(std::move(packet_)); }
+
+private:
+    ScopedAudioPacketRelease(const ScopedAudioPacketRelease&) = delete;
+    ScopedAudioPacketRelease& operator=(const ScopedAudioPacketRelease&) = delete;
+
+    std::unique_ptr<AudioStreamPacket>& packet_;
+};
+
+#endif // AUDIO_PACKET_POOL_H
@@ -0,0 +1,314 @@
+#include "control_message.h"
+
+namespace {
+
+class Scanner {
+public:
+    Scanner(const char* data, size_t size) : p_(data), end_(data + size) {}
+
+    bool AtEnd() {
+        SkipWhitespace();
+        return p_ == end_;
+    }
+
+    bool Expect(char c) {
+        SkipWhitespace();
+        if (p_ == end_ || *p_ != c) {
+            return false;
+        }
+        p_++;
+        return true;
+    }
+
+    bool ScanString(JsonSlice& slice) {
+        if (!Expect('"')) {
+            return false;
+        }
+        const char* start = p_;
+        bool escaped = false;
+        while (p_ != end_) {
+            unsigned char c = *p_;
+            if (c == '"') {
+                slice.raw = std::string_view(start, p_ - start);
+                slice.kind = kJsonSliceString;
+                slice.escaped = escaped;
+                p_++;
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                escaped = true;
+                if (++p_ == end_) {
+                    return false;
+                }
+                switch (*p_) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    for (int i = 0; i < 4; i++) {
+                        if (++p_ == end_ || !IsHexDigit(*p_)) {
+                            return false;
+                        }
+                    }
+                    break;
+                default:
+                    return false;
+                }
+            }
+            p_++;
+        }
+        return false;
+    }
+
+    bool ScanValue(JsonSlice& slice, int depth) {
+        SkipWhitespace();
+        if (p_ == end_) {
+            return false;
+        }
+        const char* start = p_;
+        switch (*p_) {
+        case '"':
+            return ScanString(slice);
+        case '{':
+        case '[':
+            if (depth >= CONTROL_MESSAGE_MAX_DEPTH || !SkipContainer(depth + 1)) {
+                return false;
+            }
+            slice.kind = *start == '{' ? kJsonSliceObject : kJsonSliceArray;
+            break;
+        case 't':
+            if (!ScanLiteral("true")) {
+                return false;
+            }
+            slice.kind = kJsonSliceBool;
+            break;
+        case 'f':
+            if (!ScanLiteral("false")) {
+                return false;
+            }
+            slice.kind = kJsonSliceBool;
+            break;
+        case 'n':
+            if (!ScanLiteral("null")) {
+                return false;
+            }
+            slice.kind = kJsonSliceNull;
+            break;
+        default:
+            if (!ScanNumber()) {
+                return false;
+            }
+            slice.kind = kJsonSliceNumber;
+            break;
+        }
+        slice.raw = std::string_view(start, p_ - start);
+        slice.escaped = false;
+        return true;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+
+    static bool IsHexDigit(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    void SkipWhitespace() {
+        while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+            p_++;
+        }
+    }
+
+    bool ScanLiteral(std::string_view literal) {
+        if ((size_t)(end_ - p_) < literal.size() || std::string_view(p_, literal.size()) != literal) {
+            return false;
+        }
+        p_ += literal.size();
+        return true;
+    }
+
+    bool ScanDigits() {
+        if (p_ == end_ || !IsDigit(*p_)) {
+            return false;
+        }
+        while (p_ != end_ && IsDigit(*p_)) {
+            p_++;
+        }
+        return true;
+    }
+
+    bool ScanNumber() {
+        if (p_ != end_ && *p_ == '-') {
+            p_++;
+        }
+        if (p_ != end_ && *p_ == '0') {
+            p_++;
+        } else if (!ScanDigits()) {
+            return false;
+        }
+        if (p_ != end_ && *p_ == '.') {
+            p_++;
+            if (!ScanDigits()) {
+                return false;
+            }
+        }
+        if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+            p_++;
+            if (p_ != end_ && (*p_ == '+' || *p_ == '-')) {
+                p_++;
+            }
+            if (!ScanDigits()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Checks an object or array without keeping anything
+    bool SkipContainer(int depth) {
+        bool object = *p_ == '{';
+        char close = object ? '}' : ']';
+        p_++;
+        if (Expect(close)) {
+            return true;
+        }
+        JsonSlice slice;
+        do {
+            if (object && (!ScanString(slice) || !Expect(':'))) {
+                return false;
+            }
+            if (!ScanValue(slice, depth)) {
+                return false;
+            }
+        } while (Expect(','));
+        return Expect(close);
+    }
+};
+
+void AppendUtf8(std::string& output, uint32_t code_point) {
+    if (code_point < 0x80) {
+        output.push_back(code_point);
+    } else if (code_point < 0x800) {
+        output.push_back(0xC0 | (code_point >> 6));
+        output.push_back(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        output.push_back(0xE0 | (code_point >> 12));
+        output.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        output.push_back(0x80 | (code_point & 0x3F));
+    } else {
+        output.push_back(0xF0 | (code_point >> 18));
+        output.push_back(0x80 | ((code_point >> 12) & 0x3F));
+        output.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        output.push_back(0x80 | (code_point & 0x3F));
+    }
+}
+
+uint32_t ParseHex4(const char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else {
+            value |= c - 'A' + 10;
+        }
+    }
+    return value;
+}
+
+} // namespace
+
+bool JsonSlice::operator==(std::string_view value) const {
+    if (kind != kJsonSliceString) {
+        return false;
+    }
+    if (!escaped) {
+        return raw == value;
+    }
+    return ToString() == value;
+}
+
+std::string JsonSlice::ToString() const {
+    if (!escaped) {
+        return std::string(raw);
+    }
+    // Escapes were checked by the scanner
+    std::string output;
+    output.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
+        if (c != '\\') {
+            output.push_back(c);
+            continue;
+        }
+        c = raw[++i];
+        switch (c) {
+        case 'b': output.push_back('\b'); break;
+        case 'f': output.push_back('\f'); break;
+        case 'n': output.push_back('\n'); break;
+        case 'r': output.push_back('\r'); break;
+        case 't': output.push_back('\t'); break;
+        case 'u': {
+            uint32_t code_point = ParseHex4(&raw[i + 1]);
+            i += 4;
+            // A surrogate pair encodes one character outside the BMP
+            if (code_point >= 0xD800 && code_point < 0xDC00 && i + 6 < raw.size() &&
+                raw[i + 1] == '\\' && raw[i + 2] == 'u') {
+                uint32_t low = ParseHex4(&raw[i + 3]);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+            }
+            AppendUtf8(output, code_point);
+            break;
+        }
+        default:
+            output.push_back(c);
+            break;
+        }
+    }
+    return output;
+}
+
+bool ControlMessage::Parse(const char* data, size_t size) {
+    field_count_ = 0;
+    Scanner scanner(data, size);
+    if (!scanner.Expect('{')) {
+        return false;
+    }
+    if (!scanner.Expect('}')) {
+        do {
+            Field field;
+            if (!scanner.ScanString(field.name) || !scanner.Expect(':') || !scanner.ScanValue(field.value, 1)) {
+                return false;
+            }
+            if (field_count_ < CONTROL_MESSAGE_MAX_FIELDS) {
+                fields_[field_count_++] = field;
+            }
+        } while (scanner.Expect(','));
+        if (!scanner.Expect('}')) {
+            return false;
+        }
+    }
+    return scanner.AtEnd();
+}
+
+JsonSlice ControlMessage::Get(std::string_view name) const {
+    for (size_t i = 0; i < field_count_; i++) {
+        if (fields_[i].name == name) {
+            return fields_[i].value;
+        }
+    }
+    return JsonSlice();
+}
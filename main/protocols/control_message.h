@@ -0,0 +1,67 @@
+#ifndef CONTROL_MESSAGE_H
+#define CONTROL_MESSAGE_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// Top level fields kept per message, later ones are validated but not kept
+#define CONTROL_MESSAGE_MAX_FIELDS 12
+#define CONTROL_MESSAGE_MAX_DEPTH 32
+
+enum JsonSliceKind : uint8_t {
+    kJsonSliceNone,     // The field is not in the message
+    kJsonSliceString,
+    kJsonSliceNumber,
+    kJsonSliceBool,
+    kJsonSliceNull,
+    kJsonSliceObject,
+    kJsonSliceArray,
+};
+
+/*
+ * A value inside the received text, not copied. Strings are kept without their quotes and
+ * still escaped; objects and arrays are kept as their raw JSON text, so an MCP payload can
+ * be handed on without being parsed or printed again.
+ */
+struct JsonSlice {
+    std::string_view raw;
+    JsonSliceKind kind = kJsonSliceNone;
+    bool escaped = false;
+
+    inline bool IsString() const { return kind == kJsonSliceString; }
+    inline bool IsObject() const { return kind == kJsonSliceObject; }
+    inline bool IsTrue() const { return kind == kJsonSliceBool && raw == "true"; }
+    // Compares a string value, e.g. message.type() == "tts"
+    bool operator==(std::string_view value) const;
+    bool operator!=(std::string_view value) const { return !(*this == value); }
+    // The string value with escapes decoded, or the raw text of any other value
+    std::string ToString() const;
+};
+
+/*
+ * Single pass scanner for the JSON control messages sent by the server.
+ *
+ * The messages are small objects dispatched on their "type" field, e.g.
+ * {"session_id":"xxx","type":"tts","state":"sentence_start","text":"..."}. Parse() checks the
+ * whole text and records where each top level value is, without allocating; the caller
+ * only copies the strings it keeps. Nested values are checked but only kept as raw text.
+ */
+class ControlMessage {
+public:
+    bool Parse(const char* data, size_t size);
+
+    JsonSlice Get(std::string_view name) const;
+    inline JsonSlice type() const { return Get("type"); }
+
+private:
+    struct Field {
+        JsonSlice name;
+        JsonSlice value;
+    };
+    Field fields_[CONTROL_MESSAGE_MAX_FIELDS];
+    size_t field_count_ = 0;
+};
+
+#endif // CONTROL_MESSAGE_H
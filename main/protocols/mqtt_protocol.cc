@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -10,7 +11,7 @@
 
 #define TAG "MQTT"
 
-MqttProtocol::MqttProtocol() {
+MqttProtocol::MqttProtocol() : cipher_(std::make_shared<UdpAudioCipher>()) {
     event_group_handle_ = xEventGroupCreate();
 
     // Initialize reconnect timer
@@ -91,32 +92,33 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        ControlMessage message;
+        if (!message.Parse(payload.data(), payload.size())) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        auto type = message.type();
+        if (!type.IsString()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
+        if (type == "hello") {
+            // Only the hello needs a tree, it is nested and comes once per session
+            cJSON* root = cJSON_ParseWithLength(payload.data(), payload.size());
             ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            cJSON_Delete(root);
+        } else if (type == "goodbye") {
+            auto session_id = message.Get("session_id");
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id.IsString() ? session_id.ToString().c_str() : "null");
+            if (!session_id.IsString() || session_id == session_id_) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -153,29 +155,22 @@ bool MqttProtocol::SendText(const std::string& text) {
 }
 
 bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    ScopedAudioPacketRelease release(packet);
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
+    // Audio packets may carry headroom for other transports, only the Opus data is sent here
+    size_t payload_size = packet->payload.size() - packet->headroom;
+    auto cipher = std::atomic_load(&cipher_);
+    if (!cipher->Encrypt(packet->payload.data() + packet->headroom, payload_size, packet->timestamp,
+        ++local_sequence_, send_buffer_)) {
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    audio_bytes_sent_ += send_buffer_.size();
+    return udp_->Send(send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -204,6 +199,7 @@ bool MqttProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    audio_bytes_sent_ = 0;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
@@ -228,8 +224,10 @@ bool MqttProtocol::OpenAudioChannel() {
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
+         * |tag 16u| (aes-128-gcm only)
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        auto cipher = std::atomic_load(&cipher_);
+        if (data.size() < cipher->overhead()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -239,33 +237,32 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        auto window_result = replay_window_.Check(sequence);
+        if (window_result == kReplayWindowDuplicate || window_result == kReplayWindowTooOld) {
+            ESP_LOGD(TAG, "Dropped replayed audio packet with sequence: %lu", sequence);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        auto& pool = AudioPacketPool::GetInstance();
+        auto packet = pool.Acquire(data.size() - cipher->overhead());
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        packet->sequence = sequence;
+        packet->has_sequence = true;
+        if (!cipher->Decrypt((const uint8_t*)data.data(), data.size(), packet->payload)) {
+            pool.Release(std::move(packet));
+            return;
+        }
+        // Only packets that decrypted move the window. Out of order packets are passed on, the jitter buffer reorders them
+        if (replay_window_.Update(sequence) == kReplayWindowJump) {
+            ESP_LOGW(TAG, "Unconfirmed audio sequence jump to %lu", sequence);
+            pool.Release(std::move(packet));
             return;
         }
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -277,6 +274,10 @@ bool MqttProtocol::OpenAudioChannel() {
     return true;
 }
 
+ReplayWindowStatistics MqttProtocol::GetAudioReceiveStatistics() const {
+    return replay_window_.GetStatistics();
+}
+
 std::string MqttProtocol::GetHelloMessage() {
     // 发送 hello 消息申请 UDP 通道
     cJSON* root = cJSON_CreateObject();
@@ -293,8 +294,15 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddUplinkAudioParams(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
+    // The server picks one of these in udp.encryption, older servers only know aes-128-ctr
+    cJSON* encryption = cJSON_CreateArray();
+    cJSON_AddItemToArray(encryption, cJSON_CreateString("aes-128-ctr"));
+    cJSON_AddItemToArray(encryption, cJSON_CreateString("aes-128-gcm"));
+    cJSON* udp = cJSON_CreateObject();
+    cJSON_AddItemToObject(udp, "encryption", encryption);
+    cJSON_AddItemToObject(root, "udp", udp);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -326,6 +334,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkAudioParams(audio_params);
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -338,13 +347,23 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
     auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
 
-    // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
-    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    auto mode = kUdpAudioCipherAesCtr;
+    auto encryption = cJSON_GetObjectItem(udp, "encryption");
+    if (cJSON_IsString(encryption) && strcmp(encryption->valuestring, "aes-128-gcm") == 0) {
+        mode = kUdpAudioCipherAesGcm;
+    }
+    ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_,
+        mode == kUdpAudioCipherAesGcm ? "aes-128-gcm" : "aes-128-ctr");
+    // The receive task of the previous channel may still be decrypting with the old cipher
+    auto cipher = std::make_shared<UdpAudioCipher>();
+    if (!cipher->SetKey(DecodeHexString(key), DecodeHexString(nonce), mode)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    std::atomic_store(&cipher_, cipher);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    replay_window_.Reset();
+    replay_window_.SetAuthenticated(mode == kUdpAudioCipherAesGcm);
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -3,10 +3,10 @@
 
 
 #include "protocol.h"
+#include "udp_audio_cipher.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -15,6 +15,7 @@
 #include <string>
 #include <map>
 #include <mutex>
+#include <memory>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 60000
@@ -31,6 +32,7 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    ReplayWindowStatistics GetAudioReceiveStatistics() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -40,12 +42,15 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    // Replaced as a whole on every server hello, use std::atomic_load / std::atomic_store
+    // because the UDP receive task decrypts without channel_mutex_
+    std::shared_ptr<UdpAudioCipher> cipher_;
+    // Reused for every datagram, guarded by channel_mutex_
+    std::string send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    ReplayWindow replay_window_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
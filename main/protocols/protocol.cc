@@ -4,7 +4,7 @@
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const ControlMessage& message)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -32,6 +32,60 @@ void Protocol::OnDisconnected(std::function<void()> callback) {
     on_disconnected_ = callback;
 }
 
+void Protocol::SetUplinkProfile(const UplinkProfile& profile) {
+    preferred_uplink_profile_ = profile;
+    uplink_profile_ = profile;
+}
+
+uint8_t* Protocol::PrependAudioHeader(AudioStreamPacket& packet, size_t header_size) {
+    // Packets encoded for this transport already have room for the header, the others are shifted once
+    if (packet.headroom < header_size) {
+        packet.payload.insert(packet.payload.begin(), header_size - packet.headroom, 0);
+        packet.headroom = header_size;
+    }
+    return packet.payload.data() + packet.headroom - header_size;
+}
+
+void Protocol::AddUplinkAudioParams(cJSON* audio_params) {
+    // A new session starts from the device preference, the server hello may override it
+    uplink_profile_ = preferred_uplink_profile_;
+    // Every field the server can override, so it knows what it is overriding
+    cJSON_AddNumberToObject(audio_params, "frame_duration", uplink_profile_.frame_duration);
+    cJSON_AddNumberToObject(audio_params, "bitrate", uplink_profile_.bitrate);
+    cJSON_AddNumberToObject(audio_params, "complexity", uplink_profile_.complexity);
+    cJSON_AddBoolToObject(audio_params, "dtx", uplink_profile_.dtx);
+}
+
+void Protocol::ParseUplinkAudioParams(const cJSON* audio_params) {
+    // e.g. "uplink": {"frame_duration": 20, "bitrate": 24000, "complexity": 3, "dtx": true}
+    auto uplink = cJSON_GetObjectItem(audio_params, "uplink");
+    if (!cJSON_IsObject(uplink)) {
+        return;
+    }
+    auto frame_duration = cJSON_GetObjectItem(uplink, "frame_duration");
+    if (cJSON_IsNumber(frame_duration)) {
+        if (frame_duration->valueint == 20 || frame_duration->valueint == 40 || frame_duration->valueint == 60) {
+            uplink_profile_.frame_duration = frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Unsupported uplink frame duration: %d", frame_duration->valueint);
+        }
+    }
+    auto bitrate = cJSON_GetObjectItem(uplink, "bitrate");
+    if (cJSON_IsNumber(bitrate)) {
+        uplink_profile_.bitrate = bitrate->valueint;
+    }
+    auto complexity = cJSON_GetObjectItem(uplink, "complexity");
+    if (cJSON_IsNumber(complexity) && complexity->valueint >= 0 && complexity->valueint <= 10) {
+        uplink_profile_.complexity = complexity->valueint;
+    }
+    auto dtx = cJSON_GetObjectItem(uplink, "dtx");
+    if (cJSON_IsBool(dtx)) {
+        uplink_profile_.dtx = cJSON_IsTrue(dtx);
+    }
+    ESP_LOGI(TAG, "Uplink profile: %d ms, bitrate %d, complexity %d, dtx %d", uplink_profile_.frame_duration,
+        uplink_profile_.bitrate, uplink_profile_.complexity, uplink_profile_.dtx);
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -64,6 +118,12 @@ void Protocol::SendStartListening(ListeningMode mode) {
     } else {
         message += ",\"mode\":\"manual\"";
     }
+#if CONFIG_USE_VAD_GATED_UPLINK
+    // Only voice is sent, silence between the utterances is not a network problem
+    if (mode != kListeningModeAutoStop) {
+        message += ",\"vad_gated\":true";
+    }
+#endif
     message += "}";
     SendText(message);
 }
@@ -78,6 +138,31 @@ void Protocol::SendMcpMessage(const std::string& payload) {
     SendText(message);
 }
 
+void Protocol::SendMcpMessage(const std::function<bool(const TextWriter& write)>& write_payload, size_t size_hint) {
+    std::string head = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":";
+    text_size_hint_ = head.size() + size_hint + 1;
+    if (SendTextFragment(head.data(), head.size(), false)) {
+        write_payload([this](const char* data, size_t size) {
+            return SendTextFragment(data, size, false);
+        });
+    }
+    // Always finish the message, a fragmented one would block everything sent after it
+    SendTextFragment("}", 1, true);
+}
+
+bool Protocol::SendTextFragment(const char* data, size_t size, bool last) {
+    if (text_fragments_.empty()) {
+        text_fragments_.reserve(text_size_hint_);
+    }
+    text_fragments_.append(data, size);
+    if (!last) {
+        return true;
+    }
+    std::string text = std::move(text_fragments_);
+    text_fragments_.clear();
+    return SendText(text);
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
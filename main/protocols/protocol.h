@@ -1,17 +1,38 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include "replay_window.h"
+#include "control_message.h"
+
 #include <cJSON.h>
 #include <string>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <atomic>
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
     std::vector<uint8_t> payload;
+    uint32_t sequence = 0;  // Transport sequence number, only valid with has_sequence
+    bool has_sequence = false;
+    size_t headroom = 0;    // Bytes reserved in front of the Opus data in payload for the transport header
+};
+
+// Opus encoder settings for the audio sent to the server
+struct UplinkProfile {
+    int frame_duration = 60;    // 20, 40 or 60 ms
+    int bitrate = 0;            // Advertised to the server, 0 for automatic
+    int complexity = 0;         // 0 ~ 10, higher costs more CPU
+    bool dtx = false;           // Discontinuous transmission, tiny packets during silence
+
+    bool operator==(const UplinkProfile& other) const {
+        return frame_duration == other.frame_duration && bitrate == other.bitrate &&
+            complexity == other.complexity && dtx == other.dtx;
+    }
+    bool operator!=(const UplinkProfile& other) const { return !(*this == other); }
 };
 
 struct BinaryProtocol2 {
@@ -41,6 +62,9 @@ enum ListeningMode {
     kListeningModeRealtime // 需要 AEC 支持
 };
 
+// Writes one piece of a streamed text message, false if it could not be sent
+using TextWriter = std::function<bool(const char* data, size_t size)>;
+
 class Protocol {
 public:
     virtual ~Protocol() = default;
@@ -54,9 +78,20 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Audio bytes sent in the current audio channel session, including the transport headers
+    inline size_t audio_bytes_sent() const {
+        return audio_bytes_sent_;
+    }
+    // The profile in effect for the current session, after the server hello
+    inline const UplinkProfile& uplink_profile() const {
+        return uplink_profile_;
+    }
+    // The profile advertised in the next client hello
+    void SetUplinkProfile(const UplinkProfile& profile);
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Server messages other than hello / goodbye, scanned in place without building a cJSON tree
+    void OnIncomingJson(std::function<void(const ControlMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -68,14 +103,23 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Warm up the connection before the audio channel is opened, e.g. while the wake word is spoken
+    virtual void PreConnect() {}
+    // Headroom to reserve in outgoing packets so SendAudio can build its header in place
+    virtual size_t GetAudioHeadroom() const { return 0; }
+    // Loss and reordering of the incoming audio, only datagram transports have any
+    virtual ReplayWindowStatistics GetAudioReceiveStatistics() const { return ReplayWindowStatistics(); }
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    // Sends an MCP message whose payload is written in pieces, for results too large to copy.
+    // size_hint is the expected payload size, used when the transport has to collect the pieces
+    void SendMcpMessage(const std::function<bool(const TextWriter& write)>& write_payload, size_t size_hint = 0);
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const ControlMessage& message)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
@@ -85,13 +129,23 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    UplinkProfile preferred_uplink_profile_;
+    UplinkProfile uplink_profile_;
+    std::atomic<size_t> audio_bytes_sent_{0};
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    // Sends a text message in fragments, by default they are collected and sent with SendText
+    virtual bool SendTextFragment(const char* data, size_t size, bool last);
+    std::string text_fragments_;
+    size_t text_size_hint_ = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    uint8_t* PrependAudioHeader(AudioStreamPacket& packet, size_t header_size);
+    void AddUplinkAudioParams(cJSON* audio_params);
+    void ParseUplinkAudioParams(const cJSON* audio_params);
 };
 
 #endif // PROTOCOL_H
@@ -0,0 +1,113 @@
+#include "replay_window.h"
+
+void ReplayWindow::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = false;
+    bitmap_ = 0;
+    has_pending_jump_ = false;
+    in_order_count_ = 0;
+    statistics_ = ReplayWindowStatistics();
+}
+
+void ReplayWindow::SetAuthenticated(bool authenticated) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    authenticated_ = authenticated;
+}
+
+ReplayWindowResult ReplayWindow::Check(uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = Classify(sequence);
+    if (result == kReplayWindowDuplicate) {
+        statistics_.duplicate_count++;
+    } else if (result == kReplayWindowTooOld) {
+        statistics_.too_old_count++;
+    }
+    return result;
+}
+
+ReplayWindowResult ReplayWindow::Update(uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = Classify(sequence);
+    switch (result) {
+    case kReplayWindowNew:
+        Advance(sequence);
+        break;
+    case kReplayWindowReordered: {
+        uint32_t offset = highest_sequence_ - sequence;
+        bitmap_ |= 1ULL << offset;
+        statistics_.reordered_count++;
+        if (offset > statistics_.reorder_depth) {
+            statistics_.reorder_depth = offset;
+        }
+        in_order_count_ = 0;
+        break;
+    }
+    case kReplayWindowJump:
+        if (has_pending_jump_ && sequence - pending_jump_ - 1 < REPLAY_WINDOW_SIZE) {
+            // The stream really continues from there, e.g. after a long outage
+            has_pending_jump_ = false;
+            Advance(sequence);
+            return kReplayWindowNew;
+        }
+        has_pending_jump_ = true;
+        pending_jump_ = sequence;
+        statistics_.jump_count++;
+        return result;
+    default:
+        return result;
+    }
+    statistics_.received_count++;
+    return result;
+}
+
+ReplayWindowStatistics ReplayWindow::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+ReplayWindowResult ReplayWindow::Classify(uint32_t sequence) const {
+    if (!started_) {
+        return kReplayWindowNew;
+    }
+    int32_t ahead = (int32_t)(sequence - highest_sequence_);
+    if (ahead > 0) {
+        if (!authenticated_ && ahead > REPLAY_WINDOW_MAX_JUMP) {
+            return kReplayWindowJump;
+        }
+        return kReplayWindowNew;
+    }
+    uint32_t offset = -ahead;
+    if (offset >= REPLAY_WINDOW_SIZE) {
+        return kReplayWindowTooOld;
+    }
+    if (bitmap_ & (1ULL << offset)) {
+        return kReplayWindowDuplicate;
+    }
+    return kReplayWindowReordered;
+}
+
+void ReplayWindow::Advance(uint32_t sequence) {
+    if (!started_) {
+        // Nothing before the first packet is missing
+        started_ = true;
+        highest_sequence_ = sequence;
+        bitmap_ = ~0ULL;
+        return;
+    }
+
+    uint32_t shift = sequence - highest_sequence_;
+    if (shift >= REPLAY_WINDOW_SIZE) {
+        statistics_.lost_count += REPLAY_WINDOW_SIZE - __builtin_popcountll(bitmap_) + (shift - REPLAY_WINDOW_SIZE);
+        bitmap_ = 1;
+    } else {
+        uint64_t leaving = bitmap_ >> (REPLAY_WINDOW_SIZE - shift);
+        statistics_.lost_count += shift - __builtin_popcountll(leaving);
+        bitmap_ = (bitmap_ << shift) | 1;
+    }
+    highest_sequence_ = sequence;
+
+    if (statistics_.reorder_depth > 0 && ++in_order_count_ >= REPLAY_WINDOW_SIZE) {
+        statistics_.reorder_depth--;
+        in_order_count_ = 0;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef REPLAY_WINDOW_H
+#define REPLAY_WINDOW_H
+
+#include <mutex>
+#include <cstdint>
+
+// Sequences tracked behind the highest one, older packets are rejected
+#define REPLAY_WINDOW_SIZE 64
+// Larger forward jumps of an unauthenticated stream must be confirmed by the next packet
+#define REPLAY_WINDOW_MAX_JUMP 256
+
+enum ReplayWindowResult {
+    kReplayWindowNew,           // Ahead of everything received so far
+    kReplayWindowReordered,     // Inside the window and not received yet
+    kReplayWindowDuplicate,
+    kReplayWindowTooOld,        // Behind the window
+    kReplayWindowJump,          // Too far ahead, dropped until the next packet confirms it
+};
+
+struct ReplayWindowStatistics {
+    uint32_t received_count = 0;
+    uint32_t reordered_count = 0;
+    uint32_t duplicate_count = 0;
+    uint32_t too_old_count = 0;
+    uint32_t jump_count = 0;
+    // Holes are counted as lost once they leave the window
+    uint32_t lost_count = 0;
+    // How many packets late reordered packets arrived recently, decays while the stream is in order
+    uint32_t reorder_depth = 0;
+};
+
+/*
+ * Anti-replay window over the sequence numbers of the UDP audio stream (RFC 4303 3.4.3).
+ *
+ * A bitmap marks which of the last REPLAY_WINDOW_SIZE sequences have been received, so a
+ * reordered packet is still accepted once while duplicates and stale packets are dropped.
+ * Reordering itself is left to the jitter buffer; reorder_depth tells it how long to wait.
+ *
+ * Check() is cheap and runs before decryption, Update() records a packet that decrypted
+ * correctly. Without authentication anybody can forge a sequence number, so a far jump
+ * only moves the window when the following packet continues from it.
+ */
+class ReplayWindow {
+public:
+    void Reset();
+    // Authenticated packets cannot be forged, a jump is a real gap
+    void SetAuthenticated(bool authenticated);
+
+    ReplayWindowResult Check(uint32_t sequence);
+    ReplayWindowResult Update(uint32_t sequence);
+    ReplayWindowStatistics GetStatistics() const;
+
+private:
+    mutable std::mutex mutex_;
+    bool authenticated_ = false;
+    bool started_ = false;
+    uint32_t highest_sequence_ = 0;
+    // Bit i is set if highest_sequence_ - i has been received
+    uint64_t bitmap_ = 0;
+    bool has_pending_jump_ = false;
+    uint32_t pending_jump_ = 0;
+    uint32_t in_order_count_ = 0;
+    ReplayWindowStatistics statistics_;
+
+    ReplayWindowResult Classify(uint32_t sequence) const;
+    void Advance(uint32_t sequence);
+};
+
+#endif // REPLAY_WINDOW_H
@@ -0,0 +1,120 @@
+#include "udp_audio_cipher.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <arpa/inet.h>
+
+#define TAG "UdpAudioCipher"
+
+UdpAudioCipher::UdpAudioCipher() {
+    mbedtls_aes_init(&aes_ctx_);
+    mbedtls_gcm_init(&gcm_encrypt_ctx_);
+    mbedtls_gcm_init(&gcm_decrypt_ctx_);
+}
+
+UdpAudioCipher::~UdpAudioCipher() {
+    mbedtls_aes_free(&aes_ctx_);
+    mbedtls_gcm_free(&gcm_encrypt_ctx_);
+    mbedtls_gcm_free(&gcm_decrypt_ctx_);
+}
+
+bool UdpAudioCipher::SetKey(const std::string& key, const std::string& header_template, UdpAudioCipherMode mode) {
+    Clear();
+    if (key.size() != 16 || header_template.size() != UDP_AUDIO_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Invalid key (%u) or nonce (%u) size", key.size(), header_template.size());
+        return false;
+    }
+    memcpy(header_template_, header_template.data(), UDP_AUDIO_HEADER_SIZE);
+    mode_ = mode;
+
+    int ret;
+    if (mode_ == kUdpAudioCipherAesGcm) {
+        ret = mbedtls_gcm_setkey(&gcm_encrypt_ctx_, MBEDTLS_CIPHER_ID_AES, (const unsigned char*)key.data(), 128);
+        if (ret == 0) {
+            ret = mbedtls_gcm_setkey(&gcm_decrypt_ctx_, MBEDTLS_CIPHER_ID_AES, (const unsigned char*)key.data(), 128);
+        }
+    } else {
+        ret = mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to set key, ret: %d", ret);
+        return false;
+    }
+    ready_ = true;
+    return true;
+}
+
+void UdpAudioCipher::Clear() {
+    ready_ = false;
+    // Drop the previous key schedule, the contexts stay usable
+    mbedtls_aes_free(&aes_ctx_);
+    mbedtls_gcm_free(&gcm_encrypt_ctx_);
+    mbedtls_gcm_free(&gcm_decrypt_ctx_);
+    mbedtls_aes_init(&aes_ctx_);
+    mbedtls_gcm_init(&gcm_encrypt_ctx_);
+    mbedtls_gcm_init(&gcm_decrypt_ctx_);
+}
+
+bool UdpAudioCipher::Encrypt(const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence, std::string& output) {
+    if (!ready_) {
+        return false;
+    }
+    output.resize(overhead() + size);
+    auto header = (uint8_t*)output.data();
+    memcpy(header, header_template_, UDP_AUDIO_HEADER_SIZE);
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(timestamp);
+    *(uint32_t*)&header[12] = htonl(sequence);
+    auto ciphertext = header + UDP_AUDIO_HEADER_SIZE;
+
+    int ret;
+    if (mode_ == kUdpAudioCipherAesGcm) {
+        header[1] |= UDP_AUDIO_FLAG_UPLINK;
+        // The header is the IV, so it is authenticated without being passed as additional data
+        ret = mbedtls_gcm_crypt_and_tag(&gcm_encrypt_ctx_, MBEDTLS_GCM_ENCRYPT, size, header, UDP_AUDIO_HEADER_SIZE,
+            nullptr, 0, payload, ciphertext, UDP_AUDIO_GCM_TAG_SIZE, ciphertext + size);
+    } else {
+        // The counter block starts as the header and is advanced by mbedtls, so work on a copy
+        uint8_t counter[UDP_AUDIO_HEADER_SIZE];
+        uint8_t stream_block[16];
+        size_t nc_off = 0;
+        memcpy(counter, header, UDP_AUDIO_HEADER_SIZE);
+        ret = mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, payload, ciphertext);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool UdpAudioCipher::Decrypt(const uint8_t* data, size_t size, std::vector<uint8_t>& payload) {
+    if (!ready_ || size < overhead()) {
+        return false;
+    }
+    if (mode_ == kUdpAudioCipherAesGcm && (data[1] & UDP_AUDIO_FLAG_UPLINK)) {
+        // Our own uplink reflected back, or a server reusing uplink IVs
+        ESP_LOGW(TAG, "Dropped an audio packet with the uplink flag set");
+        return false;
+    }
+    size_t payload_size = size - overhead();
+    payload.resize(payload_size);
+    auto ciphertext = data + UDP_AUDIO_HEADER_SIZE;
+
+    int ret;
+    if (mode_ == kUdpAudioCipherAesGcm) {
+        ret = mbedtls_gcm_auth_decrypt(&gcm_decrypt_ctx_, payload_size, data, UDP_AUDIO_HEADER_SIZE, nullptr, 0,
+            ciphertext + payload_size, UDP_AUDIO_GCM_TAG_SIZE, ciphertext, payload.data());
+    } else {
+        uint8_t counter[UDP_AUDIO_HEADER_SIZE];
+        uint8_t stream_block[16];
+        size_t nc_off = 0;
+        memcpy(counter, data, UDP_AUDIO_HEADER_SIZE);
+        ret = mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, counter, stream_block, ciphertext, payload.data());
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
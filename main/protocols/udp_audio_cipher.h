@@ -0,0 +1,67 @@
+#ifndef UDP_AUDIO_CIPHER_H
+#define UDP_AUDIO_CIPHER_H
+
+#include <mbedtls/aes.h>
+#include <mbedtls/gcm.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|, also the AES-CTR / AES-GCM nonce
+#define UDP_AUDIO_HEADER_SIZE 16
+#define UDP_AUDIO_GCM_TAG_SIZE 16
+// Set in the flags of every uplink header in AES-GCM mode. Both directions share the key and the
+// header template, so without it the two sequence counters would produce the same IVs
+#define UDP_AUDIO_FLAG_UPLINK 0x80
+
+enum UdpAudioCipherMode {
+    kUdpAudioCipherAesCtr,  // "aes-128-ctr", confidentiality only
+    kUdpAudioCipherAesGcm,  // "aes-128-gcm", a tag after the payload authenticates the header and the payload
+};
+
+/*
+ * Encryption of the MQTT+UDP audio channel.
+ *
+ * The key schedule is computed once per session, and the header / nonce / tag are kept in
+ * fixed arrays, so neither direction allocates once the output buffers have grown to a
+ * frame. mbedtls runs on the AES accelerator (with GDMA on the chips that have it) when
+ * CONFIG_MBEDTLS_HARDWARE_AES is enabled, which is the ESP-IDF default.
+ *
+ * Encrypt is called by the sending task and Decrypt by the UDP receive task. AES-CTR only
+ * reads the shared key schedule; AES-GCM keeps state while running, so each direction has
+ * its own GCM context. A new session gets a new cipher object instead of SetKey() on the
+ * one the receive task may be using.
+ */
+class UdpAudioCipher {
+public:
+    UdpAudioCipher();
+    ~UdpAudioCipher();
+
+    // key is 16 bytes, header_template is the 16 bytes nonce from the server hello
+    bool SetKey(const std::string& key, const std::string& header_template, UdpAudioCipherMode mode);
+    void Clear();
+
+    // Writes header + ciphertext (+ tag) to output, reusing its capacity
+    bool Encrypt(const uint8_t* payload, size_t size, uint32_t timestamp, uint32_t sequence, std::string& output);
+    // Writes the plain payload of a received datagram to payload, false if it is malformed or forged
+    bool Decrypt(const uint8_t* data, size_t size, std::vector<uint8_t>& payload);
+
+    inline bool ready() const { return ready_; }
+    inline UdpAudioCipherMode mode() const { return mode_; }
+    // Bytes added to every payload on the wire
+    inline size_t overhead() const {
+        return UDP_AUDIO_HEADER_SIZE + (mode_ == kUdpAudioCipherAesGcm ? UDP_AUDIO_GCM_TAG_SIZE : 0);
+    }
+
+private:
+    UdpAudioCipherMode mode_ = kUdpAudioCipherAesCtr;
+    bool ready_ = false;
+    uint8_t header_template_[UDP_AUDIO_HEADER_SIZE] = {0};
+    mbedtls_aes_context aes_ctx_;
+    mbedtls_gcm_context gcm_encrypt_ctx_;
+    mbedtls_gcm_context gcm_decrypt_ctx_;
+};
+
+#endif // UDP_AUDIO_CIPHER_H
@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -14,9 +15,27 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t idle_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->CloseIdleConnection();
+            });
+        },
+        .arg = this,
+    };
+    esp_timer_create(&idle_timer_args, &idle_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (preconnecting_) {
+        xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+    if (idle_timer_ != nullptr) {
+        esp_timer_stop(idle_timer_);
+        esp_timer_delete(idle_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,35 +45,47 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    ScopedAudioPacketRelease release(packet);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    // The header is written into the packet headroom, right in front of the Opus data
+    size_t payload_size = packet->payload.size() - packet->headroom;
+    const uint8_t* frame;
+    size_t frame_size;
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        auto bp2 = (BinaryProtocol2*)PrependAudioHeader(*packet, sizeof(BinaryProtocol2));
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp2->payload_size = htonl(payload_size);
+        frame = (const uint8_t*)bp2;
+        frame_size = sizeof(BinaryProtocol2) + payload_size;
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        auto bp3 = (BinaryProtocol3*)PrependAudioHeader(*packet, sizeof(BinaryProtocol3));
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp3->payload_size = htons(payload_size);
+        frame = (const uint8_t*)bp3;
+        frame_size = sizeof(BinaryProtocol3) + payload_size;
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        frame = packet->payload.data() + packet->headroom;
+        frame_size = payload_size;
+    }
+
+    audio_bytes_sent_ += frame_size;
+    return websocket_->Send(frame, frame_size, true);
+}
+
+size_t WebsocketProtocol::GetAudioHeadroom() const {
+    if (version_ == 2) {
+        return sizeof(BinaryProtocol2);
+    } else if (version_ == 3) {
+        return sizeof(BinaryProtocol3);
     }
+    return 0;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -71,30 +102,225 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::SendTextFragment(const char* data, size_t size, bool last) {
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    // Continuation frames of one text message, nothing else may be sent in between
+    if (!websocket_->Send(data, size, false, last)) {
+        ESP_LOGE(TAG, "Failed to send text fragment of %u bytes", size);
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && session_active_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    if (session_reuse_ && session_active_ && websocket_ != nullptr && websocket_->IsConnected()) {
+        // Only the session ends, the connection is kept for the next one
+        session_active_ = false;
+        std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"goodbye\"}";
+        websocket_->Send(message);
+        StartIdleTimer();
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+        return;
+    }
+    ResetConnection();
+    session_active_ = false;
+}
+
+void WebsocketProtocol::PreConnect() {
+    if (session_active_ || preconnecting_) {
+        return;
+    }
+    if (websocket_ != nullptr && websocket_->IsConnected()) {
+        // Still warm, keep it a while longer
+        StartIdleTimer();
+        return;
+    }
+
+    // The handshake can take seconds, run it on its own task so the main loop keeps going
+    ResetConnection();
+    preconnect_version_ = version_;
+    preconnecting_ = true;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT);
+    if (xTaskCreate([](void* arg) {
+        ((WebsocketProtocol*)arg)->PreConnectTask();
+        vTaskDelete(NULL);
+    }, "ws_preconnect", 2048 * 4, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the pre-connect task");
+        preconnecting_ = false;
+    }
+}
+
+void WebsocketProtocol::PreConnectTask() {
+    int version = preconnect_version_;
+    uint32_t connect_ms = 0;
+    auto websocket = CreateConnection(version, connect_ms);
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        preconnected_websocket_ = std::move(websocket);
+        preconnect_version_ = version;
+        preconnect_ms_ = connect_ms;
+    }
+    preconnecting_ = false;
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT);
+    Application::GetInstance().Schedule([this]() {
+        TakePreConnection();
+    });
+}
+
+void WebsocketProtocol::TakePreConnection() {
+    std::unique_ptr<WebSocket> websocket;
+    int version;
+    uint32_t connect_ms;
+    {
+        std::lock_guard<std::mutex> lock(preconnect_mutex_);
+        websocket = std::move(preconnected_websocket_);
+        version = preconnect_version_;
+        connect_ms = preconnect_ms_;
+    }
+    if (websocket == nullptr) {
+        return;
+    }
+    if (session_active_ || websocket_ != nullptr) {
+        // The audio channel connected by itself meanwhile
+        ESP_LOGI(TAG, "Dropping the pre-connected websocket");
+        return;
+    }
+    UseConnection(std::move(websocket), version, connect_ms);
+    connection_statistics_.preconnect_count++;
+    StartIdleTimer();
+}
+
+void WebsocketProtocol::StartIdleTimer() {
+    esp_timer_stop(idle_timer_);
+    esp_timer_start_once(idle_timer_, WEBSOCKET_IDLE_TIMEOUT_SECONDS * 1000000ULL);
+}
+
+void WebsocketProtocol::CloseIdleConnection() {
+    if (!session_active_ && websocket_ != nullptr) {
+        ESP_LOGI(TAG, "Closing idle connection");
+        ResetConnection();
+    }
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    if (preconnecting_) {
+        // Use the connection being set up instead of opening a second one
+        xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT, pdFALSE, pdFALSE,
+            pdMS_TO_TICKS(WEBSOCKET_PRECONNECT_WAIT_MS));
+    }
+    TakePreConnection();
+    esp_timer_stop(idle_timer_);
+    error_occurred_ = false;
+    audio_bytes_sent_ = 0;
+    session_id_ = "";
+
+    auto message = GetHelloMessage();
+    bool reused = websocket_ != nullptr && websocket_->IsConnected();
+    if (reused) {
+        xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+        int64_t hello_start_us = esp_timer_get_time();
+        if (websocket_->Send(message) && WaitForServerHello(WEBSOCKET_REUSE_HELLO_TIMEOUT_MS)) {
+            connection_statistics_.last_hello_ms = (esp_timer_get_time() - hello_start_us) / 1000;
+        } else {
+            ESP_LOGW(TAG, "Kept connection did not answer, reconnecting");
+            ResetConnection();
+            reused = false;
+        }
+    }
+
+    if (!reused) {
+        if (!Connect()) {
+            SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+            return false;
+        }
+
+        // Send hello message to describe the client
+        xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+        int64_t hello_start_us = esp_timer_get_time();
+        if (!SendText(message)) {
+            return false;
+        }
+        if (!WaitForServerHello(WEBSOCKET_HELLO_TIMEOUT_MS)) {
+            ESP_LOGE(TAG, "Failed to receive server hello");
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+            return false;
+        }
+        connection_statistics_.last_hello_ms = (esp_timer_get_time() - hello_start_us) / 1000;
+    }
+
+    auto& stats = connection_statistics_;
+    stats.open_count++;
+    if (reused) {
+        stats.reuse_count++;
+    }
+    ESP_LOGI(TAG, "Audio channel opened on a %s connection, connect: %lu ms, hello: %lu ms, reused: %lu/%lu, pre-connected: %lu",
+        reused ? "kept" : "new", stats.last_connect_ms, stats.last_hello_ms, stats.reuse_count, stats.open_count,
+        stats.preconnect_count);
+
+    session_active_ = true;
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+
+    return true;
+}
+
+bool WebsocketProtocol::WaitForServerHello(int timeout_ms) {
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT;
+}
+
+bool WebsocketProtocol::Connect() {
+    int version = version_;
+    uint32_t connect_ms = 0;
+    auto websocket = CreateConnection(version, connect_ms);
+    if (websocket == nullptr) {
+        return false;
+    }
+    UseConnection(std::move(websocket), version, connect_ms);
+    return true;
+}
+
+void WebsocketProtocol::ResetConnection() {
+    // Events still coming from the old socket are ignored from now on
+    live_websocket_ = nullptr;
+    websocket_.reset();
+}
+
+void WebsocketProtocol::UseConnection(std::unique_ptr<WebSocket> websocket, int version, uint32_t connect_ms) {
+    websocket_ = std::move(websocket);
+    live_websocket_ = websocket_.get();
+    version_ = version;
+    session_reuse_ = false;
+    connection_statistics_.last_connect_ms = connect_ms;
+    connection_statistics_.connect_count++;
+}
+
+// Also runs on the pre-connect task, so members are only touched by the handlers it installs
+std::unique_ptr<WebSocket> WebsocketProtocol::CreateConnection(int& version, uint32_t& connect_ms) {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
-    int version = settings.GetInt("version");
-    if (version != 0) {
-        version_ = version;
+    int configured_version = settings.GetInt("version");
+    if (configured_version != 0) {
+        version = configured_version;
     }
 
-    error_occurred_ = false;
-
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    auto websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
-        return false;
+        return nullptr;
     }
 
     if (!token.empty()) {
@@ -102,101 +328,106 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    // Every connection gets its own handlers, only the one in use may touch the session
+    WebSocket* socket = websocket.get();
+    websocket->OnData([this, socket](const char* data, size_t len, bool binary) {
+        if (live_websocket_ != socket) {
+            return;
+        }
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
+                    // The payload size comes from the wire, never read past the frame
+                    if (len < sizeof(BinaryProtocol2) || len - sizeof(BinaryProtocol2) < ntohl(bp2->payload_size)) {
+                        ESP_LOGW(TAG, "Invalid audio frame, len: %u", len);
+                        return;
+                    }
                     bp2->version = ntohs(bp2->version);
                     bp2->type = ntohs(bp2->type);
                     bp2->timestamp = ntohl(bp2->timestamp);
                     bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                    auto packet = AudioPacketPool::GetInstance().Acquire(bp2->payload_size);
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->timestamp = bp2->timestamp;
+                    memcpy(packet->payload.data(), bp2->payload, bp2->payload_size);
+                    on_incoming_audio_(std::move(packet));
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
+                    if (len < sizeof(BinaryProtocol3) || len - sizeof(BinaryProtocol3) < ntohs(bp3->payload_size)) {
+                        ESP_LOGW(TAG, "Invalid audio frame, len: %u", len);
+                        return;
+                    }
                     bp3->type = bp3->type;
                     bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                    auto packet = AudioPacketPool::GetInstance().Acquire(bp3->payload_size);
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    memcpy(packet->payload.data(), bp3->payload, bp3->payload_size);
+                    on_incoming_audio_(std::move(packet));
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    auto packet = AudioPacketPool::GetInstance().Acquire(len);
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    memcpy(packet->payload.data(), data, len);
+                    on_incoming_audio_(std::move(packet));
                 }
             }
         } else {
             // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
+            ControlMessage message;
+            if (!message.Parse(data, len)) {
+                ESP_LOGE(TAG, "Invalid JSON message, data: %.*s", (int)len, data);
+            } else if (!message.type().IsString()) {
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+            } else if (message.type() == "hello") {
+                // Only the hello needs a tree, it is nested and comes once per session
+                auto root = cJSON_ParseWithLength(data, len);
+                ParseServerHello(root);
+                cJSON_Delete(root);
+            } else if (message.type() == "goodbye") {
+                // Only sent by servers that keep the connection between sessions
+                auto session_id = message.Get("session_id");
+                ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id.IsString() ? session_id.ToString().c_str() : "null");
+                if (!session_id.IsString() || session_id == session_id_) {
+                    Application::GetInstance().Schedule([this]() {
+                        CloseAudioChannel();
+                    });
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+            } else if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(message);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this, socket]() {
+        if (live_websocket_ != socket) {
+            ESP_LOGI(TAG, "Unused websocket disconnected");
+            return;
+        }
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
+        // An idle kept connection has no audio channel to close
+        if (session_active_.exchange(false) && on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
-    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
+    ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version);
+    int64_t connect_start_us = esp_timer_get_time();
+    if (!websocket->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
-        return false;
+        return nullptr;
     }
-
-    // Send hello message to describe the client
-    auto message = GetHelloMessage();
-    if (!SendText(message)) {
-        return false;
-    }
-
-    // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
-    if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
-        ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
-        return false;
-    }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
-
-    return true;
+    connect_ms = (esp_timer_get_time() - connect_start_us) / 1000;
+    return websocket;
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
@@ -209,13 +440,15 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // The connection can carry more than one session, each ended by a goodbye message
+    cJSON_AddBoolToObject(features, "session_reuse", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddUplinkAudioParams(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -237,6 +470,9 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    auto session_reuse = cJSON_GetObjectItem(root, "session_reuse");
+    session_reuse_ = cJSON_IsTrue(session_reuse);
+
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -247,6 +483,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkAudioParams(audio_params);
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
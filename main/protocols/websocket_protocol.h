@@ -7,8 +7,30 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <mutex>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_PRECONNECT_DONE_EVENT (1 << 1)
+
+#define WEBSOCKET_HELLO_TIMEOUT_MS 10000
+// A kept connection may have been dropped silently, give up on it sooner and reconnect
+#define WEBSOCKET_REUSE_HELLO_TIMEOUT_MS 3000
+// A connection without a session is closed after this long
+#define WEBSOCKET_IDLE_TIMEOUT_SECONDS 60
+// Opening the audio channel waits this long for a running pre-connect before connecting itself
+#define WEBSOCKET_PRECONNECT_WAIT_MS 10000
+
+struct WebsocketConnectionStatistics {
+    uint32_t open_count = 0;        // Audio channels opened
+    uint32_t reuse_count = 0;       // Audio channels opened on a connection that was already up
+    uint32_t connect_count = 0;     // New connections, including the speculative ones
+    uint32_t preconnect_count = 0;
+    uint32_t last_connect_ms = 0;   // TCP + TLS + WebSocket upgrade of the last new connection
+    uint32_t last_hello_ms = 0;     // Client hello to server hello of the last audio channel
+};
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -20,14 +42,40 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    size_t GetAudioHeadroom() const override;
+    void PreConnect() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
+    // The socket events are accepted from, read by the network task
+    std::atomic<WebSocket*> live_websocket_{nullptr};
     int version_ = 1;
+    // Set while a session (hello to goodbye) runs on the connection
+    std::atomic<bool> session_active_{false};
+    // The server ends sessions with a goodbye message and keeps the connection
+    bool session_reuse_ = false;
+    esp_timer_handle_t idle_timer_ = nullptr;
+    WebsocketConnectionStatistics connection_statistics_;
+    // The pre-connect task connects on its own and leaves the result here for the main loop
+    std::atomic<bool> preconnecting_{false};
+    std::mutex preconnect_mutex_;
+    std::unique_ptr<WebSocket> preconnected_websocket_;
+    int preconnect_version_ = 1;
+    uint32_t preconnect_ms_ = 0;
 
+    bool Connect();
+    std::unique_ptr<WebSocket> CreateConnection(int& version, uint32_t& connect_ms);
+    void UseConnection(std::unique_ptr<WebSocket> websocket, int version, uint32_t connect_ms);
+    void ResetConnection();
+    void PreConnectTask();
+    void TakePreConnection();
+    bool WaitForServerHello(int timeout_ms);
+    void StartIdleTimer();
+    void CloseIdleConnection();
     void ParseServerHello(const cJSON* root);
     bool SendText(const std::string& text) override;
+    bool SendTextFragment(const char* data, size_t size, bool last) override;
     std::string GetHelloMessage();
 };
 
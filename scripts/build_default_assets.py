@@ -19,6 +19,9 @@ import json
 import struct
 from datetime import datetime
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'spiffs_assets'))
+from assets_digest import append_digest
+
 
 # =============================================================================
 # Pack model functions (from pack_model.py)
@@ -395,6 +398,8 @@ def pack_assets_simple(target_path, include_path, out_file, assets_path, max_nam
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
     final_data = header_data + combined_data_length + combined_data
+    # SHA-256 of the image and of each file, checked once by the firmware
+    final_data = append_digest(final_data)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)
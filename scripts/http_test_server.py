@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+'''
+  Stand-in HTTP server for testing the assets and OTA downloads on a device or a host build.
+
+  Serves the files of a directory with GET and HEAD, and Range requests (206) by default.
+  It can misbehave the way real servers and networks do:
+    --no-range      ignore Range and always reply 200 with the whole file
+    --drop-at N     close the connection after N bytes of a response body
+    --drop-once     only drop the first response, so a resumed download completes
+    --rate BPS      limit the send rate, so a download is still running when it is dropped
+
+  Example, for resuming an assets download that is cut after 100 KB:
+    python3 scripts/http_test_server.py --dir build --port 8080 --drop-at 100000 --drop-once
+'''
+import argparse
+import os
+import re
+import socket
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class TestRequestHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    options = None
+    dropped = False
+    lock = threading.Lock()
+
+    def setup(self):
+        super().setup()
+        # Small send buffer, so a drop happens close to the requested offset
+        self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 8192)
+
+    def log_message(self, format, *args):
+        if self.options.verbose:
+            super().log_message(format, *args)
+
+    def do_HEAD(self):
+        self.handle_request(send_body=False)
+
+    def do_GET(self):
+        self.handle_request(send_body=True)
+
+    def handle_request(self, send_body):
+        name = os.path.basename(self.path.split('?')[0])
+        path = os.path.join(self.options.dir, name)
+        if not name or not os.path.isfile(path):
+            self.send_empty(404)
+            return
+        with open(path, 'rb') as f:
+            body = f.read()
+
+        start, end = 0, len(body)
+        range_header = self.headers.get('Range')
+        if range_header and not self.options.no_range:
+            byte_range = self.parse_range(range_header, len(body))
+            if byte_range is None:
+                self.send_empty(416, {'Content-Range': f'bytes */{len(body)}'})
+                return
+            start, end = byte_range
+            self.send_response(206)
+            self.send_header('Content-Range', f'bytes {start}-{end - 1}/{len(body)}')
+        else:
+            self.send_response(200)
+        self.send_header('Accept-Ranges', 'none' if self.options.no_range else 'bytes')
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(end - start))
+        self.end_headers()
+        if send_body:
+            self.send_body(body[start:end])
+        print(f'{self.command} {name} {range_header or "-"} -> {start}-{end} of {len(body)}')
+
+    @staticmethod
+    def parse_range(header, size):
+        # A single range: bytes=a-b, bytes=a- or bytes=-n
+        match = re.fullmatch(r'bytes=(\d*)-(\d*)', header.strip())
+        if not match or (match.group(1) == '' and match.group(2) == ''):
+            return None
+        if match.group(1) == '':
+            start, end = max(0, size - int(match.group(2))), size
+        else:
+            start = int(match.group(1))
+            end = min(size, int(match.group(2)) + 1) if match.group(2) else size
+        if start >= size or start >= end:
+            return None
+        return start, end
+
+    def send_body(self, data):
+        drop_at = self.take_drop()
+        sent = 0
+        while sent < len(data):
+            if drop_at is not None and sent >= drop_at:
+                print(f'Dropped the connection after {sent} bytes')
+                self.close_connection = True
+                # Reset instead of a clean close, like a lost network
+                self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack('ii', 1, 0))
+                return
+            limit = len(data) if drop_at is None else min(drop_at, len(data))
+            chunk = min(1024, limit - sent)
+            self.wfile.write(data[sent:sent + chunk])
+            sent += chunk
+            if self.options.rate:
+                time.sleep(chunk / self.options.rate)
+
+    def take_drop(self):
+        if self.options.drop_at is None:
+            return None
+        with self.lock:
+            if self.options.drop_once and TestRequestHandler.dropped:
+                return None
+            TestRequestHandler.dropped = True
+        return self.options.drop_at
+
+    def send_empty(self, code, headers=None):
+        self.send_response(code)
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+        print(f'{self.command} {self.path} -> {code}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in HTTP server for download tests')
+    parser.add_argument('--dir', '-d', default='.', help='Directory with the files to serve')
+    parser.add_argument('--host', default='0.0.0.0', help='Address to listen on')
+    parser.add_argument('--port', '-p', type=int, default=8080, help='Port to listen on')
+    parser.add_argument('--no-range', action='store_true', help='Ignore Range headers and reply 200 with the whole file')
+    parser.add_argument('--drop-at', type=int, help='Close the connection after this many bytes of a response body')
+    parser.add_argument('--drop-once', action='store_true', help='Only drop the first response')
+    parser.add_argument('--rate', type=int, default=0, help='Send rate limit in bytes per second, 0 for none')
+    parser.add_argument('--verbose', '-v', action='store_true', help='Log every request line')
+    TestRequestHandler.options = parser.parse_args()
+
+    server = ThreadingHTTPServer((TestRequestHandler.options.host, TestRequestHandler.options.port), TestRequestHandler)
+    server.daemon_threads = True
+    print(f'Serving {os.path.abspath(TestRequestHandler.options.dir)} on port {TestRequestHandler.options.port}')
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
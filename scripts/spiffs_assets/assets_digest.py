@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Digest trailer of the assets partition image
+
+The image keeps the layout read by every firmware version:
+
+    uint32 files, uint32 checksum, uint32 length
+    mmap table (files * 44 bytes) + file data ('ZZ' + bytes per file)
+
+where checksum is the 16-bit byte sum of the `length` bytes after the header.
+This tool appends a trailer after those bytes, so older firmware ignores it:
+
+    char     magic[8]            "XZDIGEST"
+    uint32   version             1
+    uint32   files               same as the header
+    uint8    image_sha256[32]    SHA-256 of the header, table and data
+    uint8    file_sha256[files][32]  SHA-256 of each file, in table order, without the 'ZZ' prefix
+
+The trailer starts at the next 4 byte boundary. The firmware checks the image
+with the hardware SHA engine once and caches the result in NVS.
+
+For delta updates a block manifest is served next to the image as assets.bin.blocks:
+
+    char     magic[8]            "XZBLOCKS"
+    uint32   version             1
+    uint32   block_size          a multiple of the 4 KB flash sector
+    uint32   image_size
+    uint8    block_sha256[n][32] SHA-256 of each block, the last one may be shorter
+
+The firmware hashes the blocks already in its partition and downloads only the
+ones that differ with HTTP Range requests.
+
+Usage:
+    assets_digest.py append assets.bin   # add or replace the trailer
+    assets_digest.py check assets.bin    # verify checksum, trailer and every file
+    assets_digest.py blocks assets.bin   # write assets.bin.blocks
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+DIGEST_MAGIC = b'XZDIGEST'
+DIGEST_VERSION = 1
+BLOCKS_MAGIC = b'XZBLOCKS'
+BLOCKS_VERSION = 1
+DEFAULT_BLOCK_SIZE = 16 * 1024
+HEADER_SIZE = 12
+TABLE_ENTRY_SIZE = 44
+NAME_LENGTH = 32
+
+
+def compute_checksum(data):
+    return sum(data) & 0xFFFF
+
+
+def parse_image(image):
+    """Returns (files, checksum, length, table) where table is a list of (name, offset, size)"""
+    if len(image) < HEADER_SIZE:
+        raise ValueError('image is smaller than its header')
+    files, checksum, length = struct.unpack_from('<III', image, 0)
+    if HEADER_SIZE + length > len(image):
+        raise ValueError(f'stored length {length} exceeds the image size {len(image)}')
+    if files * TABLE_ENTRY_SIZE > length:
+        raise ValueError(f'table of {files} files exceeds the stored length {length}')
+    data_start = HEADER_SIZE + files * TABLE_ENTRY_SIZE
+    table = []
+    for i in range(files):
+        entry = HEADER_SIZE + i * TABLE_ENTRY_SIZE
+        name = image[entry:entry + NAME_LENGTH].split(b'\0', 1)[0].decode('utf-8', 'replace')
+        size, offset = struct.unpack_from('<II', image, entry + NAME_LENGTH)
+        start = data_start + offset
+        if start + 2 + size > HEADER_SIZE + length:
+            raise ValueError(f'file {name} exceeds the stored length')
+        table.append((name, start, size))
+    return files, checksum, length, table
+
+
+def digest_offset(length):
+    return (HEADER_SIZE + length + 3) & ~3
+
+
+def build_trailer(image):
+    files, _, length, table = parse_image(image)
+    end = HEADER_SIZE + length
+    trailer = DIGEST_MAGIC + struct.pack('<II', DIGEST_VERSION, files)
+    trailer += hashlib.sha256(image[:end]).digest()
+    for _, start, size in table:
+        trailer += hashlib.sha256(image[start + 2:start + 2 + size]).digest()
+    return trailer
+
+
+def append_digest(image):
+    """Returns the image with its digest trailer, any previous trailer is replaced"""
+    image = bytes(image)
+    _, _, length, _ = parse_image(image)
+    end = HEADER_SIZE + length
+    padding = b'\0' * (digest_offset(length) - end)
+    return image[:end] + padding + build_trailer(image)
+
+
+def build_blocks(image, block_size=DEFAULT_BLOCK_SIZE):
+    """Returns the block manifest of the image"""
+    if block_size <= 0 or block_size % 4096 != 0:
+        raise ValueError(f'block size {block_size} is not a multiple of 4096')
+    manifest = BLOCKS_MAGIC + struct.pack('<III', BLOCKS_VERSION, block_size, len(image))
+    for offset in range(0, len(image), block_size):
+        manifest += hashlib.sha256(image[offset:offset + block_size]).digest()
+    return manifest
+
+
+def check_image(image):
+    """Returns (errors, warnings), the image is valid if errors is empty"""
+    problems = []
+    try:
+        files, checksum, length, table = parse_image(image)
+    except ValueError as e:
+        return [str(e)], []
+
+    calculated = compute_checksum(image[HEADER_SIZE:HEADER_SIZE + length])
+    if calculated != checksum:
+        problems.append(f'checksum 0x{calculated:04X} does not match the stored 0x{checksum:04X}')
+    for name, start, _ in table:
+        if image[start:start + 2] != b'ZZ':
+            problems.append(f'file {name} has no ZZ prefix')
+
+    offset = digest_offset(length)
+    if image[offset:offset + len(DIGEST_MAGIC)] != DIGEST_MAGIC:
+        return problems, ['no digest trailer, only the 16-bit checksum protects this image']
+    version, trailer_files = struct.unpack_from('<II', image, offset + 8)
+    if version != DIGEST_VERSION or trailer_files != files:
+        problems.append(f'digest trailer version {version} with {trailer_files} files is not supported')
+        return problems, []
+    expected = build_trailer(image)
+    actual = image[offset:offset + len(expected)]
+    if actual[16:48] != expected[16:48]:
+        problems.append('image SHA-256 does not match')
+    for i, (name, _, _) in enumerate(table):
+        position = 48 + i * 32
+        if actual[position:position + 32] != expected[position:position + 32]:
+            problems.append(f'file {name} SHA-256 does not match')
+    return problems, []
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Append or check the digest trailer of assets.bin, or write its block manifest')
+    parser.add_argument('command', choices=['append', 'check', 'blocks'])
+    parser.add_argument('image', help='Path to assets.bin')
+    parser.add_argument('--block-size', type=int, default=DEFAULT_BLOCK_SIZE,
+                        help='Block size of the manifest written by the blocks command')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    if args.command == 'append':
+        image = append_digest(image)
+        with open(args.image, 'wb') as f:
+            f.write(image)
+        print(f'Digest trailer appended to {args.image}')
+        return
+
+    if args.command == 'blocks':
+        manifest = build_blocks(image, args.block_size)
+        with open(args.image + '.blocks', 'wb') as f:
+            f.write(manifest)
+        print(f'Block manifest written to {args.image}.blocks')
+        return
+
+    errors, warnings = check_image(image)
+    for warning in warnings:
+        print(f'{args.image}: warning: {warning}')
+    for error in errors:
+        print(f'{args.image}: error: {error}')
+    if errors:
+        sys.exit(1)
+    print(f'{args.image}: {struct.unpack_from("<I", image, 0)[0]} files OK')
+
+
+if __name__ == '__main__':
+    main()
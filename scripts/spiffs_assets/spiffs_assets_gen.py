@@ -20,6 +20,8 @@ from typing import List
 from pathlib import Path
 from packaging import version
 
+from assets_digest import append_digest
+
 sys.dont_write_bytecode = True
 
 GREEN = '\033[1;32m'
@@ -456,6 +458,8 @@ def pack_assets(config: PackModelsConfig):
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
     final_data = header_data + combined_data_length + combined_data
+    # SHA-256 of the image and of each file, checked once by the firmware
+    final_data = append_digest(final_data)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)
@@ -0,0 +1,30 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+
+/*
+ * Minimal checks for the host tests, no test framework needed.
+ * Each test program exits non-zero when a check failed, so ctest sees the failure.
+ */
+static int host_test_failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        host_test_failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+static inline int host_test_result() {
+    if (host_test_failures == 0) {
+        printf("All checks passed\n");
+    } else {
+        printf("%d checks failed\n", host_test_failures);
+    }
+    return host_test_failures != 0;
+}
+
+#endif // HOST_TEST_H
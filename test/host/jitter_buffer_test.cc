@@ -0,0 +1,186 @@
+/*
+ * JitterBuffer trace replay: packets arrive at given times with given sequence numbers, and
+ * the decoder pulls one frame every frame duration. The result of each pull is compared with
+ * the expected playout: a sequence number, C for a concealed frame, - for nothing to play.
+ */
+#include "host_test.h"
+#include "jitter_buffer.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#define FRAME_MS 60
+
+struct Arrival {
+    int64_t ms;
+    uint32_t sequence;
+};
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t sequence, bool has_sequence = true) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->frame_duration = FRAME_MS;
+    packet->sequence = sequence;
+    packet->has_sequence = has_sequence;
+    return packet;
+}
+
+static std::string Replay(JitterBuffer& buffer, const std::vector<Arrival>& arrivals, int64_t first_pull_ms, int pulls) {
+    std::string playout;
+    size_t next = 0;
+    for (int i = 0; i < pulls; i++) {
+        int64_t now_ms = first_pull_ms + i * FRAME_MS;
+        while (next < arrivals.size() && arrivals[next].ms <= now_ms) {
+            buffer.Push(MakePacket(arrivals[next].sequence), arrivals[next].ms * 1000);
+            next++;
+        }
+        std::unique_ptr<AudioStreamPacket> packet;
+        switch (buffer.Pop(packet, now_ms * 1000)) {
+        case kJitterBufferPacket:
+            playout += std::to_string(packet->sequence);
+            break;
+        case kJitterBufferConceal:
+            playout += "C";
+            break;
+        case kJitterBufferEmpty:
+            playout += "-";
+            break;
+        }
+        playout += i + 1 < pulls ? " " : "";
+    }
+    return playout;
+}
+
+static void TestReorder() {
+    JitterBuffer buffer(16);
+    buffer.SetReorderDepth(1);
+    // 3 overtakes 2, the target delay of two frames lets 2 arrive before its turn
+    auto playout = Replay(buffer, {{0, 1}, {60, 3}, {70, 2}, {120, 4}, {180, 5}, {240, 6}}, 0, 8);
+    CHECK(playout == "- 1 2 3 4 5 6 -", "reorder playout: %s", playout.c_str());
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.concealed_count == 0 && statistics.late_count == 0, "reorder concealed %u late %u",
+        statistics.concealed_count, statistics.late_count);
+}
+
+static void TestLoss() {
+    JitterBuffer buffer(16);
+    auto playout = Replay(buffer, {{0, 1}, {60, 2}, {180, 4}, {240, 5}}, 100, 6);
+    CHECK(playout == "1 2 C 4 5 -", "loss playout: %s", playout.c_str());
+    CHECK(buffer.GetStatistics().concealed_count == 1, "concealed %u", buffer.GetStatistics().concealed_count);
+}
+
+static void TestLate() {
+    JitterBuffer buffer(16);
+    // 3 arrives after its frame was concealed, and a duplicate of 4 after 4 played
+    auto playout = Replay(buffer, {{0, 1}, {60, 2}, {180, 4}, {240, 5}, {250, 3}, {300, 4}}, 100, 6);
+    CHECK(playout == "1 2 C 4 5 -", "late playout: %s", playout.c_str());
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.late_count == 2, "late %u", statistics.late_count);
+    CHECK(statistics.underrun_count == 0, "underrun %u", statistics.underrun_count);
+}
+
+static void TestDrainIsNotUnderrun() {
+    JitterBuffer buffer(16);
+    auto playout = Replay(buffer, {{0, 1}, {60, 2}, {120, 3}}, 60, 6);
+    CHECK(playout == "1 2 3 - - -", "drain playout: %s", playout.c_str());
+    CHECK(buffer.GetStatistics().underrun_count == 0, "the end of the stream counted as underrun");
+    CHECK(!buffer.IsBuffering() && buffer.empty(), "drained buffer not empty");
+
+    // More of the same stream shows it ran out too early
+    CHECK(buffer.Push(MakePacket(4), 500000), "packet after the drain dropped");
+    CHECK(buffer.GetStatistics().underrun_count == 1, "underrun not counted: %u", buffer.GetStatistics().underrun_count);
+
+    // A new stream starts over, its sequence numbers are not late
+    buffer.Clear();
+    CHECK(buffer.Push(MakePacket(1), 2000000), "first packet of a new stream dropped");
+    auto statistics = buffer.GetStatistics();
+    CHECK(statistics.underrun_count == 1 && statistics.late_count == 0, "new stream underrun %u late %u",
+        statistics.underrun_count, statistics.late_count);
+}
+
+static void TestSequenceZero() {
+    JitterBuffer buffer(16);
+    auto playout = Replay(buffer, {{0, 0}, {60, 1}, {120, 2}}, 60, 4);
+    CHECK(playout == "0 1 2 -", "sequence 0 playout: %s", playout.c_str());
+
+    // Sequence numbers continue across the 32 bit wrap
+    buffer.Clear();
+    playout = Replay(buffer, {{0, 0xfffffffe}, {60, 0xffffffff}, {120, 1}, {180, 2}}, 60, 5);
+    CHECK(playout == "4294967294 4294967295 C 1 2", "wrap playout: %s", playout.c_str());
+
+    // Without a transport sequence (WebSocket) packets are numbered by arrival, whatever the field holds
+    JitterBuffer arrival_buffer(16);
+    for (int i = 0; i < 3; i++) {
+        CHECK(arrival_buffer.Push(MakePacket(0, false), i * FRAME_MS * 1000), "unnumbered packet %d dropped", i);
+    }
+    int played = 0;
+    std::unique_ptr<AudioStreamPacket> packet;
+    while (arrival_buffer.Pop(packet, 200000) == kJitterBufferPacket) {
+        played++;
+    }
+    CHECK(played == 3, "played %d of 3 unnumbered packets", played);
+}
+
+static void TestRandomTrace() {
+    std::mt19937 rng(1);
+    for (double loss : {0.0, 0.05}) {
+        for (int jitter_ms : {0, 40, 150}) {
+            JitterBuffer buffer(40);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            std::uniform_int_distribution<int> delay_ms(0, jitter_ms);
+            std::multimap<int64_t, uint32_t> sorted;
+            int sent = 0;
+            for (uint32_t sequence = 1; sequence <= 500; sequence++) {
+                if (uniform(rng) < loss) {
+                    continue;
+                }
+                sorted.emplace((int64_t)sequence * FRAME_MS + delay_ms(rng), sequence);
+                sent++;
+            }
+            std::vector<Arrival> arrivals;
+            for (auto& [ms, sequence] : sorted) {
+                arrivals.push_back({ms, sequence});
+            }
+            auto playout = Replay(buffer, arrivals, 0, 520);
+
+            int played = 0;
+            uint32_t last = 0;
+            bool in_order = true;
+            size_t start = 0;
+            while (start < playout.size()) {
+                size_t end = playout.find(' ', start);
+                auto token = playout.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                if (token != "C" && token != "-") {
+                    uint32_t sequence = std::stoul(token);
+                    in_order = in_order && sequence > last;
+                    last = sequence;
+                    played++;
+                }
+                start = end == std::string::npos ? playout.size() : end + 1;
+            }
+            auto statistics = buffer.GetStatistics();
+            printf("loss %.2f jitter %3d ms: played %d/%d, concealed %u, late %u, underruns %u, target %u ms\n",
+                loss, jitter_ms, played, sent, statistics.concealed_count, statistics.late_count,
+                statistics.underrun_count, statistics.target_delay_ms);
+            CHECK(in_order, "playout out of order");
+            CHECK(played + (int)statistics.late_count + (int)statistics.overflow_count == sent,
+                "packets went missing: played %d late %u overflow %u sent %d", played,
+                statistics.late_count, statistics.overflow_count, sent);
+            if (loss == 0 && jitter_ms == 0) {
+                CHECK(statistics.late_count == 0 && statistics.underrun_count == 0, "steady stream late %u underruns %u",
+                    statistics.late_count, statistics.underrun_count);
+            }
+        }
+    }
+}
+
+int main() {
+    TestReorder();
+    TestLoss();
+    TestLate();
+    TestDrainIsNotUnderrun();
+    TestSequenceZero();
+    TestRandomTrace();
+    return host_test_result();
+}
@@ -0,0 +1,139 @@
+/*
+ * Backend selection of image_to_jpeg / image_to_jpeg_cb with mock backends in front of the
+ * software encoder: a backend that does not support the frame is skipped, one that fails
+ * before writing falls through to the next with the stream untouched, and one that fails
+ * after writing ends the encode with an error instead of appending a second image.
+ */
+#include "host_test.h"
+#include "jpeg_test_images.h"
+#include "image_to_jpeg.h"
+#include "jpeg_backend.h"
+
+#include <cstdlib>
+#include <cstring>
+
+int host_jpeg_encode_threads = 2;
+
+enum MockBehavior {
+    kMockFailBeforeWrite,
+    kMockFailAfterWrite,
+    kMockSucceed,
+};
+
+class MockJpegBackend : public JpegBackend {
+public:
+    MockJpegBackend(const char* name, bool supported, MockBehavior behavior)
+        : name_(name), supported_(supported), behavior_(behavior) {
+    }
+
+    const char* name() const override {
+        return name_;
+    }
+    bool Supports(pixformat_t format, uint16_t width, uint16_t height) const override {
+        return supported_;
+    }
+    bool Encode(const uint8_t* src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                jpge2_simple::output_stream* dst) override {
+        calls++;
+        const uint8_t soi[2] = {0xff, 0xd8};
+        switch (behavior_) {
+        case kMockFailBeforeWrite:
+            return false;
+        case kMockFailAfterWrite:
+            dst->put_buf(soi, sizeof(soi));
+            return false;
+        default:
+            dst->put_buf(soi, sizeof(soi));
+            return dst->put_buf(nullptr, 0);
+        }
+    }
+
+    int calls = 0;
+
+private:
+    const char* name_;
+    bool supported_;
+    MockBehavior behavior_;
+};
+
+struct Capture {
+    std::string data;
+    int ends = 0;
+};
+
+static size_t CaptureOutput(void* arg, size_t index, const void* data, size_t len) {
+    auto capture = (Capture*)arg;
+    if (data == nullptr) {
+        capture->ends++;
+    } else {
+        capture->data.append((const char*)data, len);
+    }
+    return len;
+}
+
+int main() {
+    int width = 320, height = 240;
+    auto frame = ToPixelFormat(MakeTestImage(kTestImageNoisy, width, height), width, height, kTestRgb565);
+    auto software = jpeg_get_backends().back();
+    CHECK(strcmp(software->name(), "software") == 0, "last backend is %s", software->name());
+    CHECK(jpeg_get_backends().size() == 1, "hardware backend on the host");
+
+    Capture reference;
+    CHECK(image_to_jpeg_cb(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, CaptureOutput, &reference),
+        "software encode failed");
+    CHECK(reference.ends == 1, "software stream ended %d times", reference.ends);
+
+    // Skipped and failing-before-write backends fall through to the software encoder, same bytes
+    MockJpegBackend skipped("skipped", false, kMockSucceed);
+    MockJpegBackend fails_early("fails_early", true, kMockFailBeforeWrite);
+    jpeg_set_backends({&skipped, &fails_early, software});
+    Capture fallthrough;
+    CHECK(image_to_jpeg_cb(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, CaptureOutput, &fallthrough),
+        "fallthrough encode failed");
+    CHECK(fallthrough.data == reference.data && fallthrough.ends == 1, "fallthrough output differs, %zu bytes, %d ends",
+        fallthrough.data.size(), fallthrough.ends);
+    CHECK(skipped.calls == 0 && fails_early.calls == 1, "skipped called %d times, fails_early %d times", skipped.calls,
+        fails_early.calls);
+
+    // The memory variant selects the same way
+    uint8_t* out = nullptr;
+    size_t out_len = 0;
+    CHECK(image_to_jpeg(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, &out, &out_len),
+        "memory encode failed");
+    CHECK(out_len == reference.data.size() && memcmp(out, reference.data.data(), out_len) == 0, "memory output differs");
+    free(out);
+
+    // Output already written cannot be taken back, the next backend is not tried
+    MockJpegBackend fails_late("fails_late", true, kMockFailAfterWrite);
+    MockJpegBackend next("next", true, kMockSucceed);
+    jpeg_set_backends({&fails_late, &next, software});
+    Capture partial;
+    CHECK(!image_to_jpeg_cb(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, CaptureOutput, &partial),
+        "failure after writing reported as success");
+    CHECK(partial.data.size() == 2 && next.calls == 0, "%zu bytes written, next backend called %d times",
+        partial.data.size(), next.calls);
+
+    // The first backend that succeeds wins
+    jpeg_set_backends({&skipped, &next, software});
+    Capture first;
+    CHECK(image_to_jpeg_cb(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, CaptureOutput, &first) &&
+        first.data.size() == 2 && first.ends == 1, "mock output not used");
+
+    // No backend supports the input
+    jpeg_set_backends({&skipped});
+    Capture unsupported;
+    CHECK(!image_to_jpeg_cb(frame.data(), frame.size(), width, height, PIXFORMAT_RGB565, 80, CaptureOutput, &unsupported) &&
+        unsupported.data.empty(), "encoded without a supporting backend");
+
+    // The benchmark reports each backend that can encode, and refuses oversized requests
+    jpeg_set_backends({&fails_early, software});
+    auto results = jpeg_benchmark(320, 240, 80, 3);
+    CHECK(results.size() == 1 && results[0].backend == "software" && results[0].fps > 0 && results[0].jpeg_size > 0,
+        "benchmark returned %zu results", results.size());
+    CHECK(jpeg_benchmark(JPEG_BENCHMARK_MAX_WIDTH + 16, 240, 80, 1).empty(), "oversized benchmark ran");
+    CHECK(jpeg_benchmark(320, 240, 80, JPEG_BENCHMARK_MAX_FRAMES + 1).empty(), "too many benchmark frames ran");
+
+    jpeg_set_backends({});
+    CHECK(jpeg_get_backends().size() == 1 && jpeg_get_backends()[0] == software, "default backends not restored");
+    return host_test_result();
+}
@@ -0,0 +1,135 @@
+/*
+ * jpge2_simple regression on the fixed image set: every image, size, subsampling and quality
+ * must encode to the same bytes as the encoder before the fused DCT and word bit writer
+ * (jpeg_encoder_baseline.inc), and decode with libjpeg to the same PSNR.
+ *
+ * An intentional change of the output regenerates the table with --print-baseline, the PSNR
+ * check then still fails if the quality got worse. Also reports the time per VGA frame.
+ */
+#include "host_test.h"
+#include "jpeg_test_images.h"
+#include "jpeg_encoder.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+// Allowed PSNR loss against the baseline, in dB
+#define JPEG_PSNR_TOLERANCE 0.05
+
+struct BaselineCase {
+    uint64_t hash;
+    uint32_t size;
+    double psnr;
+};
+
+static const BaselineCase kBaseline[] = {
+#include "jpeg_encoder_baseline.inc"
+};
+
+struct StringStream : jpge2_simple::output_stream {
+    std::string data;
+    bool put_buf(const void* buf, int len) override {
+        if (buf != nullptr) {
+            data.append((const char*)buf, len);
+        }
+        return true;
+    }
+    jpge2_simple::uint get_size() const override {
+        return data.size();
+    }
+};
+
+// Grayscale images take the green channel
+static std::vector<uint8_t> SourcePixels(const std::vector<uint8_t>& rgb, int channels) {
+    if (channels == 3) {
+        return rgb;
+    }
+    std::vector<uint8_t> gray(rgb.size() / 3);
+    for (size_t i = 0; i < gray.size(); i++) {
+        gray[i] = rgb[i * 3 + 1];
+    }
+    return gray;
+}
+
+static std::string Encode(const std::vector<uint8_t>& pixels, int width, int height, int channels, int quality, int subsampling) {
+    StringStream stream;
+    auto encoder = std::make_unique<jpge2_simple::jpeg_encoder>();
+    jpge2_simple::params params;
+    params.m_quality = quality;
+    params.m_subsampling = (jpge2_simple::subsampling_t)subsampling;
+    if (!encoder->init(&stream, width, height, channels, params)) {
+        return "";
+    }
+    for (int y = 0; y < height; y++) {
+        encoder->process_scanline(&pixels[(size_t)y * width * channels]);
+    }
+    encoder->process_scanline(nullptr);
+    return stream.data;
+}
+
+int main(int argc, char** argv) {
+    bool print_baseline = argc > 1 && strcmp(argv[1], "--print-baseline") == 0;
+    const int sizes[][2] = {{640, 480}, {321, 243}};
+    const int qualities[] = {10, 50, 80, 95, 100};
+    size_t index = 0;
+    int identical = 0;
+    if (print_baseline) {
+        printf("// Generated by jpeg_encoder_test --print-baseline: hash, size and PSNR of each case\n");
+    }
+
+    for (auto& size : sizes) {
+        int width = size[0], height = size[1];
+        for (int kind = 0; kind < kTestImageKindCount; kind++) {
+            auto image = MakeTestImage(kind, width, height);
+            for (int subsampling = jpge2_simple::Y_ONLY; subsampling <= jpge2_simple::H2V2; subsampling++) {
+                int channels = subsampling == jpge2_simple::Y_ONLY ? 1 : 3;
+                auto pixels = SourcePixels(image, channels);
+                for (int quality : qualities) {
+                    auto jpeg = Encode(pixels, width, height, channels, quality, subsampling);
+                    std::vector<uint8_t> decoded;
+                    int decoded_width = 0, decoded_height = 0, components = 0;
+                    bool clean = DecodeJpeg(jpeg, decoded, decoded_width, decoded_height, components);
+                    double psnr = Psnr(pixels, decoded);
+                    uint64_t hash = Fnv1a64(jpeg);
+
+                    if (print_baseline) {
+                        printf("    {0x%016llxull, %zu, %.2f}, // %s %dx%d sub %d q %d\n", (unsigned long long)hash,
+                            jpeg.size(), psnr, kTestImageNames[kind], width, height, subsampling, quality);
+                        continue;
+                    }
+                    CHECK(clean && decoded_width == width && decoded_height == height && components == channels,
+                        "%s %dx%d sub %d q %d does not decode", kTestImageNames[kind], width, height, subsampling, quality);
+                    if (index >= sizeof(kBaseline) / sizeof(kBaseline[0])) {
+                        CHECK(false, "no baseline for case %zu, run with --print-baseline", index);
+                        index++;
+                        continue;
+                    }
+                    const auto& baseline = kBaseline[index++];
+                    bool same = hash == baseline.hash && jpeg.size() == baseline.size;
+                    identical += same;
+                    CHECK(same, "%s %dx%d sub %d q %d: %zu bytes, baseline %u", kTestImageNames[kind], width, height,
+                        subsampling, quality, jpeg.size(), baseline.size);
+                    CHECK(psnr >= baseline.psnr - JPEG_PSNR_TOLERANCE, "%s %dx%d sub %d q %d: PSNR %.2f dB, baseline %.2f dB",
+                        kTestImageNames[kind], width, height, subsampling, quality, psnr, baseline.psnr);
+                }
+            }
+        }
+    }
+    if (print_baseline) {
+        return 0;
+    }
+    printf("%d of %zu cases byte-identical to the baseline\n", identical, index);
+
+    // Camera frame as encoded by Esp32Camera::Explain: VGA, quality 80, H2V2
+    auto image = MakeTestImage(kTestImageNoisy, 640, 480);
+    const int frames = 20;
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int i = 0; i < frames; i++) {
+        bytes += Encode(image, 640, 480, 3, 80, jpge2_simple::H2V2).size();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    printf("VGA q80 H2V2: %.2f ms per frame, %zu bytes\n", ms, bytes / frames);
+    return host_test_result();
+}
@@ -0,0 +1,142 @@
+/*
+ * Direct RGB565, grayscale and YUYV input of image_to_jpeg_cb against the line staging path it
+ * replaced (each line converted to RGB888 or Y, then process_scanline), on the fixed image set:
+ * 10 sizes, 3 formats, 3 qualities and 5 thread counts, 450 cases.
+ *
+ * RGB565 and grayscale must be byte-identical to the staging path with the same restart
+ * interval. YUYV no longer goes through RGB, so it may differ, but its decoded PSNR against the
+ * RGB image the frame was made from must not be worse. Odd-width YUYV frames must be rejected.
+ */
+#include "host_test.h"
+#include "jpeg_test_images.h"
+#include "image_to_jpeg.h"
+#include "jpeg_encoder.h"
+
+#include <memory>
+
+int host_jpeg_encode_threads = 1;
+
+// Allowed PSNR loss of the direct YUYV path, in dB
+#define YUYV_PSNR_TOLERANCE 0.3
+
+struct StringStream : jpge2_simple::output_stream {
+    std::string data;
+    bool put_buf(const void* buf, int len) override {
+        if (buf != nullptr) {
+            data.append((const char*)buf, len);
+        }
+        return true;
+    }
+    jpge2_simple::uint get_size() const override {
+        return data.size();
+    }
+};
+
+static size_t AppendOutput(void* arg, size_t index, const void* data, size_t len) {
+    if (data != nullptr) {
+        ((std::string*)arg)->append((const char*)data, len);
+    }
+    return len;
+}
+
+// The removed convert_line_format: RGB565 and YUYV to RGB888, grayscale copied
+static std::vector<uint8_t> StagingLines(const std::vector<uint8_t>& frame, int width, int height, pixformat_t format) {
+    size_t pixels = (size_t)width * height;
+    if (format == PIXFORMAT_GRAYSCALE) {
+        return frame;
+    }
+    std::vector<uint8_t> lines(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t* src = &frame[i * 2];
+        uint8_t* dst = &lines[i * 3];
+        if (format == PIXFORMAT_RGB565) {
+            dst[0] = src[0] & 0xf8;
+            dst[1] = (src[0] & 0x07) << 5 | (src[1] & 0xe0) >> 3;
+            dst[2] = (src[1] & 0x1f) << 3;
+            continue;
+        }
+        const uint8_t* pair = &frame[(i & ~(size_t)1) * 2];
+        int c = src[0] - 16, d = pair[1] - 128, e = pair[3] - 128;
+        dst[0] = std::clamp((298 * c + 409 * e + 128) >> 8, 0, 255);
+        dst[1] = std::clamp((298 * c - 100 * d - 208 * e + 128) >> 8, 0, 255);
+        dst[2] = std::clamp((298 * c + 516 * d + 128) >> 8, 0, 255);
+    }
+    return lines;
+}
+
+static std::string EncodeStaging(const std::vector<uint8_t>& lines, int width, int height, int channels, int quality, int restart_interval) {
+    StringStream stream;
+    jpge2_simple::params params;
+    params.m_quality = quality;
+    params.m_subsampling = channels == 1 ? jpge2_simple::Y_ONLY : jpge2_simple::H2V2;
+    params.m_restart_interval = restart_interval;
+    auto encoder = std::make_unique<jpge2_simple::jpeg_encoder>();
+    if (!encoder->init(&stream, width, height, channels, params)) {
+        return "";
+    }
+    for (int y = 0; y < height; y++) {
+        encoder->process_scanline(&lines[(size_t)y * width * channels]);
+    }
+    encoder->process_scanline(nullptr);
+    return stream.data;
+}
+
+static double DecodedPsnr(const std::string& jpeg, const std::vector<uint8_t>& reference) {
+    std::vector<uint8_t> decoded;
+    int width, height, components;
+    if (!DecodeJpeg(jpeg, decoded, width, height, components) || decoded.size() != reference.size()) {
+        return 0;
+    }
+    return Psnr(decoded, reference);
+}
+
+int main() {
+    const int sizes[][2] = {{320, 240}, {640, 480}, {17, 33}, {16, 32}, {100, 17}, {800, 600}, {1, 40}, {33, 9}, {240, 240}, {1600, 1200}};
+    const pixformat_t formats[] = {PIXFORMAT_RGB565, PIXFORMAT_GRAYSCALE, PIXFORMAT_YUV422};
+    int cases = 0;
+    double worst_yuyv = 99;
+
+    for (auto& size : sizes) {
+        int width = size[0], height = size[1];
+        auto image = MakeTestImage((width + height) % kTestImageKindCount, width, height);
+        for (auto format : formats) {
+            auto test_format = format == PIXFORMAT_RGB565 ? kTestRgb565 : format == PIXFORMAT_GRAYSCALE ? kTestGrayscale : kTestYuyv;
+            auto frame = ToPixelFormat(image, width, height, test_format);
+            auto lines = StagingLines(frame, width, height, format);
+            int channels = format == PIXFORMAT_GRAYSCALE ? 1 : 3;
+            int mcu_size = channels == 1 ? 8 : 16;
+            int mcu_rows = (height + mcu_size - 1) / mcu_size;
+            for (int quality : {10, 80, 95}) {
+                std::string plain = EncodeStaging(lines, width, height, channels, quality, 0);
+                for (int threads : {1, 2, 3, 4, 7}) {
+                    cases++;
+                    host_jpeg_encode_threads = threads;
+                    std::string output;
+                    bool ok = image_to_jpeg_cb(frame.data(), frame.size(), width, height, format, quality, AppendOutput, &output);
+                    if (format == PIXFORMAT_YUV422 && (width & 1)) {
+                        CHECK(!ok, "odd width YUYV %dx%d accepted", width, height);
+                        continue;
+                    }
+                    CHECK(ok, "%dx%d format %d q %d, %d threads: encode failed", width, height, format, quality, threads);
+                    if (format == PIXFORMAT_YUV422) {
+                        double direct = DecodedPsnr(output, image);
+                        double staging = DecodedPsnr(plain, image);
+                        worst_yuyv = std::min(worst_yuyv, direct - staging);
+                        CHECK(direct >= staging - YUYV_PSNR_TOLERANCE, "YUYV %dx%d q %d, %d threads: PSNR %.2f dB, staging path %.2f dB",
+                            width, height, quality, threads, direct, staging);
+                        continue;
+                    }
+                    int restart_interval = 0;
+                    if (threads > 1 && mcu_rows > 1) {
+                        restart_interval = (width + mcu_size - 1) / mcu_size * ((mcu_rows + threads - 1) / threads);
+                    }
+                    std::string reference = EncodeStaging(lines, width, height, channels, quality, restart_interval);
+                    CHECK(output == reference, "%dx%d format %d q %d, %d threads: %zu bytes, staging path %zu bytes",
+                        width, height, format, quality, threads, output.size(), reference.size());
+                }
+            }
+        }
+    }
+    printf("%d cases, worst YUYV PSNR difference direct - staging: %+.2f dB\n", cases, worst_yuyv);
+    return host_test_result();
+}
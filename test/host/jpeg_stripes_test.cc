@@ -0,0 +1,120 @@
+/*
+ * Parallel stripe encoding of image_to_jpeg_cb: for every thread count the stitched output must
+ * be a baseline JPEG that libjpeg decodes without warnings, with one restart marker between
+ * stripes, to exactly the pixels of the single-threaded output. Also measures how the encode
+ * time scales with the thread count on the fixed image set.
+ */
+#include "host_test.h"
+#include "jpeg_test_images.h"
+#include "image_to_jpeg.h"
+
+#include <chrono>
+#include <thread>
+
+int host_jpeg_encode_threads = 1;
+
+struct Capture {
+    std::string data;
+    int ends = 0;
+    bool in_order = true;
+};
+
+static size_t CaptureOutput(void* arg, size_t index, const void* data, size_t len) {
+    auto capture = (Capture*)arg;
+    if (data == nullptr) {
+        capture->ends++;
+        return len;
+    }
+    capture->in_order = capture->in_order && index == capture->data.size() && capture->ends == 0;
+    capture->data.append((const char*)data, len);
+    return len;
+}
+
+static Capture Encode(std::vector<uint8_t>& frame, int width, int height, pixformat_t format, int quality, int threads) {
+    host_jpeg_encode_threads = threads;
+    Capture capture;
+    if (!image_to_jpeg_cb(frame.data(), frame.size(), width, height, format, quality, CaptureOutput, &capture)) {
+        capture.data.clear();
+    }
+    return capture;
+}
+
+static void TestStripes() {
+    const int sizes[][2] = {{320, 240}, {640, 480}, {17, 33}, {100, 17}, {1, 40}, {33, 9}, {800, 600}};
+    const pixformat_t formats[] = {PIXFORMAT_RGB565, PIXFORMAT_GRAYSCALE};
+    int cases = 0;
+    for (auto& size : sizes) {
+        int width = size[0], height = size[1];
+        for (int kind = 0; kind < kTestImageKindCount; kind++) {
+            auto image = MakeTestImage(kind, width, height);
+            for (auto format : formats) {
+                auto frame = ToPixelFormat(image, width, height, format == PIXFORMAT_GRAYSCALE ? kTestGrayscale : kTestRgb565);
+                std::vector<uint8_t> single;
+                int mcu_size = format == PIXFORMAT_GRAYSCALE ? 8 : 16;
+                int mcu_rows = (height + mcu_size - 1) / mcu_size;
+                for (int threads : {1, 2, 3, 4, 7}) {
+                    auto capture = Encode(frame, width, height, format, 80, threads);
+                    std::vector<uint8_t> decoded;
+                    int decoded_width = 0, decoded_height = 0, components = 0;
+                    bool clean = DecodeJpeg(capture.data, decoded, decoded_width, decoded_height, components);
+                    cases++;
+                    CHECK(clean && decoded_width == width && decoded_height == height,
+                        "%s %dx%d format %d, %d threads: libjpeg decode failed", kTestImageNames[kind], width, height, format, threads);
+                    CHECK(capture.ends == 1 && capture.in_order, "%s %dx%d, %d threads: %d ends, in order %d",
+                        kTestImageNames[kind], width, height, threads, capture.ends, capture.in_order);
+
+                    int stripes = 1;
+                    if (threads > 1 && mcu_rows > 1) {
+                        int stripe_mcu_rows = (mcu_rows + threads - 1) / threads;
+                        stripes = (mcu_rows + stripe_mcu_rows - 1) / stripe_mcu_rows;
+                    }
+                    int markers = CountRestartMarkers(capture.data);
+                    CHECK(markers == stripes - 1, "%dx%d, %d threads: %d restart markers, %d stripes", width, height,
+                        threads, markers, stripes);
+
+                    if (threads == 1) {
+                        single = decoded;
+                    } else {
+                        CHECK(decoded == single, "%s %dx%d format %d, %d threads: pixels differ from one thread",
+                            kTestImageNames[kind], width, height, format, threads);
+                    }
+                }
+            }
+        }
+    }
+    printf("%d stripe cases decoded\n", cases);
+}
+
+static double EncodeMs(std::vector<uint8_t>& frame, int width, int height, int threads) {
+    double best = 1e9;
+    for (int round = 0; round < 3; round++) {
+        auto start = std::chrono::steady_clock::now();
+        Encode(frame, width, height, PIXFORMAT_RGB565, 80, threads);
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static void TestThreadScaling() {
+    // UXGA, the largest camera frame
+    int width = 1600, height = 1200;
+    auto frame = ToPixelFormat(MakeTestImage(kTestImageNoisy, width, height), width, height, kTestRgb565);
+    double one_thread = EncodeMs(frame, width, height, 1);
+    unsigned cores = std::thread::hardware_concurrency();
+    for (int threads : {1, 2, 4}) {
+        double ms = EncodeMs(frame, width, height, threads);
+        printf("%dx%d RGB565 q80, %d threads: %.2f ms, %.2fx\n", width, height, threads, ms, one_thread / ms);
+        if (threads == 2 && cores >= 2) {
+            CHECK(one_thread / ms >= 1.3, "2 threads only %.2fx faster than one", one_thread / ms);
+        }
+    }
+    if (cores < 2) {
+        printf("Single core host, thread scaling not checked\n");
+    }
+}
+
+int main() {
+    TestStripes();
+    TestThreadScaling();
+    return host_test_result();
+}
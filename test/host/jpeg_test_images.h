@@ -0,0 +1,164 @@
+#ifndef JPEG_TEST_IMAGES_H
+#define JPEG_TEST_IMAGES_H
+
+#include <jpeglib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Fixed image set of the JPEG host tests, generated so that no binary images are checked in.
+ * The same kind and size always give the same pixels, on any host.
+ */
+enum TestImageKind {
+    kTestImageGradient,     // Smooth gradients, the best case for the DCT
+    kTestImageNoisy,        // Soft texture plus sensor noise, like a camera frame
+    kTestImageChecker,      // Hard coloured edges
+    kTestImageStrokes,      // Thin dark strokes on white, like text and UI
+    kTestImageRandom,       // Incompressible, the largest output
+    kTestImageKindCount,
+};
+
+static const char* const kTestImageNames[kTestImageKindCount] = {"gradient", "noisy", "checker", "strokes", "random"};
+
+// RGB888, w * h * 3 bytes
+static std::vector<uint8_t> MakeTestImage(int kind, int width, int height) {
+    std::vector<uint8_t> image((size_t)width * height * 3);
+    uint32_t seed = 1000 + kind;
+    auto random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (int)((seed >> 16) & 0x7fff);
+    };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* p = &image[((size_t)y * width + x) * 3];
+            switch (kind) {
+            case kTestImageGradient:
+                p[0] = x * 255 / width;
+                p[1] = y * 255 / height;
+                p[2] = (x + y) * 255 / (width + height);
+                break;
+            case kTestImageNoisy: {
+                // Rounded to integers first, so the pixels do not depend on the libm of the host
+                int base = 128 + (int)std::lround(60 * std::sin(x / 23.0) * std::cos(y / 17.0));
+                for (int c = 0; c < 3; c++) {
+                    p[c] = std::clamp(base + random() % 41 - 20 + c * 10, 0, 255);
+                }
+                break;
+            }
+            case kTestImageChecker: {
+                bool on = ((x / 13) + (y / 11)) & 1;
+                p[0] = on ? 250 : 5;
+                p[1] = on ? 30 : 220;
+                p[2] = on ? 128 : 64;
+                break;
+            }
+            case kTestImageStrokes: {
+                bool stroke = (x % 37 < 3) || (y % 29 < 2) || ((x + 2 * y) % 53 < 2);
+                p[0] = p[1] = stroke ? 20 : 235;
+                p[2] = stroke ? 200 : 235;
+                break;
+            }
+            default:
+                for (int c = 0; c < 3; c++) {
+                    p[c] = random() & 0xff;
+                }
+                break;
+            }
+        }
+    }
+    return image;
+}
+
+// Frame in a camera pixel format: big-endian RGB565, grayscale (green) or YUYV (BT.601 video range)
+enum TestPixelFormat { kTestRgb565, kTestGrayscale, kTestYuyv };
+
+static std::vector<uint8_t> ToPixelFormat(const std::vector<uint8_t>& rgb, int width, int height, TestPixelFormat format) {
+    size_t pixels = (size_t)width * height;
+    std::vector<uint8_t> frame(format == kTestGrayscale ? pixels : pixels * 2);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t* p = &rgb[i * 3];
+        if (format == kTestGrayscale) {
+            frame[i] = p[1];
+        } else if (format == kTestRgb565) {
+            uint16_t value = ((p[0] & 0xf8) << 8) | ((p[1] & 0xfc) << 3) | (p[2] >> 3);
+            frame[i * 2] = value >> 8;
+            frame[i * 2 + 1] = value & 0xff;
+        } else {
+            frame[i * 2] = (66 * p[0] + 129 * p[1] + 25 * p[2] + 128) / 256 + 16;
+            // Even pixels carry U, odd pixels V, each averaged over the pair
+            const uint8_t* first = &rgb[(i & ~(size_t)1) * 3];
+            const uint8_t* second = &rgb[std::min(i | 1, pixels - 1) * 3];
+            int r = (first[0] + second[0]) / 2, g = (first[1] + second[1]) / 2, b = (first[2] + second[2]) / 2;
+            frame[i * 2 + 1] = (i & 1) ? (112 * r - 94 * g - 18 * b + 128 * 256 + 128) / 256
+                                       : (-38 * r - 74 * g + 112 * b + 128 * 256 + 128) / 256;
+        }
+    }
+    return frame;
+}
+
+// Restart markers RST0-RST7 in the entropy coded data
+static int CountRestartMarkers(const std::string& jpeg) {
+    int count = 0;
+    for (size_t i = 0; i + 1 < jpeg.size(); i++) {
+        if ((uint8_t)jpeg[i] == 0xff && ((uint8_t)jpeg[i + 1] & 0xf8) == 0xd0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static uint64_t Fnv1a64(const std::string& data) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Decodes with libjpeg as the reference decoder, false on errors or corrupt data warnings
+static bool DecodeJpeg(const std::string& jpeg, std::vector<uint8_t>& pixels, int& width, int& height, int& components) {
+    if (jpeg.size() < 4) {
+        return false;
+    }
+    jpeg_decompress_struct decoder;
+    jpeg_error_mgr error;
+    decoder.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&decoder);
+    jpeg_mem_src(&decoder, (const unsigned char*)jpeg.data(), jpeg.size());
+    if (jpeg_read_header(&decoder, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&decoder);
+        return false;
+    }
+    jpeg_start_decompress(&decoder);
+    width = decoder.output_width;
+    height = decoder.output_height;
+    components = decoder.output_components;
+    pixels.resize((size_t)width * height * components);
+    while (decoder.output_scanline < decoder.output_height) {
+        unsigned char* row = pixels.data() + (size_t)decoder.output_scanline * width * components;
+        jpeg_read_scanlines(&decoder, &row, 1);
+    }
+    bool clean = error.num_warnings == 0;
+    jpeg_finish_decompress(&decoder);
+    jpeg_destroy_decompress(&decoder);
+    return clean;
+}
+
+static double Psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    double squared_error = 0;
+    size_t count = std::min(a.size(), b.size());
+    for (size_t i = 0; i < count; i++) {
+        double diff = (double)a[i] - b[i];
+        squared_error += diff * diff;
+    }
+    if (count == 0 || squared_error == 0) {
+        return 99;
+    }
+    return 10 * std::log10(255.0 * 255.0 / (squared_error / count));
+}
+
+#endif // JPEG_TEST_IMAGES_H
@@ -0,0 +1,180 @@
+/*
+ * Server AEC alignment: PlaybackClock on a simulated I2S clock that drifts against the system
+ * timer, and SampleTimeline carrying the timestamps through a processor.
+ *
+ * The simulated codec plays at (1 + ppm) times its nominal rate and its writes block while
+ * the DMA buffer is full, like the real I2S driver. The clock only sees the write times, and
+ * must still report the server timestamp of the sample being heard within a few milliseconds
+ * over ten minutes of playback, across underruns.
+ */
+#include "host_test.h"
+#include "playback_clock.h"
+#include "sample_timeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define DMA_SAMPLES (6 * 240)
+// Largest allowed difference between the reported and the audible server timestamp
+#define MAX_ALIGNMENT_ERROR_MS 3
+
+struct SimulatedCodec {
+    double rate;
+    uint64_t written = 0;
+    // The audible position was base_position at base_us, until it reaches written
+    double base_position = 0;
+    double base_us = 0;
+
+    double Played(double now_us) const {
+        return std::min((double)written, base_position + (now_us - base_us) * rate / 1000000.0);
+    }
+
+    // Returns when the write returns, the DMA blocks until it has room for the whole block
+    double Write(size_t samples, double now_us) {
+        if (Played(now_us) >= written) {
+            // Drained, the new block starts playing right away
+            base_position = written;
+            base_us = now_us;
+        }
+        double end_us = now_us;
+        double room_at = written + samples - (double)DMA_SAMPLES;
+        if (room_at > Played(now_us)) {
+            end_us = base_us + (room_at - base_position) * 1000000.0 / rate;
+        }
+        written += samples;
+        return end_us;
+    }
+};
+
+struct Block {
+    uint64_t position;
+    size_t samples;
+    uint32_t timestamp_ms;
+};
+
+// Returns the largest alignment error in ms, and the share of queries answered
+static double RunPlayback(double ppm, size_t block_samples, double& answered, std::mt19937& rng) {
+    PlaybackClock clock(32, DMA_SAMPLES);
+    clock.SetSampleRate(SAMPLE_RATE);
+    SimulatedCodec codec;
+    codec.rate = SAMPLE_RATE * (1 + ppm / 1000000.0);
+    std::uniform_real_distribution<double> scheduling_us(0, 2000);
+
+    std::vector<Block> blocks;
+    uint32_t server_ms = 5000;
+    double now_us = 1000000;
+    double max_error_ms = 0;
+    int queries = 0;
+    int answers = 0;
+
+    auto query_until = [&](double until_us) {
+        for (double t = now_us; t < until_us; t += 7000) {
+            double played = codec.Played(t);
+            auto block = std::find_if(blocks.begin(), blocks.end(), [&](const Block& b) {
+                return played >= b.position && played < b.position + b.samples;
+            });
+            if (block == blocks.end()) {
+                continue;
+            }
+            double truth_ms = block->timestamp_ms + (played - block->position) * 1000.0 / SAMPLE_RATE;
+            uint32_t reported = clock.GetTimestamp((int64_t)t);
+            queries++;
+            if (reported != 0) {
+                answers++;
+                max_error_ms = std::max(max_error_ms, std::fabs(reported - truth_ms));
+            }
+        }
+    };
+
+    // Ten minutes of speech, in utterances of 20 s with 3 s of silence in between
+    for (int utterance = 0; utterance < 26; utterance++) {
+        size_t utterance_blocks = 20 * SAMPLE_RATE / block_samples;
+        for (size_t i = 0; i < utterance_blocks; i++) {
+            uint32_t timestamp = server_ms;
+            server_ms += block_samples * 1000 / SAMPLE_RATE;
+            blocks.push_back({codec.written, block_samples, timestamp});
+            if (blocks.size() > 64) {
+                blocks.erase(blocks.begin());
+            }
+            double start_us = now_us;
+            double end_us = codec.Write(block_samples, start_us);
+            // The input task keeps asking while the output task is blocked in the write
+            query_until(end_us);
+            now_us = end_us;
+            clock.OnOutput(timestamp, block_samples, (int64_t)start_us, (int64_t)end_us);
+            double next_us = end_us + scheduling_us(rng);
+            query_until(next_us);
+            now_us = next_us;
+        }
+        double silence_end_us = now_us + 3000000;
+        query_until(silence_end_us);
+        now_us = silence_end_us;
+    }
+    answered = queries > 0 ? (double)answers / queries : 0;
+    return max_error_ms;
+}
+
+static void TestPlaybackClockDrift() {
+    std::mt19937 rng(1);
+    for (double ppm : {-300.0, 0.0, 300.0}) {
+        for (size_t block_samples : {960, 240}) {
+            double answered;
+            double error_ms = RunPlayback(ppm, block_samples, answered, rng);
+            printf("drift %+4.0f ppm, %3zu sample blocks: max error %.2f ms, %.1f%% answered\n",
+                ppm, block_samples, error_ms, answered * 100);
+            CHECK(error_ms <= MAX_ALIGNMENT_ERROR_MS, "alignment error %.2f ms at %+.0f ppm", error_ms, ppm);
+            CHECK(answered > 0.95, "only %.1f%% of the queries answered", answered * 100);
+        }
+    }
+}
+
+static void TestPlaybackClockIdle() {
+    PlaybackClock clock(8, DMA_SAMPLES);
+    clock.SetSampleRate(SAMPLE_RATE);
+    CHECK(clock.GetTimestamp(1000000) == 0, "timestamp before any playback");
+    clock.OnOutput(1000, 960, 0, 0);
+    CHECK(clock.GetTimestamp(30000) == 1030, "timestamp inside the first block: %u", clock.GetTimestamp(30000));
+    clock.Reset();
+    CHECK(clock.GetTimestamp(30000) == 0, "timestamp after reset");
+    // Blocks without a server timestamp (local sounds) are played but not reported
+    clock.OnOutput(0, 960, 100000, 100000);
+    CHECK(clock.GetTimestamp(120000) == 0, "timestamp of a local sound");
+}
+
+static void TestSampleTimeline() {
+    // 512 sample feed chunks, 960 sample output frames like the AFE at 60 ms
+    SampleTimeline timeline(8, SAMPLE_RATE);
+    for (int i = 0; i < 6; i++) {
+        timeline.Append(512, i == 3 ? 0 : 2000 + i * 32);
+    }
+    CHECK(timeline.fed() == 6 * 512, "fed %llu samples", (unsigned long long)timeline.fed());
+    CHECK(timeline.GetTimestamp(0) == 2000, "first frame: %u", timeline.GetTimestamp(0));
+    // The second frame starts 448 samples (28 ms) into the second chunk
+    CHECK(timeline.GetTimestamp(960) == 2032 + 28, "second frame: %u", timeline.GetTimestamp(960));
+    // A frame starting in a chunk captured while nothing played has no timestamp
+    CHECK(timeline.GetTimestamp(3 * 512 + 100) == 0, "chunk without timestamp");
+    CHECK(timeline.GetTimestamp(6 * 512) == 0, "position not fed yet");
+
+    // Old chunks are forgotten once the anchors wrap
+    for (int i = 6; i < 20; i++) {
+        timeline.Append(512, 2000 + i * 32);
+    }
+    CHECK(timeline.GetTimestamp(0) == 0, "forgotten chunk still reported");
+    CHECK(timeline.GetTimestamp(19 * 512 + 16) == 2000 + 19 * 32 + 1, "last chunk: %u", timeline.GetTimestamp(19 * 512 + 16));
+
+    CHECK(!timeline.ConsumeReset(), "reset reported without a reset");
+    timeline.Reset();
+    CHECK(timeline.fed() == 0 && timeline.GetTimestamp(19 * 512) == 0, "reset kept the chunks");
+    CHECK(timeline.ConsumeReset(), "reset not reported");
+    CHECK(!timeline.ConsumeReset(), "reset reported twice");
+}
+
+int main() {
+    TestPlaybackClockIdle();
+    TestPlaybackClockDrift();
+    TestSampleTimeline();
+    return host_test_result();
+}
@@ -0,0 +1,3 @@
+#pragma once
+// protocol.h only passes cJSON pointers around, the host tests never build JSON
+typedef struct cJSON cJSON;
@@ -0,0 +1,7 @@
+#pragma once
+// The host has no SPIRAM, the encoders only reach heap_caps_* when it is enabled
+#include <stdlib.h>
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_8BIT (1 << 2)
+static inline void* heap_caps_malloc(size_t size, int) { return malloc(size); }
+static inline void* heap_caps_realloc(void* ptr, size_t size, int) { return realloc(ptr, size); }
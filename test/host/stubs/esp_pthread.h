@@ -0,0 +1,11 @@
+#pragma once
+// std::thread takes no attributes on the host, the configuration is accepted and ignored
+#include <stddef.h>
+typedef struct {
+    size_t stack_size;
+    int prio;
+    const char* thread_name;
+    int pin_to_core;
+} esp_pthread_cfg_t;
+static inline esp_pthread_cfg_t esp_pthread_get_default_config() { return {3072, 5, nullptr, -1}; }
+static inline int esp_pthread_set_cfg(const esp_pthread_cfg_t*) { return 0; }
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+static inline int64_t esp_timer_get_time() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
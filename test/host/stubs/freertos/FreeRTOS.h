@@ -0,0 +1,5 @@
+#pragma once
+#define portNUM_PROCESSORS 2
+static inline int xPortGetCoreID() { return 0; }
+// The JPEG tests choose the stripe thread count at run time, see JPEG_ENCODE_THREADS in CMakeLists.txt
+extern int host_jpeg_encode_threads;
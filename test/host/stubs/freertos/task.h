@@ -0,0 +1,4 @@
+#pragma once
+typedef void* TaskHandle_t;
+typedef unsigned int UBaseType_t;
+static inline UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 5; }
@@ -0,0 +1,2 @@
+#pragma once
+// No SoC features on the host, e.g. the JPEG hardware backend compiles to nullptr